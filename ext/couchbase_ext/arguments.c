@@ -17,6 +17,78 @@
 
 #include "couchbase_ext.h"
 
+/* The arena won't grow beyond this size, larger commands use heap */
+#define ARENA_MAX_SIZE (64 * 1024)
+#define ARENA_MIN_SIZE 1024
+
+/* The multi-key commands bigger than this are split into windows, which
+ * are scheduled as the responses for the previous ones arrive (see
+ * cb_context_window_next). It bounds the memory used for the command
+ * arguments and for the output buffers of the library. The keys are
+ * counted before the command is built, the bytes are counted as the
+ * values are encoded (see cb_params_store_extract_keys_i) */
+#define WINDOW_MAX_KEYS 4096
+#define WINDOW_MAX_BYTES (4 * 1024 * 1024)
+
+/* Allocate the block for the array of the commands followed by the array
+ * of the pointers to them. Usually the block is taken from the arena of
+ * the bucket, which is reused between operations. The heap is used when
+ * the arena is occupied (e.g. by other thread) or the block is too big. */
+    static void *
+cb_params_alloc_block(struct params_st *params, lcb_size_t num, size_t item_size)
+{
+    struct arena_st *arena = &params->bucket->arena;
+    size_t size = num * (item_size + sizeof(void *));
+    void *block;
+
+    if (!arena->busy && size <= ARENA_MAX_SIZE) {
+        if (arena->capacity < size) {
+            size_t capacity = arena->capacity ? arena->capacity : ARENA_MIN_SIZE;
+            while (capacity < size) {
+                capacity *= 2;
+            }
+            block = xrealloc(arena->data, capacity);
+            if (block == NULL) {
+                rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
+            }
+            arena->data = block;
+            arena->capacity = capacity;
+        }
+        arena->busy = 1;
+        params->from_arena = 1;
+        block = arena->data;
+        memset(block, 0, size);
+    } else {
+        block = xcalloc(1, size);
+        if (block == NULL) {
+            rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
+        }
+    }
+    params->block = block;
+    return block;
+}
+
+/* Convert the key to String and remember it, so that the callbacks could
+ * return the same object (see cb_context_key). The only key of the
+ * command is kept as is, the Array is allocated for the second one.
+ * Returns the key with the prefix of the bucket */
+    static VALUE
+cb_params_key(struct params_st *params, VALUE key_obj)
+{
+    struct bucket_st *bucket = params->bucket;
+
+    key_obj = unify_key(bucket, key_obj, 0);
+    if (NIL_P(params->keys)) {
+        params->keys = key_obj;
+    } else {
+        if (TYPE(params->keys) == T_STRING) {
+            params->keys = rb_ary_new3(1, params->keys);
+        }
+        rb_ary_push(params->keys, key_obj);
+    }
+    return bucket->key_prefix ? rb_str_plus(bucket->key_prefix_val, key_obj) : key_obj;
+}
+
 
 /* TOUCH */
 
@@ -26,14 +98,8 @@ cb_params_touch_alloc(struct params_st *params, lcb_size_t size)
     lcb_size_t ii;
 
     params->cmd.touch.num = size;
-    params->cmd.touch.items = xcalloc(size, sizeof(lcb_touch_cmd_t));
-    if (params->cmd.touch.items == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
-    params->cmd.touch.ptr = xcalloc(size, sizeof(lcb_touch_cmd_t *));
-    if (params->cmd.touch.ptr == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
+    params->cmd.touch.items = cb_params_alloc_block(params, size, sizeof(lcb_touch_cmd_t));
+    params->cmd.touch.ptr = (const lcb_touch_cmd_t **)(params->cmd.touch.items + size);
     for (ii = 0; ii < size; ++ii) {
         params->cmd.touch.ptr[ii] = params->cmd.touch.items + ii;
     }
@@ -42,7 +108,7 @@ cb_params_touch_alloc(struct params_st *params, lcb_size_t size)
     static void
 cb_params_touch_init_item(struct params_st *params, lcb_size_t idx, VALUE key_obj, lcb_time_t exptime)
 {
-    key_obj = unify_key(params->bucket, key_obj, 1);
+    key_obj = cb_params_key(params, key_obj);
     params->cmd.touch.items[idx].v.v0.key = RSTRING_PTR(key_obj);
     params->cmd.touch.items[idx].v.v0.nkey = RSTRING_LEN(key_obj);
     params->cmd.touch.items[idx].v.v0.exptime = exptime;
@@ -122,14 +188,8 @@ cb_params_remove_alloc(struct params_st *params, lcb_size_t size)
     lcb_size_t ii;
 
     params->cmd.remove.num = size;
-    params->cmd.remove.items = xcalloc(size, sizeof(lcb_remove_cmd_t));
-    if (params->cmd.remove.items == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
-    params->cmd.remove.ptr = xcalloc(size, sizeof(lcb_remove_cmd_t *));
-    if (params->cmd.remove.ptr == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
+    params->cmd.remove.items = cb_params_alloc_block(params, size, sizeof(lcb_remove_cmd_t));
+    params->cmd.remove.ptr = (const lcb_remove_cmd_t **)(params->cmd.remove.items + size);
     for (ii = 0; ii < size; ++ii) {
         params->cmd.remove.ptr[ii] = params->cmd.remove.items + ii;
     }
@@ -138,7 +198,7 @@ cb_params_remove_alloc(struct params_st *params, lcb_size_t size)
     static void
 cb_params_remove_init_item(struct params_st *params, lcb_size_t idx, VALUE key_obj, lcb_cas_t cas)
 {
-    key_obj = unify_key(params->bucket, key_obj, 1);
+    key_obj = cb_params_key(params, key_obj);
     params->cmd.remove.items[idx].v.v0.key = RSTRING_PTR(key_obj);
     params->cmd.remove.items[idx].v.v0.nkey = RSTRING_LEN(key_obj);
     params->cmd.remove.items[idx].v.v0.cas = cas;
@@ -217,14 +277,8 @@ cb_params_store_alloc(struct params_st *params, lcb_size_t size)
     lcb_size_t ii;
 
     params->cmd.store.num = size;
-    params->cmd.store.items = xcalloc(size, sizeof(lcb_store_cmd_t));
-    if (params->cmd.store.items == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
-    params->cmd.store.ptr = xcalloc(size, sizeof(lcb_store_cmd_t *));
-    if (params->cmd.store.ptr == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
+    params->cmd.store.items = cb_params_alloc_block(params, size, sizeof(lcb_store_cmd_t));
+    params->cmd.store.ptr = (const lcb_store_cmd_t **)(params->cmd.store.items + size);
     for (ii = 0; ii < size; ++ii) {
         params->cmd.store.ptr[ii] = params->cmd.store.items + ii;
     }
@@ -235,12 +289,29 @@ cb_params_store_init_item(struct params_st *params, lcb_size_t idx,
         VALUE key_obj, VALUE value_obj, lcb_uint32_t flags, lcb_cas_t cas,
         lcb_time_t exptime)
 {
-    key_obj = unify_key(params->bucket, key_obj, 1);
-    value_obj = encode_value(value_obj, params->cmd.store.flags);
+    key_obj = cb_params_key(params, key_obj);
+    if (params->cmd.store.encoded) {
+        if (TYPE(value_obj) != T_STRING) {
+            rb_raise(eValueFormatError, "the encoded value for key '%s' must be String", RSTRING_PTR(key_obj));
+        }
+    } else {
+        value_obj = encode_value(value_obj, params->cmd.store.flags);
+    }
     if (value_obj == Qundef) {
         rb_raise(eValueFormatError, "unable to convert value for key '%s'", RSTRING_PTR(key_obj));
     }
     params->cmd.store.items[idx].v.v0.datatype = params->cmd.store.datatype;
+    /* the appended chunk cannot be compressed on its own */
+    if (params->cmd.store.compression && params->cmd.store.operation != LCB_APPEND
+            && params->cmd.store.operation != LCB_PREPEND) {
+        VALUE compressed = cb_compress_value(value_obj, params->cmd.store.compression,
+                params->cmd.store.compression_min_size);
+        if (compressed != value_obj) {
+            /* the server shouldn't treat it as JSON anymore */
+            params->cmd.store.items[idx].v.v0.datatype = 0x00;
+            value_obj = compressed;
+        }
+    }
     params->cmd.store.items[idx].v.v0.operation = params->cmd.store.operation;
     params->cmd.store.items[idx].v.v0.key = RSTRING_PTR(key_obj);
     params->cmd.store.items[idx].v.v0.nkey = RSTRING_LEN(key_obj);
@@ -258,6 +329,10 @@ cb_params_store_extract_keys_i(VALUE key, VALUE value, VALUE arg)
     struct params_st *params = (struct params_st *)arg;
     cb_params_store_init_item(params, params->idx++, key, value,
             params->cmd.store.flags, 0, params->cmd.store.ttl);
+    if (params->npayload > WINDOW_MAX_BYTES && params->idx >= 2) {
+        /* the rest of pairs go to the next window (see cb_params_window_cut) */
+        return ST_STOP;
+    }
     return ST_CONTINUE;
 }
 
@@ -281,10 +356,16 @@ cb_params_store_parse_options(struct params_st *params, VALUE options)
     if (tmp != Qnil) {
         params->cmd.store.ttl = NUM2ULONG(tmp);
     }
+    params->cmd.store.encoded = RTEST(rb_hash_aref(options, sym_encoded));
     tmp = rb_hash_aref(options, sym_cas);
     if (tmp != Qnil) {
         params->cmd.store.cas = NUM2ULL(tmp);
     }
+    if (RTEST(rb_funcall(options, id_has_key_p, 1, sym_compression))) {
+        cb_compression_parse(rb_hash_aref(options, sym_compression),
+                &params->cmd.store.compression,
+                &params->cmd.store.compression_min_size);
+    }
     tmp = rb_hash_aref(options, sym_observe);
     if (tmp != Qnil) {
         Check_Type(tmp, T_HASH);
@@ -314,6 +395,7 @@ cb_params_store_parse_arguments(struct params_st *params, int argc, VALUE argv)
                     cb_params_store_alloc(params, RHASH_SIZE(keys));
                     rb_hash_foreach(keys, cb_params_store_extract_keys_i,
                             (VALUE)params);
+                    params->cmd.store.num = params->idx;
                     break;
                 default:
                     rb_raise(rb_eArgError, "there must be either Hash with key-value pairs"
@@ -340,26 +422,14 @@ cb_params_get_alloc(struct params_st *params, lcb_size_t size)
 
     params->cmd.get.num = size;
     if (params->cmd.get.replica) {
-        params->cmd.get.items = xcalloc(size, sizeof(lcb_get_replica_cmd_t));
-        if (params->cmd.get.items_gr == NULL) {
-            rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-        }
-        params->cmd.get.ptr = xcalloc(size, sizeof(lcb_get_replica_cmd_t *));
-        if (params->cmd.get.ptr_gr == NULL) {
-            rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-        }
+        params->cmd.get.items_gr = cb_params_alloc_block(params, size, sizeof(lcb_get_replica_cmd_t));
+        params->cmd.get.ptr_gr = (const lcb_get_replica_cmd_t **)(params->cmd.get.items_gr + size);
         for (ii = 0; ii < size; ++ii) {
             params->cmd.get.ptr_gr[ii] = params->cmd.get.items_gr + ii;
         }
     } else {
-        params->cmd.get.items = xcalloc(size, sizeof(lcb_get_cmd_t));
-        if (params->cmd.get.items == NULL) {
-            rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-        }
-        params->cmd.get.ptr = xcalloc(size, sizeof(lcb_get_cmd_t *));
-        if (params->cmd.get.ptr == NULL) {
-            rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-        }
+        params->cmd.get.items = cb_params_alloc_block(params, size, sizeof(lcb_get_cmd_t));
+        params->cmd.get.ptr = (const lcb_get_cmd_t **)(params->cmd.get.items + size);
         for (ii = 0; ii < size; ++ii) {
             params->cmd.get.ptr[ii] = params->cmd.get.items + ii;
         }
@@ -370,7 +440,7 @@ cb_params_get_alloc(struct params_st *params, lcb_size_t size)
 cb_params_get_init_item(struct params_st *params, lcb_size_t idx,
         VALUE key_obj, lcb_time_t exptime)
 {
-    key_obj = unify_key(params->bucket, key_obj, 1);
+    key_obj = cb_params_key(params, key_obj);
     if (params->cmd.get.replica) {
         params->cmd.get.items_gr[idx].v.v0.key = RSTRING_PTR(key_obj);
         params->cmd.get.items_gr[idx].v.v0.nkey = RSTRING_LEN(key_obj);
@@ -388,7 +458,6 @@ cb_params_get_init_item(struct params_st *params, lcb_size_t idx,
 cb_params_get_extract_keys_i(VALUE key, VALUE value, VALUE arg)
 {
     struct params_st *params = (struct params_st *)arg;
-    rb_ary_push(params->cmd.get.keys_ary, key);
     cb_params_get_init_item(params, params->idx++, key, NUM2ULONG(value));
     return ST_CONTINUE;
 }
@@ -404,6 +473,7 @@ cb_params_get_parse_options(struct params_st *params, VALUE options)
     params->cmd.get.replica = RTEST(rb_hash_aref(options, sym_replica));
     params->cmd.get.extended = RTEST(rb_hash_aref(options, sym_extended));
     params->cmd.get.assemble_hash = RTEST(rb_hash_aref(options, sym_assemble_hash));
+    params->cmd.get.lazy = RTEST(rb_hash_aref(options, sym_lazy));
     if (RTEST(rb_funcall(options, id_has_key_p, 1, sym_quiet))) {
         params->cmd.get.quiet = RTEST(rb_hash_aref(options, sym_quiet));
     }
@@ -442,7 +512,6 @@ cb_params_get_parse_arguments(struct params_st *params, int argc, VALUE argv)
                 params->cmd.get.array = 1;
                 cb_params_get_alloc(params, RARRAY_LEN(keys));
                 for (ii = 0; ii < params->cmd.get.num; ++ii) {
-                    rb_ary_push(params->cmd.get.keys_ary, RARRAY_PTR(keys)[ii]);
                     cb_params_get_init_item(params, ii, RARRAY_PTR(keys)[ii], params->cmd.get.ttl);
                 }
                 break;
@@ -458,14 +527,12 @@ cb_params_get_parse_arguments(struct params_st *params, int argc, VALUE argv)
             default:
                 /* single key */
                 cb_params_get_alloc(params, 1);
-                rb_ary_push(params->cmd.get.keys_ary, keys);
                 cb_params_get_init_item(params, 0, keys, params->cmd.get.ttl);
         }
     } else {
         /* just list of arguments */
         cb_params_get_alloc(params, argc);
         for (ii = 0; ii < params->cmd.get.num; ++ii) {
-            rb_ary_push(params->cmd.get.keys_ary, RARRAY_PTR(argv)[ii]);
             cb_params_get_init_item(params, ii, RARRAY_PTR(argv)[ii], params->cmd.get.ttl);
         }
     }
@@ -479,14 +546,8 @@ cb_params_arith_alloc(struct params_st *params, lcb_size_t size)
     lcb_size_t ii;
 
     params->cmd.arith.num = size;
-    params->cmd.arith.items = xcalloc(size, sizeof(lcb_arithmetic_cmd_t));
-    if (params->cmd.arith.items == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
-    params->cmd.arith.ptr = xcalloc(size, sizeof(lcb_arithmetic_cmd_t *));
-    if (params->cmd.arith.ptr == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
+    params->cmd.arith.items = cb_params_alloc_block(params, size, sizeof(lcb_arithmetic_cmd_t));
+    params->cmd.arith.ptr = (const lcb_arithmetic_cmd_t **)(params->cmd.arith.items + size);
     for (ii = 0; ii < size; ++ii) {
         params->cmd.arith.ptr[ii] = params->cmd.arith.items + ii;
     }
@@ -496,7 +557,7 @@ cb_params_arith_alloc(struct params_st *params, lcb_size_t size)
 cb_params_arith_init_item(struct params_st *params, lcb_size_t idx,
         VALUE key_obj, lcb_int64_t delta)
 {
-    key_obj = unify_key(params->bucket, key_obj, 1);
+    key_obj = cb_params_key(params, key_obj);
     params->cmd.arith.items[idx].v.v0.key = RSTRING_PTR(key_obj);
     params->cmd.arith.items[idx].v.v0.nkey = RSTRING_LEN(key_obj);
     params->cmd.arith.items[idx].v.v0.delta = delta * params->cmd.arith.sign;
@@ -593,14 +654,8 @@ cb_params_stats_alloc(struct params_st *params, lcb_size_t size)
     lcb_size_t ii;
 
     params->cmd.stats.num = size;
-    params->cmd.stats.items = xcalloc(size, sizeof(lcb_server_stats_cmd_t));
-    if (params->cmd.stats.items == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
-    params->cmd.stats.ptr = xcalloc(size, sizeof(lcb_server_stats_cmd_t *));
-    if (params->cmd.stats.ptr == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
+    params->cmd.stats.items = cb_params_alloc_block(params, size, sizeof(lcb_server_stats_cmd_t));
+    params->cmd.stats.ptr = (const lcb_server_stats_cmd_t **)(params->cmd.stats.items + size);
     for (ii = 0; ii < size; ++ii) {
         params->cmd.stats.ptr[ii] = params->cmd.stats.items + ii;
     }
@@ -658,14 +713,8 @@ cb_params_observe_alloc(struct params_st *params, lcb_size_t size)
     lcb_size_t ii;
 
     params->cmd.observe.num = size;
-    params->cmd.observe.items = xcalloc(size, sizeof(lcb_observe_cmd_t));
-    if (params->cmd.observe.items == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
-    params->cmd.observe.ptr = xcalloc(size, sizeof(lcb_observe_cmd_t *));
-    if (params->cmd.observe.ptr == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
+    params->cmd.observe.items = cb_params_alloc_block(params, size, sizeof(lcb_observe_cmd_t));
+    params->cmd.observe.ptr = (const lcb_observe_cmd_t **)(params->cmd.observe.items + size);
     for (ii = 0; ii < size; ++ii) {
         params->cmd.observe.ptr[ii] = params->cmd.observe.items + ii;
     }
@@ -674,7 +723,7 @@ cb_params_observe_alloc(struct params_st *params, lcb_size_t size)
     static void
 cb_params_observe_init_item(struct params_st *params, lcb_size_t idx, VALUE key_obj)
 {
-    key_obj = unify_key(params->bucket, key_obj, 1);
+    key_obj = cb_params_key(params, key_obj);
     params->cmd.observe.items[idx].v.v0.key = RSTRING_PTR(key_obj);
     params->cmd.observe.items[idx].v.v0.nkey = RSTRING_LEN(key_obj);
     params->npayload += RSTRING_LEN(key_obj);
@@ -721,14 +770,8 @@ cb_params_unlock_alloc(struct params_st *params, lcb_size_t size)
     lcb_size_t ii;
 
     params->cmd.unlock.num = size;
-    params->cmd.unlock.items = xcalloc(size, sizeof(lcb_unlock_cmd_t));
-    if (params->cmd.unlock.items == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
-    params->cmd.unlock.ptr = xcalloc(size, sizeof(lcb_unlock_cmd_t *));
-    if (params->cmd.unlock.ptr == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
+    params->cmd.unlock.items = cb_params_alloc_block(params, size, sizeof(lcb_unlock_cmd_t));
+    params->cmd.unlock.ptr = (const lcb_unlock_cmd_t **)(params->cmd.unlock.items + size);
     for (ii = 0; ii < size; ++ii) {
         params->cmd.unlock.ptr[ii] = params->cmd.unlock.items + ii;
     }
@@ -737,7 +780,7 @@ cb_params_unlock_alloc(struct params_st *params, lcb_size_t size)
     static void
 cb_params_unlock_init_item(struct params_st *params, lcb_size_t idx, VALUE key_obj, lcb_cas_t cas)
 {
-    key_obj = unify_key(params->bucket, key_obj, 1);
+    key_obj = cb_params_key(params, key_obj);
     params->cmd.unlock.items[idx].v.v0.key = RSTRING_PTR(key_obj);
     params->cmd.unlock.items[idx].v.v0.nkey = RSTRING_LEN(key_obj);
     params->cmd.unlock.items[idx].v.v0.cas = cas;
@@ -796,14 +839,8 @@ cb_params_unlock_parse_arguments(struct params_st *params, int argc, VALUE argv)
 cb_params_version_alloc(struct params_st *params)
 {
     params->cmd.version.num = 1;
-    params->cmd.version.items = xcalloc(1, sizeof(lcb_server_version_cmd_t));
-    if (params->cmd.version.items == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
-    params->cmd.version.ptr = xcalloc(1, sizeof(lcb_server_version_cmd_t *));
-    if (params->cmd.version.ptr == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for arguments");
-    }
+    params->cmd.version.items = cb_params_alloc_block(params, 1, sizeof(lcb_server_version_cmd_t));
+    params->cmd.version.ptr = (const lcb_server_version_cmd_t **)(params->cmd.version.items + 1);
     params->cmd.version.ptr[0] = params->cmd.version.items;
 }
 
@@ -812,42 +849,132 @@ cb_params_version_alloc(struct params_st *params)
     void
 cb_params_destroy(struct params_st *params)
 {
-#define _release_data_for(type) \
-    xfree(params->cmd.type.items); \
-    xfree(params->cmd.type.ptr);
+    if (params->from_arena) {
+        /* the arena is ready for the next command */
+        params->bucket->arena.busy = 0;
+        params->from_arena = 0;
+    } else {
+        xfree(params->block);
+    }
+    params->block = NULL;
+}
 
-    switch (params->type) {
-        case cmd_get:
-            _release_data_for(get);
-            xfree(params->cmd.get.items_gr);
-            xfree(params->cmd.get.ptr_gr);
-            break;
-        case cmd_touch:
-            _release_data_for(touch);
-            break;
-        case cmd_arith:
-            _release_data_for(arith);
-            break;
-        case cmd_remove:
-            _release_data_for(remove);
-            break;
-        case cmd_store:
-            _release_data_for(store);
-            break;
-        case cmd_stats:
-            _release_data_for(stats);
-            break;
-        case cmd_version:
-            _release_data_for(version);
-            break;
-        case cmd_observe:
-            _release_data_for(observe);
-            break;
-        case cmd_unlock:
-            _release_data_for(unlock);
-            break;
+/* WINDOWS */
+
+
+/* The window state is the Array [type, operation, source, keys, options],
+ * where +source+ is the Hash passed to the operation or nil */
+#define WINDOW_TYPE 0
+#define WINDOW_OPERATION 1
+#define WINDOW_SOURCE 2
+#define WINDOW_KEYS 3
+#define WINDOW_OPTIONS 4
+
+/* Returns the number of keys in the window starting at +pos+. The store
+ * commands might take less of them, when the encoded values exceed
+ * WINDOW_MAX_BYTES */
+    static size_t
+window_length(VALUE window, size_t pos)
+{
+    size_t nkeys = RARRAY_LEN(RARRAY_PTR(window)[WINDOW_KEYS]);
+
+    return nkeys - pos < WINDOW_MAX_KEYS ? nkeys - pos : WINDOW_MAX_KEYS;
+}
+
+/* Returns the argument for the keys of the window in the same form as
+ * the operation has received them: Array or Hash */
+    static VALUE
+window_slice(VALUE window, size_t pos, size_t len)
+{
+    VALUE source = RARRAY_PTR(window)[WINDOW_SOURCE];
+    VALUE keys = RARRAY_PTR(window)[WINDOW_KEYS];
+    VALUE slice, key;
+    size_t ii;
+
+    if (NIL_P(source)) {
+        return rb_ary_subseq(keys, pos, len);
     }
-#undef _release_data_for
+    slice = rb_hash_new();
+    for (ii = pos; ii < pos + len; ++ii) {
+        key = RARRAY_PTR(keys)[ii];
+        rb_hash_aset(slice, key, rb_hash_aref(source, key));
+    }
+    return slice;
+}
+
+/* Split the command if it has too many keys (see also cb_params_window_cut).
+ * The arguments are replaced with the first window, and the rest is kept
+ * in +params->window+ */
+    static void
+cb_params_window_split(struct params_st *params, int *argc, VALUE argv, VALUE opts)
+{
+    VALUE source = Qnil, keys, window;
+    size_t len;
+
+    if (*argc == 1) {
+        keys = RARRAY_PTR(argv)[0];
+        switch (TYPE(keys)) {
+            case T_ARRAY:
+                if (params->type == cmd_store || RARRAY_LEN(keys) <= WINDOW_MAX_KEYS) {
+                    return;
+                }
+                break;
+            case T_HASH:
+                if (RHASH_SIZE(keys) <= WINDOW_MAX_KEYS) {
+                    return;
+                }
+                source = keys;
+                keys = rb_funcall(source, id_keys, 0);
+                break;
+            default:
+                return;
+        }
+    } else if (*argc > WINDOW_MAX_KEYS && params->type != cmd_store) {
+        /* just list of arguments */
+        keys = rb_ary_new4(*argc, RARRAY_PTR(argv));
+    } else {
+        return;
+    }
+    window = rb_ary_new3(5, INT2FIX(params->type),
+            INT2FIX(params->type == cmd_store ? params->cmd.store.operation : 0),
+            source, keys, opts);
+    len = window_length(window, 0);
+    if (len == (size_t)RARRAY_LEN(keys)) {
+        return;
+    }
+    rb_ary_clear(argv);
+    rb_ary_push(argv, window_slice(window, 0, len));
+    *argc = 1;
+    params->window = window;
+    params->window_pos = len;
+    params->total = RARRAY_LEN(keys);
+    /* the keys of the next windows will be appended to this Array */
+    params->keys = rb_ary_new2(len);
+}
+
+/* Move the pairs which didn't fit into the first window of the multi-set
+ * (see cb_params_store_extract_keys_i) to the next windows */
+    static void
+cb_params_window_cut(struct params_st *params, VALUE argv, VALUE opts)
+{
+    VALUE source = RARRAY_PTR(argv)[0];
+
+    if (!NIL_P(params->window)) {
+        params->window_pos = params->cmd.store.num;
+        return;
+    }
+    params->window = rb_ary_new3(5, INT2FIX(params->type),
+            INT2FIX(params->cmd.store.operation), source,
+            rb_funcall(source, id_keys, 0), opts);
+    params->window_pos = params->cmd.store.num;
+    params->total = RHASH_SIZE(source);
+}
+
+/* Returns the number of keys in all windows of the command */
+    size_t
+cb_params_window_total(VALUE window)
+{
+    return RARRAY_LEN(RARRAY_PTR(window)[WINDOW_KEYS]);
 }
 
 struct build_params_st
@@ -855,6 +982,7 @@ struct build_params_st
     struct params_st *params;
     int argc;
     VALUE argv;
+    int split;
 };
 
     static VALUE
@@ -876,6 +1004,21 @@ do_params_build(VALUE ptr)
     }
 
     params->npayload = PACKET_HEADER_SIZE; /* size of packet header */
+    params->keys = Qnil;
+    params->window = Qnil;
+    if (p->split) {
+        switch (params->type) {
+            case cmd_touch:
+            case cmd_remove:
+            case cmd_store:
+            case cmd_get:
+                cb_params_window_split(params, &argc, argv, opts);
+                break;
+            default:
+                break;
+        }
+    }
+    params->error_codes = params->bucket->error_codes;
     switch (params->type) {
         case cmd_touch:
             params->cmd.touch.quiet = params->bucket->quiet;
@@ -897,7 +1040,10 @@ do_params_build(VALUE ptr)
             cb_params_remove_parse_arguments(params, argc, argv);
             break;
         case cmd_store:
-            if (argc == 1 && opts != Qnil) {
+            /* set(key, hash) stores the Hash as the value, while for the
+             * multi-set the last Hash carries the options of all pairs
+             * (e.g. set({"a" => 1, "b" => 2}, :batch_callback => true)) */
+            if (argc == 1 && opts != Qnil && TYPE(RARRAY_PTR(argv)[0]) != T_HASH) {
                 /* put last hash back because it is the value */
                 rb_ary_push(argv, opts);
                 opts = Qnil;
@@ -908,8 +1054,19 @@ do_params_build(VALUE ptr)
             params->cmd.store.flags = flags_set_format(params->bucket->default_flags,
                     params->bucket->default_format);
             params->cmd.store.observe = Qnil;
+            params->cmd.store.compression = params->bucket->compression;
+            params->cmd.store.compression_min_size = params->bucket->compression_min_size;
             cb_params_store_parse_options(params, opts);
+            if (params->cmd.store.operation == LCB_APPEND ||
+                    params->cmd.store.operation == LCB_PREPEND) {
+                /* the parts cannot be compressed separately */
+                params->cmd.store.compression = 0;
+            }
             cb_params_store_parse_arguments(params, argc, argv);
+            if (p->split && argc == 1 &&
+                    params->cmd.store.num < RHASH_SIZE(RARRAY_PTR(argv)[0])) {
+                cb_params_window_cut(params, argv, opts);
+            }
             break;
         case cmd_get:
             params->cmd.get.quiet = params->bucket->quiet;
@@ -951,12 +1108,18 @@ do_params_build(VALUE ptr)
             cb_params_unlock_parse_arguments(params, argc, argv);
             break;
     }
+    if (opts != Qnil) {
+        params->batch = RTEST(rb_hash_aref(opts, sym_batch_callback));
+        if (RTEST(rb_funcall(opts, id_has_key_p, 1, sym_errors))) {
+            params->error_codes = cb_errors_parse(rb_hash_aref(opts, sym_errors));
+        }
+    }
 
     return Qnil;
 }
 
-    void
-cb_params_build(struct params_st *params, int argc, VALUE argv)
+    static void
+params_build(struct params_st *params, int argc, VALUE argv, int split)
 {
     int fail = 0;
     struct build_params_st args;
@@ -964,6 +1127,7 @@ cb_params_build(struct params_st *params, int argc, VALUE argv)
     args.params = params;
     args.argc = argc;
     args.argv = argv;
+    args.split = split;
     rb_protect(do_params_build, (VALUE)&args, &fail);
     if (fail) {
         cb_params_destroy(params);
@@ -971,3 +1135,32 @@ cb_params_build(struct params_st *params, int argc, VALUE argv)
         rb_jump_tag(fail);
     }
 }
+
+    void
+cb_params_build(struct params_st *params, int argc, VALUE argv)
+{
+    params_build(params, argc, argv, 1);
+}
+
+/* Build the parameters for the next window of the command split by
+ * cb_params_build(), and advance +pos+ to the following one */
+    void
+cb_params_build_window(struct params_st *params, struct bucket_st *bucket, VALUE window, size_t *pos)
+{
+    VALUE args, opts = RARRAY_PTR(window)[WINDOW_OPTIONS];
+    size_t len = window_length(window, *pos);
+
+    memset(params, 0, sizeof(struct params_st));
+    params->type = FIX2INT(RARRAY_PTR(window)[WINDOW_TYPE]);
+    params->bucket = bucket;
+    if (params->type == cmd_store) {
+        params->cmd.store.operation = FIX2INT(RARRAY_PTR(window)[WINDOW_OPERATION]);
+    }
+    args = rb_ary_new3(1, window_slice(window, *pos, len));
+    if (opts != Qnil) {
+        rb_ary_push(args, opts);
+    }
+    params_build(params, RARRAY_LEN(args), args, 0);
+    /* the rest of the store window is left for the next one */
+    *pos += params->type == cmd_store ? params->cmd.store.num : len;
+}
@@ -22,20 +22,21 @@ arithmetic_callback(lcb_t handle, const void *cookie, lcb_error_t error, const l
 {
     struct context_st *ctx = (struct context_st *)cookie;
     struct bucket_st *bucket = ctx->bucket;
+    const char *msg = "failed to perform arithmetic operation";
     VALUE cas, key, val, *rv = ctx->rv, exc, res;
+    struct result_st *r;
     ID o;
 
     ctx->nqueries--;
-    key = STR_NEW((const char*)resp->v.v0.key, resp->v.v0.nkey);
-    strip_key_prefix(bucket, key);
+    key = cb_context_key(ctx, (const char*)resp->v.v0.key, resp->v.v0.nkey);
 
-    cas = resp->v.v0.cas > 0 ? ULL2NUM(resp->v.v0.cas) : Qnil;
     o = ctx->arith > 0 ? sym_increment : sym_decrement;
-    exc = cb_check_error(error, "failed to perform arithmetic operation", key);
+    exc = cb_context_check_error(ctx, error, msg, key);
     if (exc != Qnil) {
+        cas = resp->v.v0.cas > 0 ? ULL2NUM(resp->v.v0.cas) : Qnil;
         rb_ivar_set(exc, id_iv_cas, cas);
         rb_ivar_set(exc, id_iv_operation, o);
-        if (bucket->async) {
+        if (ctx->async) {
             if (bucket->on_error_proc != Qnil) {
                 cb_proc_call(bucket->on_error_proc, 3, o, key, exc);
             } else {
@@ -49,19 +50,24 @@ arithmetic_callback(lcb_t handle, const void *cookie, lcb_error_t error, const l
         }
     }
     val = ULL2NUM(resp->v.v0.value);
-    if (bucket->async) {    /* asynchronous */
+    if (ctx->async) {    /* asynchronous */
         if (ctx->proc != Qnil) {
-            res = rb_class_new_instance(0, NULL, cResult);
-            rb_ivar_set(res, id_iv_error, exc);
-            rb_ivar_set(res, id_iv_operation, o);
-            rb_ivar_set(res, id_iv_key, key);
-            rb_ivar_set(res, id_iv_value, val);
-            rb_ivar_set(res, id_iv_cas, cas);
-            cb_proc_call(ctx->proc, 1, res);
+            res = cb_result_new(o, key, exc);
+            if (ctx->error_codes) {
+                cb_result_set_status(res, error, msg);
+            }
+            r = DATA_PTR(res);
+            r->value = val;
+            if (resp->v.v0.cas > 0) {
+                r->cas = resp->v.v0.cas;
+                r->fields |= RESULT_CAS;
+            }
+            cb_context_yield(ctx, res);
         }
     } else {                /* synchronous */
-        if (NIL_P(exc)) {
+        if (error == LCB_SUCCESS) {
             if (ctx->extended) {
+                cas = resp->v.v0.cas > 0 ? ULL2NUM(resp->v.v0.cas) : Qnil;
                 rb_hash_aset(*rv, key, rb_ary_new3(2, val, cas));
             } else {
                 rb_hash_aset(*rv, key, val);
@@ -69,19 +75,31 @@ arithmetic_callback(lcb_t handle, const void *cookie, lcb_error_t error, const l
         }
     }
     if (ctx->nqueries == 0) {
-        cb_gc_unprotect(bucket, ctx->proc);
+        cb_context_finish(ctx);
     }
     (void)handle;
 }
 
+/* Fill the context and schedule the command (see cb_context_schedule()) */
+    static lcb_error_t
+do_schedule(struct schedule_st *sched)
+{
+    struct params_st *params = sched->params;
+    struct context_st *ctx = sched->ctx;
+
+    ctx->nqueries = params->cmd.arith.num;
+    return lcb_arithmetic(params->bucket->handle, cb_context_cookie(ctx),
+            params->cmd.arith.num, params->cmd.arith.ptr);
+}
+
     static inline VALUE
 cb_bucket_arithmetic(int sign, int argc, VALUE *argv, VALUE self)
 {
     struct bucket_st *bucket = DATA_PTR(self);
     struct context_st *ctx;
     VALUE args, rv, proc, exc;
-    lcb_error_t err;
     struct params_st params;
+    struct schedule_st sched;
 
     if (bucket->handle == NULL) {
         rb_raise(eConnectError, "closed connection");
@@ -94,25 +112,13 @@ cb_bucket_arithmetic(int sign, int argc, VALUE *argv, VALUE self)
     params.type = cmd_arith;
     params.bucket = bucket;
     params.cmd.arith.sign = sign;
-    cb_params_build(&params, RARRAY_LEN(args), args);
-    ctx = xcalloc(1, sizeof(struct context_st));
-    if (ctx == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for context");
-    }
     rv = rb_hash_new();
-    ctx->rv = &rv;
-    ctx->bucket = bucket;
-    ctx->proc = cb_gc_protect(bucket, proc);
-    ctx->exception = Qnil;
-    ctx->nqueries = params.cmd.arith.num;
-    err = lcb_arithmetic(bucket->handle, (const void *)ctx,
-            params.cmd.arith.num, params.cmd.arith.ptr);
-    cb_params_destroy(&params);
-    exc = cb_check_error(err, "failed to schedule arithmetic request", Qnil);
-    if (exc != Qnil) {
-        xfree(ctx);
-        rb_exc_raise(exc);
-    }
+    cb_params_build(&params, RARRAY_LEN(args), args);
+    sched.bucket = bucket;
+    sched.params = &params;
+    sched.proc = proc;
+    sched.rv = &rv;
+    ctx = cb_context_schedule(&sched, do_schedule, "failed to schedule arithmetic request", Qnil);
     bucket->nbytes += params.npayload;
     if (bucket->async) {
         maybe_do_loop(bucket);
@@ -120,10 +126,10 @@ cb_bucket_arithmetic(int sign, int argc, VALUE *argv, VALUE self)
     } else {
         if (ctx->nqueries > 0) {
             /* we have some operations pending */
-            lcb_wait(bucket->handle);
+            cb_wait(bucket, ctx);
         }
         exc = ctx->exception;
-        xfree(ctx);
+        cb_context_free(ctx);
         if (exc != Qnil) {
             cb_gc_unprotect(bucket, exc);
             rb_exc_raise(exc);
@@ -174,6 +180,11 @@ cb_bucket_arithmetic(int sign, int argc, VALUE *argv, VALUE self)
  *   @option options [true, false] :extended (false) If set to +true+, the
  *     operation will return tuple +[value, cas]+, otherwise (by default) it
  *     returns just value.
+ *   @option options [Symbol] :errors (self.errors) Report the errors as
+ *     status codes ({Result#error_code}) instead of exceptions. The
+ *     synchronous call returns +nil+ when the key is missing or its value
+ *     isn't a number.
+ *     See {Bucket#initialize}.
  *
  *   @yieldparam ret [Result] the result of operation in asynchronous mode
  *     (valid attributes: +error+, +operation+, +key+, +value+, +cas+).
@@ -262,6 +273,11 @@ cb_bucket_incr(int argc, VALUE *argv, VALUE self)
  *   @option options [true, false] :extended (false) If set to +true+, the
  *     operation will return tuple +[value, cas]+, otherwise (by default) it
  *     returns just value.
+ *   @option options [Symbol] :errors (self.errors) Report the errors as
+ *     status codes ({Result#error_code}) instead of exceptions. The
+ *     synchronous call returns +nil+ when the key is missing or its value
+ *     isn't a number.
+ *     See {Bucket#initialize}.
  *
  *   @yieldparam ret [Result] the result of operation in asynchronous mode
  *     (valid attributes: +error+, +operation+, +key+, +value+, +cas+).
@@ -26,15 +26,563 @@ error_callback(lcb_t handle, lcb_error_t error, const char *errinfo)
     bucket->exception = cb_check_error(error, errinfo, Qnil);
 }
 
+#ifdef CB_RELEASE_GVL
+struct callback_st
+{
+    struct bucket_st *bucket;
+    VALUE (*func)(VALUE);
+    VALUE arg;
+};
+
+    static void *
+do_callback_with_gvl(void *ptr)
+{
+    struct callback_st *cb = ptr;
+    struct bucket_st *bucket = cb->bucket;
+    int state = 0;
+
+    /* nested cb_wait() calls are allowed to release GVL again */
+    bucket->nogvl = 0;
+    rb_protect(cb->func, cb->arg, &state);
+    bucket->nogvl = 1;
+    if (state && !bucket->callback_state) {
+        /* it isn't allowed to unwind the stack through the blocking
+         * region, so keep the error and re-raise it in cb_wait() */
+        bucket->callback_state = state;
+        bucket->callback_error = rb_errinfo();
+        rb_set_errinfo(Qnil);
+        bucket->io->stop_event_loop(bucket->io);
+    }
+    return NULL;
+}
+#endif
+
+/* Execute the callback body. If the event loop is running without GVL
+ * (see cb_wait()), it will be acquired for the time of the call */
+    void
+cb_invoke_callback(lcb_t handle, VALUE (*func)(VALUE), VALUE arg)
+{
+#ifdef CB_RELEASE_GVL
+    struct bucket_st *bucket = (struct bucket_st *)lcb_get_cookie(handle);
+
+    if (bucket->nogvl) {
+        struct callback_st cb;
+
+        cb.bucket = bucket;
+        cb.func = func;
+        cb.arg = arg;
+        rb_thread_call_with_gvl(do_callback_with_gvl, &cb);
+        return;
+    }
+#else
+    (void)handle;
+#endif
+    func(arg);
+}
+
+#ifdef CB_RELEASE_GVL
+/* Runs in the thread of the event loop, when some byte has been written
+ * to the wakeup pipe (see do_wait_unblock()) */
+    static void
+wakeup_handler(lcb_socket_t sock, short which, void *cb_data)
+{
+    struct bucket_st *bucket = cb_data;
+    char buf[64];
+
+    while (read(sock, buf, sizeof(buf)) > 0);
+    bucket->io->stop_event_loop(bucket->io);
+    (void)which;
+}
+
+/* The IO plugin isn't thread-safe, therefore other threads don't touch
+ * the event loop directly. They write to the pipe watched by the loop */
+    static void
+do_wakeup_init(struct bucket_st *bucket)
+{
+    int fds[2];
+
+    if (pipe(fds) != 0) {
+        rb_sys_fail("failed to create the pipe for event loop");
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    bucket->wakeup_fds[0] = fds[0];
+    bucket->wakeup_fds[1] = fds[1];
+    bucket->wakeup_event = bucket->io->create_event(bucket->io);
+    bucket->io->update_event(bucket->io, fds[0], bucket->wakeup_event,
+            LCB_READ_EVENT, bucket, wakeup_handler);
+}
+
+    static void
+do_wakeup_destroy(struct bucket_st *bucket)
+{
+    if (bucket->wakeup_event) {
+        bucket->io->delete_event(bucket->io, bucket->wakeup_fds[0], bucket->wakeup_event);
+        bucket->io->destroy_event(bucket->io, bucket->wakeup_event);
+        bucket->wakeup_event = NULL;
+        close(bucket->wakeup_fds[0]);
+        close(bucket->wakeup_fds[1]);
+    }
+}
+
+    static void
+do_wakeup(struct bucket_st *bucket)
+{
+    ssize_t rc;
+
+    /* the pipe is full if the loop hasn't been woken up yet */
+    rc = write(bucket->wakeup_fds[1], "", 1);
+    (void)rc;
+}
+
+    static void *
+do_wait_without_gvl(void *ptr)
+{
+    struct bucket_st *bucket = ptr;
+    lcb_wait(bucket->handle);
+    return NULL;
+}
+
+/* Called by ruby from the interrupting thread (or signal handler) */
+    static void
+do_wait_unblock(void *ptr)
+{
+    do_wakeup((struct bucket_st *)ptr);
+}
+
+    static VALUE
+do_wait_blocking(VALUE ptr)
+{
+    struct bucket_st *bucket = (struct bucket_st *)ptr;
+    rb_thread_call_without_gvl(do_wait_without_gvl, bucket,
+            do_wait_unblock, bucket);
+    return Qnil;
+}
+#endif
+
+/* Destroy libcouchbase instance together with its IO plugin */
+    static void
+do_destroy_handle(struct bucket_st *bucket)
+{
+    if (bucket->handle) {
+#ifdef CB_RELEASE_GVL
+        do_wakeup_destroy(bucket);
+#endif
+        lcb_destroy(bucket->handle);
+        bucket->handle = NULL;
+        bucket->io = NULL;
+    }
+}
+
+/* Run the event loop until all scheduled operations complete. The GVL is
+ * released for this time, so that other ruby threads can make progress
+ * while the current one is waiting for the network. */
+    static VALUE
+do_wait(VALUE ptr)
+{
+    struct bucket_st *bucket = (struct bucket_st *)ptr;
+    VALUE loop_thread = bucket->loop_thread;
+#ifdef CB_RELEASE_GVL
+    VALUE exc = Qnil;
+    int state = 0, again, nogvl = bucket->nogvl;
+
+    bucket->loop_thread = rb_thread_current();
+    bucket->nogvl = 1;
+    rb_protect(do_wait_blocking, (VALUE)bucket, &state);
+    if (state) {
+        /* the thread has been interrupted (e.g. Thread#raise or Timeout).
+         * The callbacks refer to the contexts on the caller's stack,
+         * therefore the pending operations are drained first, still
+         * without GVL. Further interrupts are ignored until then */
+        exc = rb_errinfo();
+        rb_set_errinfo(Qnil);
+        do {
+            again = 0;
+            rb_protect(do_wait_blocking, (VALUE)bucket, &again);
+            rb_set_errinfo(Qnil);
+        } while (again);
+    }
+    bucket->nogvl = nogvl;
+    bucket->loop_thread = loop_thread;
+    if (state) {
+        bucket->callback_state = 0;
+        bucket->callback_error = Qnil;
+    } else if (bucket->callback_state) {
+        exc = bucket->callback_error;
+        state = bucket->callback_state;
+        bucket->callback_state = 0;
+        bucket->callback_error = Qnil;
+    }
+    if (state) {
+        if (rb_obj_is_kind_of(exc, rb_eException)) {
+            rb_exc_raise(exc);
+        }
+        rb_jump_tag(state);
+    }
+#else
+    bucket->loop_thread = rb_thread_current();
+    lcb_wait(bucket->handle);
+    bucket->loop_thread = loop_thread;
+#endif
+    return Qnil;
+}
+
+/* The thread-safe connection (see :thread_safe option) doesn't allow to
+ * touch libcouchbase handle while some thread is running the event loop.
+ * The other threads are parked in the list of waiters and woken up when
+ * the round of the event loop is over. */
+struct waiter_st
+{
+    VALUE thread;
+    struct waiter_st *next;
+};
+
+struct park_st
+{
+    struct bucket_st *bucket;
+    struct waiter_st waiter;
+};
+
+    static VALUE
+do_park(VALUE ptr)
+{
+    struct park_st *park = (struct park_st *)ptr;
+
+    park->waiter.next = park->bucket->waiters;
+    park->bucket->waiters = &park->waiter;
+    rb_thread_sleep_forever();
+    return Qnil;
+}
+
+    static VALUE
+do_unpark(VALUE ptr)
+{
+    struct park_st *park = (struct park_st *)ptr;
+    struct waiter_st **wp = &park->bucket->waiters;
+
+    while (*wp) {
+        if (*wp == &park->waiter) {
+            *wp = park->waiter.next;
+            break;
+        }
+        wp = &(*wp)->next;
+    }
+    return Qnil;
+}
+
+    static VALUE
+do_park_ensure(VALUE ptr)
+{
+    struct park_st park;
+
+    park.bucket = (struct bucket_st *)ptr;
+    park.waiter.thread = rb_thread_current();
+    park.waiter.next = NULL;
+    return rb_ensure(do_park, (VALUE)&park, do_unpark, (VALUE)&park);
+}
+
+    static void
+do_wake_waiters(struct bucket_st *bucket)
+{
+    struct waiter_st *w;
+
+    for (w = bucket->waiters; w; w = w->next) {
+        rb_thread_wakeup(w->thread);
+    }
+}
+
+struct round_st
+{
+    struct bucket_st *bucket;
+    int driving;            /* the current thread runs the event loop */
+};
+
+    static VALUE
+do_wait_round(VALUE ptr)
+{
+    struct round_st *round = (struct round_st *)ptr;
+    struct bucket_st *bucket = round->bucket;
+
+    /* give the chance to other threads to schedule their commands, so
+     * that they will be sent in the same batch. The loop isn't marked as
+     * running yet, therefore they don't park in cb_wait_idle() */
+    rb_thread_schedule();
+    if (bucket->running) {
+        /* other thread has started the event loop meanwhile */
+        return Qnil;
+    }
+    bucket->running = 1;
+    round->driving = 1;
+    return do_wait((VALUE)bucket);
+}
+
+/* The connection without :thread_safe option isn't serialized, therefore
+ * other threads aren't allowed to touch libcouchbase handle while the
+ * event loop is running, even when it runs the callbacks holding GVL.
+ * The nested calls from the callbacks in the same thread are allowed */
+    static void
+check_nogvl(struct bucket_st *bucket)
+{
+    if (RTEST(bucket->loop_thread) && bucket->loop_thread != rb_thread_current()) {
+        rb_raise(eInvalidError, "the connection is being used by other thread "
+                "(pass :thread_safe => true to share it)");
+    }
+}
+
+/* The callbacks of the round run in the thread driving the event loop.
+ * It cannot park waiting for itself, therefore the operations made from
+ * the callbacks are nested into the round like for the connection
+ * without :thread_safe option */
+    static int
+do_driving_p(struct bucket_st *bucket)
+{
+    return bucket->running && bucket->loop_thread == rb_thread_current();
+}
+
+/* Block the current thread until the event loop isn't running in other
+ * thread. Should be called right before scheduling the commands */
+    void
+cb_wait_idle(struct bucket_st *bucket)
+{
+    if (bucket->thread_safe) {
+        while (bucket->running && !do_driving_p(bucket)) {
+            do_park_ensure((VALUE)bucket);
+        }
+    } else {
+        check_nogvl(bucket);
+    }
+}
+
+/* Wait for completion of the operations of the given context. For the
+ * thread-safe connection the event loop is driven by one of the waiting
+ * threads, others are sleeping until their operations are done. */
+    void
+cb_wait(struct bucket_st *bucket, struct context_st *ctx)
+{
+    int state = 0, deferred = 0;
+    VALUE exc = Qnil;
+    struct round_st round;
+
+    if (!bucket->thread_safe || do_driving_p(bucket)) {
+        check_nogvl(bucket);
+        /* the loop might be stopped before the operations are done, e.g.
+         * by Thread#wakeup or when other HTTP request has been paused */
+        do {
+            do_wait((VALUE)bucket);
+        } while (ctx && ctx->nqueries > 0 && bucket->exception == Qnil
+                && !(ctx->request && ctx->request->paused));
+        return;
+    }
+    for (;;) {
+        if (ctx && ctx->nqueries == 0) {
+            break;
+        }
+        if (ctx && ctx->request && ctx->request->paused) {
+            /* the consumer of HTTP stream will continue it later */
+            break;
+        }
+        if (bucket->running) {
+            rb_protect(do_park_ensure, (VALUE)bucket, &state);
+        } else {
+            round.bucket = bucket;
+            round.driving = 0;
+            rb_protect(do_wait_round, (VALUE)&round, &state);
+            if (round.driving) {
+                bucket->running = 0;
+                do_wake_waiters(bucket);
+                if (ctx == NULL && !state) {
+                    break;
+                }
+            }
+        }
+        if (state) {
+            /* the callbacks refer to the context, therefore the error
+             * will be raised when all its operations are done */
+            if (!deferred) {
+                deferred = state;
+                exc = rb_errinfo();
+            }
+            rb_set_errinfo(Qnil);
+            state = 0;
+            if (ctx == NULL) {
+                break;
+            }
+        }
+    }
+    if (deferred) {
+        if (rb_obj_is_kind_of(exc, rb_eException)) {
+            rb_exc_raise(exc);
+        }
+        rb_jump_tag(deferred);
+    }
+}
+
+/* Translate the cookie to the context of the operation. Returns NULL if
+ * the context has been released already (see context.c) */
+    static struct context_st *
+do_resolve_context(lcb_t handle, const void *cookie)
+{
+    return cb_context_resolve((struct bucket_st *)lcb_get_cookie(handle), cookie);
+}
+
+/* The contexts of asynchronous operations are released as soon as the last
+ * response has been delivered. Synchronous ones are released by the caller */
+    static void
+do_release_context(struct context_st *ctx)
+{
+    if (ctx->async && ctx->nqueries == 0) {
+        cb_context_free(ctx);
+    }
+}
+
+/* Wrappers for libcouchbase callbacks, which pack the arguments and pass
+ * them to the real implementation through cb_invoke_callback() */
+#define DEFINE_CALLBACK_WRAPPER(name, resp_type) \
+    struct name##_args_st { \
+        lcb_t handle; \
+        const void *cookie; \
+        lcb_error_t error; \
+        const resp_type *resp; \
+    }; \
+    static VALUE \
+    name##_invoke(VALUE ptr) \
+    { \
+        struct name##_args_st *a = (struct name##_args_st *)ptr; \
+        struct context_st *ctx = do_resolve_context(a->handle, a->cookie); \
+        if (ctx) { \
+            name(a->handle, ctx, a->error, a->resp); \
+            do_release_context(ctx); \
+        } \
+        return Qnil; \
+    } \
+    static void \
+    name##_wrapper(lcb_t handle, const void *cookie, lcb_error_t error, const resp_type *resp) \
+    { \
+        struct name##_args_st args; \
+        args.handle = handle; \
+        args.cookie = cookie; \
+        args.error = error; \
+        args.resp = resp; \
+        cb_invoke_callback(handle, name##_invoke, (VALUE)&args); \
+    }
+
+#define DEFINE_HTTP_CALLBACK_WRAPPER(name) \
+    struct name##_args_st { \
+        lcb_http_request_t request; \
+        lcb_t handle; \
+        const void *cookie; \
+        lcb_error_t error; \
+        const lcb_http_resp_t *resp; \
+    }; \
+    static VALUE \
+    name##_invoke(VALUE ptr) \
+    { \
+        struct name##_args_st *a = (struct name##_args_st *)ptr; \
+        struct context_st *ctx = do_resolve_context(a->handle, a->cookie); \
+        if (ctx) { \
+            name(a->request, a->handle, ctx, a->error, a->resp); \
+            do_release_context(ctx); \
+        } \
+        return Qnil; \
+    } \
+    static void \
+    name##_wrapper(lcb_http_request_t request, lcb_t handle, const void *cookie, \
+            lcb_error_t error, const lcb_http_resp_t *resp) \
+    { \
+        struct name##_args_st args; \
+        args.request = request; \
+        args.handle = handle; \
+        args.cookie = cookie; \
+        args.error = error; \
+        args.resp = resp; \
+        cb_invoke_callback(handle, name##_invoke, (VALUE)&args); \
+    }
+
+DEFINE_CALLBACK_WRAPPER(get_callback, lcb_get_resp_t)
+DEFINE_CALLBACK_WRAPPER(touch_callback, lcb_touch_resp_t)
+DEFINE_CALLBACK_WRAPPER(delete_callback, lcb_remove_resp_t)
+DEFINE_CALLBACK_WRAPPER(stat_callback, lcb_server_stat_resp_t)
+DEFINE_CALLBACK_WRAPPER(arithmetic_callback, lcb_arithmetic_resp_t)
+DEFINE_CALLBACK_WRAPPER(version_callback, lcb_server_version_resp_t)
+DEFINE_CALLBACK_WRAPPER(observe_callback, lcb_observe_resp_t)
+DEFINE_CALLBACK_WRAPPER(unlock_callback, lcb_unlock_resp_t)
+DEFINE_HTTP_CALLBACK_WRAPPER(http_complete_callback)
+DEFINE_HTTP_CALLBACK_WRAPPER(http_data_callback)
+
+#undef DEFINE_CALLBACK_WRAPPER
+#undef DEFINE_HTTP_CALLBACK_WRAPPER
+
+struct storage_callback_args_st
+{
+    lcb_t handle;
+    const void *cookie;
+    lcb_storage_t operation;
+    lcb_error_t error;
+    const lcb_store_resp_t *resp;
+};
+
+    static VALUE
+storage_callback_invoke(VALUE ptr)
+{
+    struct storage_callback_args_st *a = (struct storage_callback_args_st *)ptr;
+    struct context_st *ctx = do_resolve_context(a->handle, a->cookie);
+
+    if (ctx) {
+        storage_callback(a->handle, ctx, a->operation, a->error, a->resp);
+        do_release_context(ctx);
+    }
+    return Qnil;
+}
+
+    static void
+storage_callback_wrapper(lcb_t handle, const void *cookie, lcb_storage_t operation,
+        lcb_error_t error, const lcb_store_resp_t *resp)
+{
+    struct storage_callback_args_st args;
+
+    args.handle = handle;
+    args.cookie = cookie;
+    args.operation = operation;
+    args.error = error;
+    args.resp = resp;
+    cb_invoke_callback(handle, storage_callback_invoke, (VALUE)&args);
+}
+
+struct error_callback_args_st
+{
+    lcb_t handle;
+    lcb_error_t error;
+    const char *errinfo;
+};
+
+    static VALUE
+error_callback_invoke(VALUE ptr)
+{
+    struct error_callback_args_st *a = (struct error_callback_args_st *)ptr;
+    error_callback(a->handle, a->error, a->errinfo);
+    return Qnil;
+}
+
+    static void
+error_callback_wrapper(lcb_t handle, lcb_error_t error, const char *errinfo)
+{
+    struct error_callback_args_st args;
+
+    args.handle = handle;
+    args.error = error;
+    args.errinfo = errinfo;
+    cb_invoke_callback(handle, error_callback_invoke, (VALUE)&args);
+}
+
     void
 cb_bucket_free(void *ptr)
 {
     struct bucket_st *bucket = ptr;
 
     if (bucket) {
-        if (bucket->handle) {
-            lcb_destroy(bucket->handle);
-        }
+        do_destroy_handle(bucket);
         xfree(bucket->authority);
         xfree(bucket->hostname);
         xfree(bucket->pool);
@@ -42,6 +590,9 @@ cb_bucket_free(void *ptr)
         xfree(bucket->username);
         xfree(bucket->password);
         xfree(bucket->key_prefix);
+        xfree(bucket->object_space.slots);
+        xfree(bucket->arena.data);
+        cb_context_pool_destroy(bucket);
         xfree(bucket);
     }
 }
@@ -55,7 +606,9 @@ cb_bucket_mark(void *ptr)
         rb_gc_mark(bucket->exception);
         rb_gc_mark(bucket->on_error_proc);
         rb_gc_mark(bucket->key_prefix_val);
-        rb_gc_mark(bucket->object_space);
+        cb_gc_mark_protected(bucket);
+        rb_gc_mark(bucket->callback_error);
+        rb_gc_mark(bucket->loop_thread);
     }
 }
 
@@ -164,6 +717,19 @@ do_scan_connection_options(struct bucket_st *bucket, int argc, VALUE *argv)
             if (RTEST(rb_funcall(opts, id_has_key_p, 1, sym_quiet))) {
                 bucket->quiet = RTEST(rb_hash_aref(opts, sym_quiet));
             }
+            if (RTEST(rb_funcall(opts, id_has_key_p, 1, sym_thread_safe))) {
+                bucket->thread_safe = RTEST(rb_hash_aref(opts, sym_thread_safe));
+            }
+            if (RTEST(rb_funcall(opts, id_has_key_p, 1, sym_compression))) {
+                cb_compression_parse(rb_hash_aref(opts, sym_compression),
+                        &bucket->compression, &bucket->compression_min_size);
+            }
+            if (RTEST(rb_funcall(opts, id_has_key_p, 1, sym_errors))) {
+                bucket->error_codes = cb_errors_parse(rb_hash_aref(opts, sym_errors));
+            }
+            if (RTEST(rb_funcall(opts, id_has_key_p, 1, sym_encoding))) {
+                bucket->encoding = cb_encoding_parse(rb_hash_aref(opts, sym_encoding));
+            }
             arg = rb_hash_aref(opts, sym_timeout);
             if (arg != Qnil) {
                 bucket->timeout = (uint32_t)NUM2ULONG(arg);
@@ -237,11 +803,7 @@ do_connect(struct bucket_st *bucket)
     lcb_error_t err;
     struct lcb_create_st create_opts;
 
-    if (bucket->handle) {
-        lcb_destroy(bucket->handle);
-        bucket->handle = NULL;
-        bucket->io = NULL;
-    }
+    do_destroy_handle(bucket);
     err = lcb_create_io_ops(&bucket->io, NULL);
     if (err != LCB_SUCCESS) {
         rb_exc_raise(cb_check_error(err, "failed to create IO instance", Qnil));
@@ -258,20 +820,23 @@ do_connect(struct bucket_st *bucket)
         rb_exc_raise(cb_check_error(err, "failed to create libcouchbase instance", Qnil));
     }
     lcb_set_cookie(bucket->handle, bucket);
-    (void)lcb_set_error_callback(bucket->handle, error_callback);
-    (void)lcb_set_store_callback(bucket->handle, storage_callback);
-    (void)lcb_set_get_callback(bucket->handle, get_callback);
-    (void)lcb_set_touch_callback(bucket->handle, touch_callback);
-    (void)lcb_set_remove_callback(bucket->handle, delete_callback);
-    (void)lcb_set_stat_callback(bucket->handle, stat_callback);
-    (void)lcb_set_arithmetic_callback(bucket->handle, arithmetic_callback);
-    (void)lcb_set_version_callback(bucket->handle, version_callback);
-    (void)lcb_set_view_complete_callback(bucket->handle, http_complete_callback);
-    (void)lcb_set_view_data_callback(bucket->handle, http_data_callback);
-    (void)lcb_set_management_complete_callback(bucket->handle, http_complete_callback);
-    (void)lcb_set_management_data_callback(bucket->handle, http_data_callback);
-    (void)lcb_set_observe_callback(bucket->handle, observe_callback);
-    (void)lcb_set_unlock_callback(bucket->handle, unlock_callback);
+#ifdef CB_RELEASE_GVL
+    do_wakeup_init(bucket);
+#endif
+    (void)lcb_set_error_callback(bucket->handle, error_callback_wrapper);
+    (void)lcb_set_store_callback(bucket->handle, storage_callback_wrapper);
+    (void)lcb_set_get_callback(bucket->handle, get_callback_wrapper);
+    (void)lcb_set_touch_callback(bucket->handle, touch_callback_wrapper);
+    (void)lcb_set_remove_callback(bucket->handle, delete_callback_wrapper);
+    (void)lcb_set_stat_callback(bucket->handle, stat_callback_wrapper);
+    (void)lcb_set_arithmetic_callback(bucket->handle, arithmetic_callback_wrapper);
+    (void)lcb_set_version_callback(bucket->handle, version_callback_wrapper);
+    (void)lcb_set_view_complete_callback(bucket->handle, http_complete_callback_wrapper);
+    (void)lcb_set_view_data_callback(bucket->handle, http_data_callback_wrapper);
+    (void)lcb_set_management_complete_callback(bucket->handle, http_complete_callback_wrapper);
+    (void)lcb_set_management_data_callback(bucket->handle, http_data_callback_wrapper);
+    (void)lcb_set_observe_callback(bucket->handle, observe_callback_wrapper);
+    (void)lcb_set_unlock_callback(bucket->handle, unlock_callback_wrapper);
 
     if (bucket->timeout > 0) {
         lcb_set_timeout(bucket->handle, bucket->timeout);
@@ -280,17 +845,13 @@ do_connect(struct bucket_st *bucket)
     }
     err = lcb_connect(bucket->handle);
     if (err != LCB_SUCCESS) {
-        lcb_destroy(bucket->handle);
-        bucket->handle = NULL;
-        bucket->io = NULL;
+        do_destroy_handle(bucket);
         rb_exc_raise(cb_check_error(err, "failed to connect libcouchbase instance to server", Qnil));
     }
     bucket->exception = Qnil;
-    lcb_wait(bucket->handle);
+    cb_wait(bucket, NULL);
     if (bucket->exception != Qnil) {
-        lcb_destroy(bucket->handle);
-        bucket->handle = NULL;
-        bucket->io = NULL;
+        do_destroy_handle(bucket);
         rb_exc_raise(bucket->exception);
     }
 }
@@ -360,6 +921,36 @@ cb_bucket_alloc(VALUE klass)
  *     returning back to the application.
  *   @option options [Fixnum] :timeout (2500000) the timeout for IO
  *     operations (in microseconds)
+ *   @option options [true, false] :thread_safe (false) allow to share the
+ *     connection between threads. The synchronous operations from
+ *     different threads will be batched and sent out together by the
+ *     thread which runs the event loop. Asynchronous mode ({Bucket#run})
+ *     isn't available for such connections.
+ *   @option options [Hash, Symbol, false] :compression (false) compress
+ *     the values larger than +:min_size+ bytes (1024 by default) using
+ *     +:algo+ (+:lz4+ or +:zstd+, if the extension was built with them).
+ *     The compressed values carry the header with the algorithm, so that
+ *     they are decompressed transparently on read. The item flags aren't
+ *     changed. Reading the value with the header, but corrupted payload
+ *     raises {Couchbase::Error::ValueFormat}. {Bucket#append} and
+ *     {Bucket#prepend} don't compress their chunks and cannot be used
+ *     with compressed values.
+ *   @option options [Symbol] :errors (:exceptions) how the failures of
+ *     key operations are reported. With +:codes+ the results yielded in
+ *     asynchronous mode carry {Result#error_code} and create the exception
+ *     object only when {Result#error} is called, and synchronous operations
+ *     don't raise for missing or existing keys: {Bucket#get},
+ *     {Bucket#incr}/{Bucket#decr} and the store operations ({Bucket#set},
+ *     {Bucket#add}, {Bucket#replace}, etc.) return +nil+ instead of the
+ *     value or CAS (e.g. on +:key_exists+ or +:not_found+), while
+ *     {Bucket#delete}, {Bucket#touch} and {Bucket#unlock} return +false+.
+ *     Can be overridden for particular operation.
+ *   @option options [Symbol] :encoding (:external) the encoding of the
+ *     keys and values received from the server. +:external+ uses
+ *     +Encoding.default_external+ and transcodes the data if
+ *     +Encoding.default_internal+ is set. +:utf8+ and +:binary+ build the
+ *     strings without conversion. JSON documents are always decoded as
+ *     UTF-8.
  *
  * @example Initialize connection using default options
  *   Couchbase.new
@@ -407,8 +998,18 @@ cb_bucket_init(int argc, VALUE *argv, VALUE self)
     bucket->key_prefix = NULL;
     bucket->key_prefix_val = Qnil;
     bucket->node_list = NULL;
-    bucket->object_space = rb_hash_new();
     bucket->node_list = NULL;
+    bucket->nogvl = 0;
+    bucket->loop_thread = Qnil;
+    bucket->callback_state = 0;
+    bucket->callback_error = Qnil;
+    bucket->thread_safe = 0;
+    bucket->running = 0;
+    bucket->waiters = NULL;
+    bucket->compression = 0;
+    bucket->compression_min_size = 0;
+    bucket->error_codes = 0;
+    bucket->encoding = ENCODING_EXTERNAL;
 
     do_scan_connection_options(bucket, argc, argv);
     do_connect(bucket);
@@ -465,6 +1066,17 @@ cb_bucket_init_copy(VALUE copy, VALUE orig)
     copy_b->environment = orig_b->environment;
     copy_b->timeout = orig_b->timeout;
     copy_b->exception = Qnil;
+    copy_b->nogvl = 0;
+    copy_b->loop_thread = Qnil;
+    copy_b->callback_state = 0;
+    copy_b->callback_error = Qnil;
+    copy_b->thread_safe = orig_b->thread_safe;
+    copy_b->compression = orig_b->compression;
+    copy_b->compression_min_size = orig_b->compression_min_size;
+    copy_b->error_codes = orig_b->error_codes;
+    copy_b->encoding = orig_b->encoding;
+    copy_b->running = 0;
+    copy_b->waiters = NULL;
     if (orig_b->on_error_proc != Qnil) {
         copy_b->on_error_proc = rb_funcall(orig_b->on_error_proc, id_dup, 0);
     }
@@ -552,6 +1164,23 @@ cb_bucket_async_p(VALUE self)
     return bucket->async ? Qtrue : Qfalse;
 }
 
+/*
+ * Check whether the connection could be shared between threads
+ *
+ * @since 1.2.0
+ *
+ * @see Bucket#initialize
+ *
+ * @return [true, false] +true+ if the connection was created with
+ *   +:thread_safe+ option
+ */
+    VALUE
+cb_bucket_thread_safe_p(VALUE self)
+{
+    struct bucket_st *bucket = DATA_PTR(self);
+    return bucket->thread_safe ? Qtrue : Qfalse;
+}
+
     VALUE
 cb_bucket_quiet_get(VALUE self)
 {
@@ -861,6 +1490,106 @@ cb_bucket_default_observe_timeout_set(VALUE self, VALUE val)
     bucket->default_observe_timeout = FIX2INT(val);
     return val;
 }
+/* Document-method: compression
+ *
+ * @since 1.2.0
+ *
+ * Get compression settings for the values
+ *
+ * @return [Hash, nil] the +:algo+ and +:min_size+ pair or +nil+ if
+ *   compression disabled
+ */
+    VALUE
+cb_bucket_compression_get(VALUE self)
+{
+    struct bucket_st *bucket = DATA_PTR(self);
+    return cb_compression_get(bucket->compression, bucket->compression_min_size);
+}
+
+/* Document-method: compression=
+ *
+ * @since 1.2.0
+ *
+ * Set compression settings for the values
+ *
+ * @see Bucket#initialize
+ *
+ * @return [Hash, Symbol, false]
+ */
+    VALUE
+cb_bucket_compression_set(VALUE self, VALUE val)
+{
+    struct bucket_st *bucket = DATA_PTR(self);
+    cb_compression_parse(val, &bucket->compression, &bucket->compression_min_size);
+    return val;
+}
+
+/* Document-method: errors
+ *
+ * @since 1.2.0
+ *
+ * Get the way the operations report errors
+ *
+ * @return [Symbol] +:exceptions+ or +:codes+
+ */
+    VALUE
+cb_bucket_errors_get(VALUE self)
+{
+    struct bucket_st *bucket = DATA_PTR(self);
+    return bucket->error_codes ? sym_codes : sym_exceptions;
+}
+
+/* Document-method: errors=
+ *
+ * @since 1.2.0
+ *
+ * Set the way the operations report errors
+ *
+ * @see Bucket#initialize
+ *
+ * @return [Symbol]
+ */
+    VALUE
+cb_bucket_errors_set(VALUE self, VALUE val)
+{
+    struct bucket_st *bucket = DATA_PTR(self);
+    bucket->error_codes = cb_errors_parse(val);
+    return val;
+}
+
+/* Document-method: encoding
+ *
+ * @since 1.2.0
+ *
+ * Get the encoding of the strings received from the server
+ *
+ * @return [Symbol] +:external+, +:utf8+ or +:binary+
+ */
+    VALUE
+cb_bucket_encoding_get(VALUE self)
+{
+    struct bucket_st *bucket = DATA_PTR(self);
+    return cb_encoding_get(bucket->encoding);
+}
+
+/* Document-method: encoding=
+ *
+ * @since 1.2.0
+ *
+ * Set the encoding of the strings received from the server
+ *
+ * @see Bucket#initialize
+ *
+ * @return [Symbol]
+ */
+    VALUE
+cb_bucket_encoding_set(VALUE self, VALUE val)
+{
+    struct bucket_st *bucket = DATA_PTR(self);
+    bucket->encoding = cb_encoding_parse(val);
+    return val;
+}
+
 /* Document-method: url
  *
  * @since 1.0.0
@@ -930,7 +1659,7 @@ cb_bucket_inspect(VALUE self)
     static void
 do_loop(struct bucket_st *bucket)
 {
-    lcb_wait(bucket->handle);
+    cb_wait(bucket, NULL);
     bucket->nbytes = 0;
 }
 
@@ -954,6 +1683,9 @@ do_run(VALUE *args)
     if (bucket->async) {
         rb_raise(eInvalidError, "nested #run");
     }
+    if (bucket->thread_safe) {
+        rb_raise(eInvalidError, "#run isn't allowed for thread-safe connection");
+    }
     bucket->threshold = 0;
     if (opts != Qnil) {
         VALUE arg;
@@ -1038,6 +1770,77 @@ cb_bucket_run(int argc, VALUE *argv, VALUE self)
     return Qnil;
 }
 
+    static VALUE
+do_async_schedule(VALUE self)
+{
+    return rb_yield(self);
+}
+
+    static VALUE
+ensure_async_schedule(VALUE self)
+{
+    struct bucket_st *bucket = DATA_PTR(self);
+
+    bucket->async = 0;
+    return Qnil;
+}
+
+/*
+ * @private Schedule operations in asynchronous mode outside of the
+ * {Bucket#run} block. The commands will be sent out on next event loop
+ * round (see {Future})
+ *
+ * @since 1.2.0
+ *
+ * @yieldparam [Bucket] bucket the bucket instance
+ *
+ * @return [Object] the value returned by the block
+ */
+    VALUE
+cb_bucket_async_schedule(VALUE self)
+{
+    struct bucket_st *bucket = DATA_PTR(self);
+
+    rb_need_block();
+    if (bucket->handle == NULL) {
+        rb_raise(eConnectError, "closed connection");
+    }
+    if (bucket->async) {
+        return rb_yield(self);
+    }
+    if (bucket->thread_safe) {
+        rb_raise(eInvalidError, "asynchronous operations aren't allowed for thread-safe connection");
+    }
+    bucket->async = 1;
+    return rb_ensure(do_async_schedule, self, ensure_async_schedule, self);
+}
+
+/*
+ * @private Run the event loop until all scheduled operations complete
+ *
+ * @since 1.2.0
+ *
+ * @return [nil]
+ */
+    VALUE
+cb_bucket_async_wait(VALUE self)
+{
+    struct bucket_st *bucket = DATA_PTR(self);
+    VALUE exc;
+
+    if (bucket->handle == NULL) {
+        rb_raise(eConnectError, "closed connection");
+    }
+    cb_wait(bucket, NULL);
+    bucket->nbytes = 0;
+    if (bucket->exception != Qnil) {
+        exc = bucket->exception;
+        bucket->exception = Qnil;
+        rb_exc_raise(exc);
+    }
+    return Qnil;
+}
+
 /*
  * Stop the event loop.
  *
@@ -1060,6 +1863,14 @@ cb_bucket_run(int argc, VALUE *argv, VALUE self)
 cb_bucket_stop(VALUE self)
 {
     struct bucket_st *bucket = DATA_PTR(self);
+
+#ifdef CB_RELEASE_GVL
+    if (bucket->nogvl && bucket->loop_thread != rb_thread_current()) {
+        /* the loop is running without GVL in other thread */
+        do_wakeup(bucket);
+        return Qnil;
+    }
+#endif
     bucket->io->stop_event_loop(bucket->io);
     return Qnil;
 }
@@ -1078,10 +1889,9 @@ cb_bucket_disconnect(VALUE self)
 {
     struct bucket_st *bucket = DATA_PTR(self);
 
+    cb_wait_idle(bucket);
     if (bucket->handle) {
-        lcb_destroy(bucket->handle);
-        bucket->handle = NULL;
-        bucket->io = NULL;
+        do_destroy_handle(bucket);
         return Qtrue;
     } else {
         rb_raise(eConnectError, "closed connection");
@@ -0,0 +1,227 @@
+/* vim: ft=c et ts=8 sts=4 sw=4 cino=
+ *
+ *   Copyright 2011, 2012 Couchbase, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "couchbase_ext.h"
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/* The compressed value is prefixed with the header: the magic bytes,
+ * the algorithm (1 byte) and the length of original data (4 bytes,
+ * network byte order). The item flags aren't touched. The magic starts
+ * with NUL, so that neither JSON, nor text, nor marshalled value could
+ * look like compressed one, and the length isn't trusted beyond
+ * COMPRESS_MAX_RATIO of the payload. */
+#define COMPRESS_MAGIC "\0CBZ"
+#define COMPRESS_MAGIC_SIZE 4
+#define COMPRESS_HEADER_SIZE (COMPRESS_MAGIC_SIZE + 1 + 4)
+#define COMPRESS_DEFAULT_MIN_SIZE 1024
+#define COMPRESS_MAX_SIZE 0x7fffffff
+#define COMPRESS_MAX_RATIO 1024
+
+    static uint32_t
+algo_from_symbol(VALUE algo)
+{
+    if (algo == sym_lz4) {
+#ifdef HAVE_LZ4
+        return COMPRESS_LZ4;
+#else
+        rb_raise(rb_eArgError, "LZ4 compression isn't supported by this build");
+#endif
+    } else if (algo == sym_zstd) {
+#ifdef HAVE_ZSTD
+        return COMPRESS_ZSTD;
+#else
+        rb_raise(rb_eArgError, "zstd compression isn't supported by this build");
+#endif
+    } else if (algo == Qtrue) {
+#if defined(HAVE_LZ4)
+        return COMPRESS_LZ4;
+#elif defined(HAVE_ZSTD)
+        return COMPRESS_ZSTD;
+#else
+        rb_raise(rb_eArgError, "compression isn't supported by this build");
+#endif
+    }
+    rb_raise(rb_eArgError, "unknown compression algorithm, expected :lz4 or :zstd");
+    return 0;
+}
+
+/* Accepts +false+/+nil+ to disable compression, +true+ or algorithm
+ * symbol to use default threshold, or Hash with +:algo+ and +:min_size+
+ * keys. */
+    void
+cb_compression_parse(VALUE arg, uint32_t *algo, size_t *min_size)
+{
+    VALUE tmp;
+
+    switch (TYPE(arg)) {
+        case T_NIL:
+        case T_FALSE:
+            *algo = 0;
+            break;
+        case T_TRUE:
+        case T_SYMBOL:
+            *algo = algo_from_symbol(arg);
+            *min_size = COMPRESS_DEFAULT_MIN_SIZE;
+            break;
+        case T_HASH:
+            tmp = rb_hash_aref(arg, sym_algo);
+            *algo = algo_from_symbol(NIL_P(tmp) ? Qtrue : tmp);
+            tmp = rb_hash_aref(arg, sym_min_size);
+            *min_size = NIL_P(tmp) ? COMPRESS_DEFAULT_MIN_SIZE : NUM2ULONG(tmp);
+            break;
+        default:
+            rb_raise(rb_eArgError, "compression option should be Hash, Symbol or boolean");
+    }
+}
+
+    VALUE
+cb_compression_get(uint32_t algo, size_t min_size)
+{
+    VALUE ret;
+
+    if (algo == 0) {
+        return Qnil;
+    }
+    ret = rb_hash_new();
+    rb_hash_aset(ret, sym_algo, algo == COMPRESS_LZ4 ? sym_lz4 : sym_zstd);
+    rb_hash_aset(ret, sym_min_size, ULONG2NUM(min_size));
+    return ret;
+}
+
+/* Returns compressed copy of the blob. The blob is returned unchanged if
+ * it is too short or doesn't compress well. */
+    VALUE
+cb_compress_value(VALUE blob, uint32_t algo, size_t min_size)
+{
+    size_t len = RSTRING_LEN(blob), bound = 0, clen = 0;
+    const char *src = RSTRING_PTR(blob);
+    unsigned char *dst;
+    VALUE ret;
+
+    if (algo == 0 || len < min_size || len > COMPRESS_MAX_SIZE) {
+        return blob;
+    }
+    switch (algo) {
+#ifdef HAVE_LZ4
+        case COMPRESS_LZ4:
+            bound = LZ4_compressBound((int)len);
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case COMPRESS_ZSTD:
+            bound = ZSTD_compressBound(len);
+            break;
+#endif
+        default:
+            (void)src;
+            return blob;
+    }
+    ret = rb_str_buf_new(COMPRESS_HEADER_SIZE + bound);
+    dst = (unsigned char *)RSTRING_PTR(ret);
+    memcpy(dst, COMPRESS_MAGIC, COMPRESS_MAGIC_SIZE);
+    dst += COMPRESS_MAGIC_SIZE;
+    dst[0] = (unsigned char)algo;
+    dst[1] = (unsigned char)(len >> 24);
+    dst[2] = (unsigned char)(len >> 16);
+    dst[3] = (unsigned char)(len >> 8);
+    dst[4] = (unsigned char)len;
+    dst += 5;
+    switch (algo) {
+#ifdef HAVE_LZ4
+        case COMPRESS_LZ4:
+            clen = LZ4_compress_default(src, (char *)dst, (int)len, (int)bound);
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case COMPRESS_ZSTD:
+            clen = ZSTD_compress(dst, bound, src, len, 1);
+            if (ZSTD_isError(clen)) {
+                clen = 0;
+            }
+            break;
+#endif
+    }
+    if (clen == 0 || COMPRESS_HEADER_SIZE + clen >= len
+            || len / COMPRESS_MAX_RATIO > clen) {
+        /* the reader wouldn't trust that ratio */
+        return blob;
+    }
+    rb_str_set_len(ret, COMPRESS_HEADER_SIZE + clen);
+    return ret;
+}
+
+/* Check if the value starts with the header of compressed data */
+    int
+cb_compressed_p(const char *bytes, size_t nbytes)
+{
+    unsigned char algo;
+
+    if (nbytes <= COMPRESS_HEADER_SIZE || memcmp(bytes, COMPRESS_MAGIC, COMPRESS_MAGIC_SIZE) != 0) {
+        return 0;
+    }
+    algo = (unsigned char)bytes[COMPRESS_MAGIC_SIZE];
+    return algo == COMPRESS_LZ4 || algo == COMPRESS_ZSTD;
+}
+
+/* Returns the String with the original data, Qundef if the payload
+ * doesn't match the header (e.g. the value has been appended), or Qnil
+ * if the algorithm is unavailable in this build. The caller should check
+ * the header with cb_compressed_p() */
+    VALUE
+cb_decompress_value(const char *bytes, size_t nbytes)
+{
+    const unsigned char *src = (const unsigned char *)bytes + COMPRESS_MAGIC_SIZE;
+    uint32_t algo;
+    size_t len;
+    VALUE ret;
+
+    algo = src[0];
+    len = ((size_t)src[1] << 24) | ((size_t)src[2] << 16)
+        | ((size_t)src[3] << 8) | (size_t)src[4];
+    bytes += COMPRESS_HEADER_SIZE;
+    nbytes -= COMPRESS_HEADER_SIZE;
+    if (len > COMPRESS_MAX_SIZE || len / COMPRESS_MAX_RATIO > nbytes) {
+        return Qundef;
+    }
+    switch (algo) {
+#ifdef HAVE_LZ4
+        case COMPRESS_LZ4:
+            ret = rb_str_new(NULL, len);
+            if (LZ4_decompress_safe(bytes, RSTRING_PTR(ret), (int)nbytes, (int)len) != (int)len) {
+                return Qundef;
+            }
+            return ret;
+#endif
+#ifdef HAVE_ZSTD
+        case COMPRESS_ZSTD:
+            ret = rb_str_new(NULL, len);
+            if (ZSTD_decompress(RSTRING_PTR(ret), len, bytes, nbytes) != len) {
+                return Qundef;
+            }
+            return ret;
+#endif
+        default:
+            (void)ret;
+            return Qnil;
+    }
+}
@@ -0,0 +1,299 @@
+/* vim: ft=c et ts=8 sts=4 sw=4 cino=
+ *
+ *   Copyright 2011, 2012 Couchbase, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "couchbase_ext.h"
+
+    void
+cb_connection_pool_free(void *ptr)
+{
+    struct connection_pool_st *pool = ptr;
+
+    if (pool) {
+        xfree(pool->connections);
+        xfree(pool->free);
+        xfree(pool);
+    }
+}
+
+    void
+cb_connection_pool_mark(void *ptr)
+{
+    struct connection_pool_st *pool = ptr;
+    size_t ii;
+
+    if (pool) {
+        for (ii = 0; ii < pool->size; ++ii) {
+            rb_gc_mark(pool->connections[ii]);
+        }
+        rb_gc_mark(pool->waiters);
+    }
+}
+
+    VALUE
+cb_connection_pool_alloc(VALUE klass)
+{
+    VALUE obj;
+    struct connection_pool_st *pool;
+
+    /* allocate new pool struct and set it to zero */
+    obj = Data_Make_Struct(klass, struct connection_pool_st,
+            cb_connection_pool_mark, cb_connection_pool_free, pool);
+    pool->waiters = Qnil;
+    return obj;
+}
+
+/*
+ * Initialize new connection pool
+ *
+ * @since 1.2.0
+ *
+ * Establishes +size+ connections with the same options. All arguments
+ * after the size are passed to {Bucket#initialize}.
+ *
+ * @param [Fixnum] size the number of connections
+ * @param [String, Hash] args the connection options (see
+ *   {Bucket#initialize})
+ *
+ * @example Pool of five connections to the "blog" bucket
+ *   pool = Couchbase::ConnectionPool.new(5, :bucket => "blog")
+ *   pool.with do |conn|
+ *     conn.get("foo")
+ *   end
+ *
+ * @raise [ArgumentError] if the size isn't positive
+ *
+ * @return [ConnectionPool]
+ */
+    VALUE
+cb_connection_pool_init(int argc, VALUE *argv, VALUE self)
+{
+    struct connection_pool_st *pool = DATA_PTR(self);
+    VALUE size, args;
+    long nn, ii;
+
+    rb_scan_args(argc, argv, "1*", &size, &args);
+    nn = NUM2LONG(size);
+    if (nn <= 0) {
+        rb_raise(rb_eArgError, "size of the pool should be positive");
+    }
+    pool->waiters = rb_ary_new();
+    pool->connections = xcalloc(nn, sizeof(VALUE));
+    pool->free = xcalloc(nn, sizeof(size_t));
+    if (pool->connections == NULL || pool->free == NULL) {
+        rb_raise(eClientNoMemoryError, "failed to allocate memory for ConnectionPool");
+    }
+    for (ii = 0; ii < nn; ++ii) {
+        pool->connections[ii] = rb_class_new_instance(RARRAY_LEN(args),
+                RARRAY_PTR(args), cBucket);
+        pool->size = ii + 1;
+    }
+    /* all connections are available, the first one on the top */
+    for (ii = 0; ii < nn; ++ii) {
+        pool->free[ii] = nn - ii - 1;
+    }
+    pool->nfree = nn;
+    return self;
+}
+
+    static VALUE
+do_park(VALUE ptr)
+{
+    struct connection_pool_st *pool = (struct connection_pool_st *)ptr;
+
+    rb_ary_push(pool->waiters, rb_thread_current());
+    rb_thread_sleep_forever();
+    return Qnil;
+}
+
+    static VALUE
+do_unpark(VALUE ptr)
+{
+    struct connection_pool_st *pool = (struct connection_pool_st *)ptr;
+    VALUE thread;
+
+    rb_ary_delete(pool->waiters, rb_thread_current());
+    /* the wakeup from checkin is lost if the thread has been interrupted
+     * (e.g. by Timeout) before it took the connection, so pass it on */
+    if (pool->nfree > 0) {
+        thread = rb_ary_entry(pool->waiters, 0);
+        if (thread != Qnil) {
+            rb_thread_wakeup(thread);
+        }
+    }
+    return Qnil;
+}
+
+/*
+ * Take the connection from the pool
+ *
+ * @since 1.2.0
+ *
+ * Blocks the current thread until some connection will be available. The
+ * connection must be returned back using {ConnectionPool#checkin}.
+ *
+ * @see ConnectionPool#with
+ *
+ * @return [Bucket]
+ */
+    VALUE
+cb_connection_pool_checkout(VALUE self)
+{
+    struct connection_pool_st *pool = DATA_PTR(self);
+
+    /* the pool is modified only under GVL, so that there no need for
+     * additional locking here */
+    while (pool->nfree == 0) {
+        rb_ensure(do_park, (VALUE)pool, do_unpark, (VALUE)pool);
+    }
+    return pool->connections[pool->free[--pool->nfree]];
+}
+
+/*
+ * Return the connection to the pool
+ *
+ * @since 1.2.0
+ *
+ * @param [Bucket] connection the connection received from
+ *   {ConnectionPool#checkout}
+ *
+ * @raise [ArgumentError] if the connection doesn't belong to the pool or
+ *   it has been returned already
+ *
+ * @return [nil]
+ */
+    VALUE
+cb_connection_pool_checkin(VALUE self, VALUE connection)
+{
+    struct connection_pool_st *pool = DATA_PTR(self);
+    size_t ii, jj;
+    VALUE thread;
+
+    for (ii = 0; ii < pool->size; ++ii) {
+        if (pool->connections[ii] == connection) {
+            break;
+        }
+    }
+    if (ii == pool->size) {
+        rb_raise(rb_eArgError, "the connection doesn't belong to the pool");
+    }
+    for (jj = 0; jj < pool->nfree; ++jj) {
+        if (pool->free[jj] == ii) {
+            rb_raise(rb_eArgError, "the connection has been checked in already");
+        }
+    }
+    pool->free[pool->nfree++] = ii;
+    thread = rb_ary_shift(pool->waiters);
+    if (thread != Qnil) {
+        rb_thread_wakeup(thread);
+    }
+    return Qnil;
+}
+
+    static VALUE
+do_with(VALUE connection)
+{
+    return rb_yield(connection);
+}
+
+    static VALUE
+ensure_with(VALUE ptr)
+{
+    VALUE *args = (VALUE *)ptr;
+    return cb_connection_pool_checkin(args[0], args[1]);
+}
+
+/*
+ * Execute the block with connection from the pool
+ *
+ * @since 1.2.0
+ *
+ * The connection will be returned back to the pool when the block
+ * completes, even if it raised an exception.
+ *
+ * @yieldparam [Bucket] connection
+ *
+ * @example
+ *   pool.with do |conn|
+ *     conn.set("foo", "bar")
+ *   end
+ *
+ * @return [Object] the value returned by the block
+ */
+    VALUE
+cb_connection_pool_with(VALUE self)
+{
+    VALUE args[2];
+
+    rb_need_block();
+    args[0] = self;
+    args[1] = cb_connection_pool_checkout(self);
+    return rb_ensure(do_with, args[1], ensure_with, (VALUE)args);
+}
+
+/*
+ * The number of connections in the pool
+ *
+ * @since 1.2.0
+ *
+ * @return [Fixnum]
+ */
+    VALUE
+cb_connection_pool_size(VALUE self)
+{
+    struct connection_pool_st *pool = DATA_PTR(self);
+    return ULONG2NUM(pool->size);
+}
+
+/*
+ * The number of connections which aren't checked out
+ *
+ * @since 1.2.0
+ *
+ * @return [Fixnum]
+ */
+    VALUE
+cb_connection_pool_available(VALUE self)
+{
+    struct connection_pool_st *pool = DATA_PTR(self);
+    return ULONG2NUM(pool->nfree);
+}
+
+/*
+ * Returns a string containing a human-readable representation of the
+ * ConnectionPool.
+ *
+ * @since 1.2.0
+ *
+ * @return [String]
+ */
+    VALUE
+cb_connection_pool_inspect(VALUE self)
+{
+    VALUE str;
+    struct connection_pool_st *pool = DATA_PTR(self);
+    char buf[200];
+
+    str = rb_str_buf_new2("#<");
+    rb_str_buf_cat2(str, rb_obj_classname(self));
+    snprintf(buf, 20, ":%p", (void *)self);
+    rb_str_buf_cat2(str, buf);
+    snprintf(buf, 100, " size:%lu available:%lu>",
+            (unsigned long)pool->size, (unsigned long)pool->nfree);
+    rb_str_buf_cat2(str, buf);
+
+    return str;
+}
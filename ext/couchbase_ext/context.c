@@ -0,0 +1,555 @@
+/* vim: ft=c et ts=8 sts=4 sw=4 cino=
+ *
+ *   Copyright 2011, 2012 Couchbase, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "couchbase_ext.h"
+
+/* The contexts are never returned to the allocator while the bucket is
+ * alive. Instead of the raw pointer, libcouchbase gets the cookie with
+ * the index of the context in the pool and its generation. The generation
+ * is incremented on each release, therefore the callbacks delivered after
+ * the context has been released (e.g. when the event loop was stopped
+ * before all responses arrived) could be detected and skipped. */
+#define CONTEXT_INDEX_BITS (sizeof(uintptr_t) > 4 ? 32 : 20)
+#define CONTEXT_INDEX_MASK (((uintptr_t)1 << CONTEXT_INDEX_BITS) - 1)
+
+    struct context_st *
+cb_context_alloc(struct bucket_st *bucket)
+{
+    struct context_pool_st *pool = &bucket->contexts;
+    struct context_st *ctx;
+    size_t idx, generation;
+
+    if (pool->nfree > 0) {
+        idx = pool->free[--pool->nfree];
+        ctx = pool->items[idx];
+    } else {
+        if (pool->size == pool->capacity) {
+            size_t capacity = pool->capacity ? pool->capacity * 2 : 16;
+            struct context_st **items;
+            size_t *stack;
+
+            if (capacity >= CONTEXT_INDEX_MASK) {
+                rb_raise(eClientNoMemoryError, "too many operations in flight");
+            }
+            items = xrealloc(pool->items, capacity * sizeof(struct context_st *));
+            if (items == NULL) {
+                rb_raise(eClientNoMemoryError, "failed to allocate memory for context");
+            }
+            pool->items = items;
+            stack = xrealloc(pool->free, capacity * sizeof(size_t));
+            if (stack == NULL) {
+                rb_raise(eClientNoMemoryError, "failed to allocate memory for context");
+            }
+            pool->free = stack;
+            pool->capacity = capacity;
+        }
+        ctx = xcalloc(1, sizeof(struct context_st));
+        if (ctx == NULL) {
+            rb_raise(eClientNoMemoryError, "failed to allocate memory for context");
+        }
+        idx = pool->size++;
+        pool->items[idx] = ctx;
+    }
+    generation = ctx->generation;
+    memset(ctx, 0, sizeof(struct context_st));
+    ctx->index = idx;
+    ctx->generation = generation;
+    ctx->bucket = bucket;
+    ctx->batch = Qnil;
+    ctx->keys = Qnil;
+    ctx->window = Qnil;
+    return ctx;
+}
+
+    void
+cb_context_free(struct context_st *ctx)
+{
+    struct context_pool_st *pool = &ctx->bucket->contexts;
+
+    if (ctx->key_slots) {
+        xfree(ctx->key_slots);
+        ctx->key_slots = NULL;
+    }
+    if (ctx->key_taken) {
+        xfree(ctx->key_taken);
+        ctx->key_taken = NULL;
+    }
+    cb_gc_unprotect(ctx->bucket, ctx->keys);
+    ctx->keys = Qnil;
+    cb_gc_unprotect(ctx->bucket, ctx->window);
+    ctx->window = Qnil;
+    ctx->generation++;
+    pool->free[pool->nfree++] = ctx->index;
+}
+
+/* Release the context of the operation, which hasn't been scheduled. The
+ * objects protected for the callbacks won't be needed anymore */
+    static void
+context_discard(struct context_st *ctx)
+{
+    struct bucket_st *bucket = ctx->bucket;
+
+    cb_gc_unprotect(bucket, ctx->proc);
+    cb_gc_unprotect(bucket, ctx->batch);
+    cb_gc_unprotect(bucket, ctx->observe_options);
+    cb_gc_unprotect(bucket, ctx->headers_val);
+    cb_context_free(ctx);
+}
+
+    static VALUE
+do_schedule(VALUE ptr)
+{
+    struct schedule_st *sched = (struct schedule_st *)ptr;
+    struct params_st *params = sched->params;
+    struct bucket_st *bucket = sched->bucket;
+    struct context_st *ctx;
+
+    ctx = sched->ctx = cb_context_alloc(bucket);
+    ctx->rv = sched->rv;
+    ctx->proc = cb_gc_protect(bucket, sched->proc);
+    ctx->observe_options = Qnil;
+    ctx->headers_val = Qnil;
+    ctx->exception = Qnil;
+    ctx->async = bucket->async;
+    if (params) {
+        if (params->batch && sched->proc != Qnil) {
+            ctx->batch = cb_gc_protect(bucket, rb_ary_new());
+        }
+        ctx->error_codes = params->error_codes;
+        ctx->keys = cb_gc_protect(bucket, params->keys);
+        ctx->window = cb_gc_protect(bucket, params->window);
+        ctx->window_pos = params->window_pos;
+    }
+    cb_wait_idle(bucket);
+    sched->err = sched->func(sched);
+    return Qnil;
+}
+
+/* Allocate the context for the command and fill the fields common to all
+ * operations, then run +func+, which fills the rest and schedules the
+ * command. The parameters (if any) are destroyed afterwards. If it raises
+ * (e.g. the thread has been interrupted in cb_wait_idle()) or the command
+ * cannot be scheduled, the context is released as well, so that neither
+ * the arena nor the slot of the pool stay occupied. Returns the context */
+    struct context_st *
+cb_context_schedule(struct schedule_st *sched,
+        lcb_error_t (*func)(struct schedule_st *sched), const char *msg, VALUE key)
+{
+    int fail = 0;
+    VALUE exc;
+
+    sched->ctx = NULL;
+    sched->func = func;
+    sched->err = LCB_SUCCESS;
+    rb_protect(do_schedule, (VALUE)sched, &fail);
+    if (sched->params) {
+        cb_params_destroy(sched->params);
+    }
+    if (fail) {
+        if (sched->ctx) {
+            context_discard(sched->ctx);
+            sched->ctx = NULL;
+        }
+        /* raise exception from protected block */
+        rb_jump_tag(fail);
+    }
+    exc = cb_check_error(sched->err, msg, key);
+    if (exc != Qnil) {
+        context_discard(sched->ctx);
+        sched->ctx = NULL;
+        rb_exc_raise(exc);
+    }
+    return sched->ctx;
+}
+
+    void
+cb_context_pool_destroy(struct bucket_st *bucket)
+{
+    struct context_pool_st *pool = &bucket->contexts;
+    size_t ii;
+
+    for (ii = 0; ii < pool->size; ++ii) {
+        xfree(pool->items[ii]);
+    }
+    xfree(pool->items);
+    xfree(pool->free);
+    memset(pool, 0, sizeof(struct context_pool_st));
+}
+
+    const void *
+cb_context_cookie(struct context_st *ctx)
+{
+    uintptr_t cookie = (uintptr_t)ctx->generation << CONTEXT_INDEX_BITS;
+    return (const void *)(cookie | (ctx->index + 1));
+}
+
+    struct context_st *
+cb_context_resolve(struct bucket_st *bucket, const void *cookie)
+{
+    struct context_pool_st *pool = &bucket->contexts;
+    size_t idx = ((uintptr_t)cookie & CONTEXT_INDEX_MASK);
+    struct context_st *ctx;
+
+    if (idx == 0 || idx > pool->size) {
+        return NULL;
+    }
+    ctx = pool->items[idx - 1];
+    if (cb_context_cookie(ctx) != cookie) {
+        return NULL;    /* the context has been released already */
+    }
+    return ctx;
+}
+
+/* Pass the result to the block of asynchronous operation. When the
+ * operation was scheduled with :batch_callback, the results are collected
+ * and yielded together by cb_context_finish() */
+    void
+cb_context_yield(struct context_st *ctx, VALUE res)
+{
+    if (ctx->batch != Qnil) {
+        rb_ary_push(ctx->batch, res);
+        return;
+    }
+    if (!ctx->arity_known) {
+        ctx->arity = cb_proc_arity(ctx->proc);
+        ctx->arity_known = 1;
+    }
+    cb_proc_call_argv(ctx->proc, ctx->arity, 1, &res);
+}
+
+/* Must be called when the last response of the operation has been
+ * received. Releases the block and flushes collected results */
+    void
+cb_context_finish(struct context_st *ctx)
+{
+    struct bucket_st *bucket = ctx->bucket;
+    VALUE proc = ctx->proc, batch = ctx->batch;
+
+    cb_gc_unprotect(bucket, proc);
+    if (batch != Qnil) {
+        ctx->batch = Qnil;
+        cb_gc_unprotect(bucket, batch);
+        if (proc != Qnil) {
+            cb_context_yield(ctx, batch);
+        }
+        RB_GC_GUARD(batch);
+    }
+    RB_GC_GUARD(proc);
+}
+
+/* Returns the exception for the error, or nil if the operation reports
+ * errors as status codes (:errors => :codes). In this mode the results
+ * passed to the block carry the code and build the exception on demand,
+ * and synchronous operations don't raise for missing or existing keys */
+    VALUE
+cb_context_check_error(struct context_st *ctx, lcb_error_t rc, const char *msg, VALUE key)
+{
+    if (ctx->error_codes && rc != LCB_SUCCESS) {
+        if (ctx->async ? ctx->proc != Qnil : cb_error_key_status_p(rc)) {
+            return Qnil;
+        }
+    }
+    return cb_check_error(rc, msg, key);
+}
+
+/* The lists shorter than this are scanned linearly */
+#define KEY_TABLE_MIN_KEYS 8
+
+    static size_t
+key_hash(const char *key, size_t nkey)
+{
+    size_t hash = (size_t)2166136261U, ii;
+
+    for (ii = 0; ii < nkey; ++ii) {
+        hash = (hash ^ (unsigned char)key[ii]) * 16777619U;
+    }
+    return hash;
+}
+
+    static inline int
+key_equal_p(VALUE str, const char *key, size_t nkey)
+{
+    return (size_t)RSTRING_LEN(str) == nkey && memcmp(RSTRING_PTR(str), key, nkey) == 0;
+}
+
+    static void
+key_table_insert(struct context_st *ctx, size_t from)
+{
+    VALUE *keys = RARRAY_PTR(ctx->keys);
+    size_t nkeys = RARRAY_LEN(ctx->keys), mask = ctx->key_nslots - 1, ii, jj;
+
+    for (ii = from; ii < nkeys; ++ii) {
+        jj = key_hash(RSTRING_PTR(keys[ii]), RSTRING_LEN(keys[ii])) & mask;
+        while (ctx->key_slots[jj] != 0) {
+            jj = (jj + 1) & mask;
+        }
+        ctx->key_slots[jj] = ii + 1;
+    }
+}
+
+    static void
+key_table_build(struct context_st *ctx)
+{
+    size_t nkeys = RARRAY_LEN(ctx->keys), nslots = 16;
+
+    while (nslots < nkeys * 2) {
+        nslots *= 2;
+    }
+    ctx->key_slots = xcalloc(nslots, sizeof(size_t));
+    if (ctx->key_slots == NULL) {
+        rb_raise(eClientNoMemoryError, "failed to allocate memory for key index");
+    }
+    ctx->key_nslots = nslots;
+    key_table_insert(ctx, 0);
+}
+
+/* Find the position of the key in the request. The responses for
+ * duplicate keys are mapped to different positions, because each of them
+ * is marked as taken once the response has been received */
+    static size_t
+key_lookup(struct context_st *ctx, const char *key, size_t nkey)
+{
+    VALUE *keys = RARRAY_PTR(ctx->keys);
+    size_t nkeys = RARRAY_LEN(ctx->keys), mask, ii, idx, found = KEY_INDEX_NONE;
+
+    if (nkeys == 1) {
+        return key_equal_p(keys[0], key, nkey) ? 0 : KEY_INDEX_NONE;
+    }
+    if (ctx->key_taken == NULL) {
+        ctx->key_taken = xcalloc(nkeys, sizeof(char));
+        if (ctx->key_taken == NULL) {
+            rb_raise(eClientNoMemoryError, "failed to allocate memory for key index");
+        }
+    }
+    /* the responses usually arrive in the order of the requests */
+    idx = ctx->key_next;
+    if (idx < nkeys && !ctx->key_taken[idx] && key_equal_p(keys[idx], key, nkey)) {
+        found = idx;
+    } else if (nkeys < KEY_TABLE_MIN_KEYS) {
+        for (ii = 0; ii < nkeys; ++ii) {
+            if (key_equal_p(keys[ii], key, nkey)) {
+                if (!ctx->key_taken[ii]) {
+                    found = ii;
+                    break;
+                } else if (found == KEY_INDEX_NONE) {
+                    found = ii;
+                }
+            }
+        }
+    } else {
+        if (ctx->key_slots == NULL) {
+            key_table_build(ctx);
+        }
+        mask = ctx->key_nslots - 1;
+        for (ii = key_hash(key, nkey) & mask; ctx->key_slots[ii] != 0; ii = (ii + 1) & mask) {
+            idx = ctx->key_slots[ii] - 1;
+            if (key_equal_p(keys[idx], key, nkey)) {
+                if (!ctx->key_taken[idx]) {
+                    found = idx;
+                    break;
+                } else if (found == KEY_INDEX_NONE) {
+                    found = idx;
+                }
+            }
+        }
+    }
+    if (found != KEY_INDEX_NONE) {
+        ctx->key_taken[found] = 1;
+        ctx->key_next = found + 1;
+    }
+    return found;
+}
+
+/* Returns the key of the response with the key prefix skipped, and sets
+ * +key_index+ of the context to its position in the request. When
+ * possible the String passed to the operation is returned, therefore the
+ * callbacks don't allocate new strings for the keys */
+    VALUE
+cb_context_key(struct context_st *ctx, const char *key, size_t nkey)
+{
+    struct bucket_st *bucket = ctx->bucket;
+    size_t nprefix;
+
+    if (bucket->key_prefix) {
+        nprefix = RSTRING_LEN(bucket->key_prefix_val);
+        if (nkey >= nprefix) {
+            key += nprefix;
+            nkey -= nprefix;
+        }
+    }
+    ctx->key_index = KEY_INDEX_NONE;
+    if (TYPE(ctx->keys) == T_STRING) {
+        /* the command with single key */
+        if (key_equal_p(ctx->keys, key, nkey)) {
+            ctx->key_index = 0;
+            return ctx->keys;
+        }
+    } else if (!NIL_P(ctx->keys)) {
+        ctx->key_index = key_lookup(ctx, key, nkey);
+        if (ctx->key_index != KEY_INDEX_NONE) {
+            return RARRAY_PTR(ctx->keys)[ctx->key_index];
+        }
+    }
+    /* the key has been modified by the application in the meantime */
+    return cb_str_new(bucket->encoding, key, nkey);
+}
+
+/* Append the keys of the next window to the keys of the operation, and
+ * extend the index built by key_lookup() */
+    static void
+key_append(struct context_st *ctx, VALUE keys)
+{
+    size_t from = RARRAY_LEN(ctx->keys), nkeys;
+    char *taken;
+
+    if (TYPE(keys) == T_STRING) {
+        rb_ary_push(ctx->keys, keys);
+    } else {
+        rb_ary_concat(ctx->keys, keys);
+    }
+    nkeys = RARRAY_LEN(ctx->keys);
+    if (ctx->key_taken) {
+        taken = xrealloc(ctx->key_taken, nkeys * sizeof(char));
+        if (taken == NULL) {
+            rb_raise(eClientNoMemoryError, "failed to allocate memory for key index");
+        }
+        memset(taken + from, 0, nkeys - from);
+        ctx->key_taken = taken;
+    }
+    if (ctx->key_slots) {
+        if (ctx->key_nslots < nkeys * 2) {
+            /* it will be rebuilt with more slots on next lookup */
+            xfree(ctx->key_slots);
+            ctx->key_slots = NULL;
+        } else {
+            key_table_insert(ctx, from);
+        }
+    }
+}
+
+    static VALUE
+do_window_next(VALUE ptr)
+{
+    struct context_st *ctx = (struct context_st *)ptr;
+    struct bucket_st *bucket = ctx->bucket;
+    struct params_st params;
+    lcb_error_t err = LCB_SUCCESS;
+    size_t num = 0;
+    VALUE exc, operation = Qnil;
+
+    cb_params_build_window(&params, bucket, ctx->window, &ctx->window_pos);
+    switch (params.type) {
+        case cmd_get:
+            operation = sym_get;
+            num = params.cmd.get.num;
+            if (params.cmd.get.replica) {
+                err = lcb_get_replica(bucket->handle, cb_context_cookie(ctx),
+                        num, params.cmd.get.ptr_gr);
+            } else {
+                err = lcb_get(bucket->handle, cb_context_cookie(ctx),
+                        num, params.cmd.get.ptr);
+            }
+            break;
+        case cmd_store:
+            switch (params.cmd.store.operation) {
+                case LCB_ADD:
+                    operation = sym_add;
+                    break;
+                case LCB_REPLACE:
+                    operation = sym_replace;
+                    break;
+                case LCB_APPEND:
+                    operation = sym_append;
+                    break;
+                case LCB_PREPEND:
+                    operation = sym_prepend;
+                    break;
+                default:
+                    operation = sym_set;
+            }
+            num = params.cmd.store.num;
+            err = lcb_store(bucket->handle, cb_context_cookie(ctx),
+                    num, params.cmd.store.ptr);
+            break;
+        case cmd_remove:
+            operation = sym_delete;
+            num = params.cmd.remove.num;
+            err = lcb_remove(bucket->handle, cb_context_cookie(ctx),
+                    num, params.cmd.remove.ptr);
+            break;
+        case cmd_touch:
+            operation = sym_touch;
+            num = params.cmd.touch.num;
+            err = lcb_touch(bucket->handle, cb_context_cookie(ctx),
+                    num, params.cmd.touch.ptr);
+            break;
+        default:
+            break;
+    }
+    cb_params_destroy(&params);
+    exc = cb_check_error(err, "failed to schedule request", Qnil);
+    if (exc != Qnil) {
+        rb_ivar_set(exc, id_iv_operation, operation);
+        rb_exc_raise(exc);
+    }
+    ctx->nqueries += num;
+    ctx->window_size = num;
+    bucket->nbytes += params.npayload;
+    if (params.keys != Qnil) {
+        key_append(ctx, params.keys);
+    }
+    if (ctx->window_pos >= cb_params_window_total(ctx->window)) {
+        cb_gc_unprotect(bucket, ctx->window);
+        ctx->window = Qnil;
+    }
+    return Qnil;
+}
+
+/* Schedule the next window of the command split by cb_params_build().
+ * It should be called when a response has been received: the next window
+ * is scheduled as soon as all responses for the windows before the last
+ * one have arrived. Therefore at most two windows are in flight, and
+ * the next one is being sent while the responses for the other arrive */
+    void
+cb_context_window_next(struct context_st *ctx)
+{
+    struct bucket_st *bucket = ctx->bucket;
+    VALUE exc;
+    int fail = 0;
+
+    if (NIL_P(ctx->window) || ctx->nqueries > ctx->window_size) {
+        return;
+    }
+    rb_protect(do_window_next, (VALUE)ctx, &fail);
+    if (fail) {
+        /* the rest of the keys won't be sent */
+        exc = rb_errinfo();
+        rb_set_errinfo(Qnil);
+        cb_gc_unprotect(bucket, ctx->window);
+        ctx->window = Qnil;
+        if (ctx->async) {
+            if (bucket->on_error_proc != Qnil) {
+                cb_proc_call(bucket->on_error_proc, 3, rb_attr_get(exc, id_iv_operation), Qnil, exc);
+            } else if (NIL_P(bucket->exception)) {
+                bucket->exception = exc;
+            }
+        }
+        if (NIL_P(ctx->exception)) {
+            ctx->exception = cb_gc_protect(bucket, exc);
+        }
+    }
+}
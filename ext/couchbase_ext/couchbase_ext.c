@@ -23,6 +23,9 @@ VALUE cBucket;
 VALUE cCouchRequest;
 VALUE cResult;
 VALUE cTimer;
+VALUE cConnectionPool;
+VALUE cLazyValue;
+VALUE cViewRowsParser;
 
 /* Modules */
 VALUE mCouchbase;
@@ -33,12 +36,17 @@ VALUE mURI;
 
 /* Symbols */
 ID sym_add;
+ID sym_algo;
 ID sym_append;
 ID sym_assemble_hash;
+ID sym_batch_callback;
+ID sym_binary;
 ID sym_body;
 ID sym_bucket;
 ID sym_cas;
 ID sym_chunked;
+ID sym_codes;
+ID sym_compression;
 ID sym_content_type;
 ID sym_create;
 ID sym_decrement;
@@ -50,8 +58,13 @@ ID sym_delete;
 ID sym_delta;
 ID sym_development;
 ID sym_document;
+ID sym_encoded;
+ID sym_encoding;
 ID sym_environment;
+ID sym_errors;
+ID sym_exceptions;
 ID sym_extended;
+ID sym_external;
 ID sym_flags;
 ID sym_format;
 ID sym_found;
@@ -61,10 +74,15 @@ ID sym_http_request;
 ID sym_increment;
 ID sym_initial;
 ID sym_key_prefix;
+ID sym_lazy;
 ID sym_lock;
+ID sym_lz4;
 ID sym_management;
 ID sym_marshal;
 ID sym_method;
+ID sym_min_size;
+ID sym_multi_json;
+ID sym_native;
 ID sym_node_list;
 ID sym_not_found;
 ID sym_num_replicas;
@@ -82,17 +100,22 @@ ID sym_put;
 ID sym_quiet;
 ID sym_replace;
 ID sym_replica;
+ID sym_rows;
 ID sym_send_threshold;
 ID sym_set;
 ID sym_stats;
+ID sym_thread_safe;
 ID sym_timeout;
+ID sym_total_rows;
 ID sym_touch;
 ID sym_ttl;
 ID sym_type;
 ID sym_unlock;
 ID sym_username;
+ID sym_utf8;
 ID sym_version;
 ID sym_view;
+ID sym_zstd;
 ID id_arity;
 ID id_call;
 ID id_delete;
@@ -114,6 +137,7 @@ ID id_iv_status;
 ID id_iv_time_to_persist;
 ID id_iv_time_to_replicate;
 ID id_iv_value;
+ID id_keys;
 ID id_load;
 ID id_match;
 ID id_observe_and_wait;
@@ -406,29 +430,35 @@ Init_couchbase_ext(void)
      * @since 1.0.0
      */
     cResult = rb_define_class_under(mCouchbase, "Result", rb_cObject);
+    rb_define_alloc_func(cResult, cb_result_alloc);
+    rb_define_method(cResult, "initialize_copy", cb_result_init_copy, 1);
     rb_define_method(cResult, "inspect", cb_result_inspect, 0);
     rb_define_method(cResult, "success?", cb_result_success_p, 0);
+    rb_define_method(cResult, "error_code", cb_result_error_code, 0);
     /* Document-method: operation
      *
      * @since 1.0.0
      *
      * @return [Symbol]
      */
-    rb_define_attr(cResult, "operation", 1, 0);
+    /* rb_define_attr(cResult, "operation", 1, 0); */
+    rb_define_method(cResult, "operation", cb_result_operation_get, 0);
     /* Document-method: error
      *
      * @since 1.0.0
      *
      * @return [Couchbase::Error::Base]
      */
-    rb_define_attr(cResult, "error", 1, 0);
+    /* rb_define_attr(cResult, "error", 1, 0); */
+    rb_define_method(cResult, "error", cb_result_error_get, 0);
     /* Document-method: key
      *
      * @since 1.0.0
      *
      * @return [String]
      */
-    rb_define_attr(cResult, "key", 1, 0);
+    /* rb_define_attr(cResult, "key", 1, 0); */
+    rb_define_method(cResult, "key", cb_result_key_get, 0);
     id_iv_key = rb_intern("@key");
     /* Document-method: value
      *
@@ -436,7 +466,8 @@ Init_couchbase_ext(void)
      *
      * @return [String]
      */
-    rb_define_attr(cResult, "value", 1, 0);
+    /* rb_define_attr(cResult, "value", 1, 0); */
+    rb_define_method(cResult, "value", cb_result_value_get, 0);
     id_iv_value = rb_intern("@value");
     /* Document-method: cas
      *
@@ -444,7 +475,8 @@ Init_couchbase_ext(void)
      *
      * @return [Fixnum]
      */
-    rb_define_attr(cResult, "cas", 1, 0);
+    /* rb_define_attr(cResult, "cas", 1, 0); */
+    rb_define_method(cResult, "cas", cb_result_cas_get, 0);
     id_iv_cas = rb_intern("@cas");
     /* Document-method: flags
      *
@@ -452,7 +484,8 @@ Init_couchbase_ext(void)
      *
      * @return [Fixnum]
      */
-    rb_define_attr(cResult, "flags", 1, 0);
+    /* rb_define_attr(cResult, "flags", 1, 0); */
+    rb_define_method(cResult, "flags", cb_result_flags_get, 0);
     id_iv_flags = rb_intern("@flags");
     /* Document-method: node
      *
@@ -460,7 +493,8 @@ Init_couchbase_ext(void)
      *
      * @return [String]
      */
-    rb_define_attr(cResult, "node", 1, 0);
+    /* rb_define_attr(cResult, "node", 1, 0); */
+    rb_define_method(cResult, "node", cb_result_node_get, 0);
     id_iv_node = rb_intern("@node");
     /* Document-method: headers
      *
@@ -470,12 +504,14 @@ Init_couchbase_ext(void)
      *
      * @return [Hash]
      */
-    rb_define_attr(cResult, "headers", 1, 0);
+    /* rb_define_attr(cResult, "headers", 1, 0); */
+    rb_define_method(cResult, "headers", cb_result_headers_get, 0);
     id_iv_headers = rb_intern("@headers");
     /* Document-method: completed
      * In {Bucket::CouchRequest} operations used to mark the final call
      * @return [Boolean] */
-    rb_define_attr(cResult, "completed", 1, 0);
+    /* rb_define_attr(cResult, "completed", 1, 0); */
+    rb_define_method(cResult, "completed", cb_result_completed_get, 0);
     rb_define_alias(cResult, "completed?", "completed");
     id_iv_completed = rb_intern("@completed");
     /* Document-method: status
@@ -491,7 +527,8 @@ Init_couchbase_ext(void)
      *
      * @return [Symbol]
      */
-    rb_define_attr(cResult, "status", 1, 0);
+    /* rb_define_attr(cResult, "status", 1, 0); */
+    rb_define_method(cResult, "status", cb_result_status_get, 0);
     id_iv_status = rb_intern("@status");
     /* Document-method: from_master
      *
@@ -502,7 +539,8 @@ Init_couchbase_ext(void)
      * True if key stored on master
      * @return [Boolean]
      */
-    rb_define_attr(cResult, "from_master", 1, 0);
+    /* rb_define_attr(cResult, "from_master", 1, 0); */
+    rb_define_method(cResult, "from_master", cb_result_from_master_get, 0);
     rb_define_alias(cResult, "from_master?", "from_master");
     id_iv_from_master = rb_intern("@from_master");
     /* Document-method: time_to_persist
@@ -514,7 +552,8 @@ Init_couchbase_ext(void)
      * Average time needed to persist key on the disk (zero if unavailable)
      * @return [Fixnum]
      */
-    rb_define_attr(cResult, "time_to_persist", 1, 0);
+    /* rb_define_attr(cResult, "time_to_persist", 1, 0); */
+    rb_define_method(cResult, "time_to_persist", cb_result_time_to_persist_get, 0);
     rb_define_alias(cResult, "ttp", "time_to_persist");
     id_iv_time_to_persist = rb_intern("@time_to_persist");
     /* Document-method: time_to_persist
@@ -526,7 +565,8 @@ Init_couchbase_ext(void)
      * Average time needed to replicate key on the disk (zero if unavailable)
      * @return [Fixnum]
      */
-    rb_define_attr(cResult, "time_to_replicate", 1, 0);
+    /* rb_define_attr(cResult, "time_to_replicate", 1, 0); */
+    rb_define_method(cResult, "time_to_replicate", cb_result_time_to_replicate_get, 0);
     rb_define_alias(cResult, "ttr", "time_to_replicate");
     id_iv_time_to_replicate = rb_intern("@time_to_replicate");
 
@@ -570,6 +610,8 @@ Init_couchbase_ext(void)
     rb_define_method(cBucket, "get", cb_bucket_get, -1);
     rb_define_method(cBucket, "run", cb_bucket_run, -1);
     rb_define_method(cBucket, "stop", cb_bucket_stop, 0);
+    rb_define_private_method(cBucket, "async_schedule", cb_bucket_async_schedule, 0);
+    rb_define_private_method(cBucket, "async_wait", cb_bucket_async_wait, 0);
     rb_define_method(cBucket, "touch", cb_bucket_touch, -1);
     rb_define_method(cBucket, "delete", cb_bucket_delete, -1);
     rb_define_method(cBucket, "stats", cb_bucket_stats, -1);
@@ -591,6 +633,7 @@ Init_couchbase_ext(void)
 
     rb_define_method(cBucket, "connected?", cb_bucket_connected_p, 0);
     rb_define_method(cBucket, "async?", cb_bucket_async_p, 0);
+    rb_define_method(cBucket, "thread_safe?", cb_bucket_thread_safe_p, 0);
 
     /* Document-method: quiet
      * Flag specifying behaviour for operations on missing keys
@@ -855,6 +898,40 @@ Init_couchbase_ext(void)
     /* rb_define_attr(cBucket, "default_observe_timeout", 1, 1); */
     rb_define_method(cBucket, "default_observe_timeout", cb_bucket_default_observe_timeout_get, 0);
     rb_define_method(cBucket, "default_observe_timeout=", cb_bucket_default_observe_timeout_set, 1);
+    /* Document-method: compression
+     *
+     * @since 1.2.0
+     *
+     * The compression settings for the values
+     *
+     * @return [Hash, nil]
+     */
+    /* rb_define_attr(cBucket, "compression", 1, 1); */
+    rb_define_method(cBucket, "compression", cb_bucket_compression_get, 0);
+    rb_define_method(cBucket, "compression=", cb_bucket_compression_set, 1);
+    /* Document-method: errors
+     *
+     * @since 1.2.0
+     *
+     * The way the operations report errors: +:exceptions+ or +:codes+
+     *
+     * @return [Symbol]
+     */
+    /* rb_define_attr(cBucket, "errors", 1, 1); */
+    rb_define_method(cBucket, "errors", cb_bucket_errors_get, 0);
+    rb_define_method(cBucket, "errors=", cb_bucket_errors_set, 1);
+    /* Document-method: encoding
+     *
+     * @since 1.2.0
+     *
+     * The encoding of the keys and values received from the server:
+     * +:external+, +:utf8+ or +:binary+
+     *
+     * @return [Symbol]
+     */
+    /* rb_define_attr(cBucket, "encoding", 1, 1); */
+    rb_define_method(cBucket, "encoding", cb_bucket_encoding_get, 0);
+    rb_define_method(cBucket, "encoding=", cb_bucket_encoding_set, 1);
 
     cCouchRequest = rb_define_class_under(cBucket, "CouchRequest", rb_cObject);
     rb_define_alloc_func(cCouchRequest, cb_http_request_alloc);
@@ -881,6 +958,41 @@ Init_couchbase_ext(void)
     rb_define_method(cTimer, "inspect", cb_timer_inspect, 0);
     rb_define_method(cTimer, "cancel", cb_timer_cancel, 0);
 
+    rb_define_singleton_method(mCouchbase, "json_backend", cb_json_backend_get, 0);
+    rb_define_singleton_method(mCouchbase, "json_backend=", cb_json_backend_set, 1);
+
+    cConnectionPool = rb_define_class_under(mCouchbase, "ConnectionPool", rb_cObject);
+    rb_define_alloc_func(cConnectionPool, cb_connection_pool_alloc);
+    rb_define_method(cConnectionPool, "initialize", cb_connection_pool_init, -1);
+    rb_define_method(cConnectionPool, "inspect", cb_connection_pool_inspect, 0);
+    rb_define_method(cConnectionPool, "checkout", cb_connection_pool_checkout, 0);
+    rb_define_method(cConnectionPool, "checkin", cb_connection_pool_checkin, 1);
+    rb_define_method(cConnectionPool, "with", cb_connection_pool_with, 0);
+    rb_define_method(cConnectionPool, "size", cb_connection_pool_size, 0);
+    rb_define_method(cConnectionPool, "available", cb_connection_pool_available, 0);
+
+    /* Document-class: Couchbase::LazyValue
+     * The value fetched with +:lazy+ option, decoded on first access
+     *
+     * @since 1.2.0
+     */
+    cLazyValue = rb_define_class_under(mCouchbase, "LazyValue", rb_cObject);
+    rb_undef_alloc_func(cLazyValue);
+    rb_define_method(cLazyValue, "inspect", cb_lazy_value_inspect, 0);
+    rb_define_method(cLazyValue, "value", cb_lazy_value_value, 0);
+    rb_define_method(cLazyValue, "raw", cb_lazy_value_raw, 0);
+    rb_define_method(cLazyValue, "flags", cb_lazy_value_flags, 0);
+    rb_define_method(cLazyValue, "decoded?", cb_lazy_value_decoded_p, 0);
+
+    /* Document-class: Couchbase::ViewRowsParser
+     * @private The incremental splitter of the view response into rows
+     *
+     * @since 1.2.0
+     */
+    cViewRowsParser = rb_define_class_under(mCouchbase, "ViewRowsParser", rb_cObject);
+    rb_define_alloc_func(cViewRowsParser, cb_view_rows_parser_alloc);
+    rb_define_method(cViewRowsParser, "feed", cb_view_rows_parser_feed, 1);
+
     /* Define symbols */
     id_arity = rb_intern("arity");
     id_call = rb_intern("call");
@@ -890,6 +1002,7 @@ Init_couchbase_ext(void)
     id_flatten_bang = rb_intern("flatten!");
     id_has_key_p = rb_intern("has_key?");
     id_host = rb_intern("host");
+    id_keys = rb_intern("keys");
     id_load = rb_intern("load");
     id_match = rb_intern("match");
     id_observe_and_wait = rb_intern("observe_and_wait");
@@ -903,12 +1016,17 @@ Init_couchbase_ext(void)
     id_verify_observe_options = rb_intern("verify_observe_options");
 
     sym_add = ID2SYM(rb_intern("add"));
+    sym_algo = ID2SYM(rb_intern("algo"));
     sym_append = ID2SYM(rb_intern("append"));
     sym_assemble_hash = ID2SYM(rb_intern("assemble_hash"));
+    sym_batch_callback = ID2SYM(rb_intern("batch_callback"));
+    sym_binary = ID2SYM(rb_intern("binary"));
     sym_body = ID2SYM(rb_intern("body"));
     sym_bucket = ID2SYM(rb_intern("bucket"));
     sym_cas = ID2SYM(rb_intern("cas"));
     sym_chunked = ID2SYM(rb_intern("chunked"));
+    sym_codes = ID2SYM(rb_intern("codes"));
+    sym_compression = ID2SYM(rb_intern("compression"));
     sym_content_type = ID2SYM(rb_intern("content_type"));
     sym_create = ID2SYM(rb_intern("create"));
     sym_decrement = ID2SYM(rb_intern("decrement"));
@@ -919,8 +1037,13 @@ Init_couchbase_ext(void)
     sym_delta = ID2SYM(rb_intern("delta"));
     sym_development = ID2SYM(rb_intern("development"));
     sym_document = ID2SYM(rb_intern("document"));
+    sym_encoded = ID2SYM(rb_intern("encoded"));
+    sym_encoding = ID2SYM(rb_intern("encoding"));
     sym_environment = ID2SYM(rb_intern("environment"));
+    sym_errors = ID2SYM(rb_intern("errors"));
+    sym_exceptions = ID2SYM(rb_intern("exceptions"));
     sym_extended = ID2SYM(rb_intern("extended"));
+    sym_external = ID2SYM(rb_intern("external"));
     sym_flags = ID2SYM(rb_intern("flags"));
     sym_format = ID2SYM(rb_intern("format"));
     sym_found = ID2SYM(rb_intern("found"));
@@ -930,10 +1053,15 @@ Init_couchbase_ext(void)
     sym_increment = ID2SYM(rb_intern("increment"));
     sym_initial = ID2SYM(rb_intern("initial"));
     sym_key_prefix = ID2SYM(rb_intern("key_prefix"));
+    sym_lazy = ID2SYM(rb_intern("lazy"));
     sym_lock = ID2SYM(rb_intern("lock"));
+    sym_lz4 = ID2SYM(rb_intern("lz4"));
     sym_management = ID2SYM(rb_intern("management"));
     sym_marshal = ID2SYM(rb_intern("marshal"));
     sym_method = ID2SYM(rb_intern("method"));
+    sym_min_size = ID2SYM(rb_intern("min_size"));
+    sym_multi_json = ID2SYM(rb_intern("multi_json"));
+    sym_native = ID2SYM(rb_intern("native"));
     sym_node_list = ID2SYM(rb_intern("node_list"));
     sym_not_found = ID2SYM(rb_intern("not_found"));
     sym_num_replicas = ID2SYM(rb_intern("num_replicas"));
@@ -951,15 +1079,22 @@ Init_couchbase_ext(void)
     sym_quiet = ID2SYM(rb_intern("quiet"));
     sym_replace = ID2SYM(rb_intern("replace"));
     sym_replica = ID2SYM(rb_intern("replica"));
+    sym_rows = ID2SYM(rb_intern("rows"));
     sym_send_threshold = ID2SYM(rb_intern("send_threshold"));
     sym_set = ID2SYM(rb_intern("set"));
     sym_stats = ID2SYM(rb_intern("stats"));
+    sym_thread_safe = ID2SYM(rb_intern("thread_safe"));
     sym_timeout = ID2SYM(rb_intern("timeout"));
+    sym_total_rows = ID2SYM(rb_intern("total_rows"));
     sym_touch = ID2SYM(rb_intern("touch"));
     sym_ttl = ID2SYM(rb_intern("ttl"));
     sym_type = ID2SYM(rb_intern("type"));
     sym_unlock = ID2SYM(rb_intern("unlock"));
     sym_username = ID2SYM(rb_intern("username"));
+    sym_utf8 = ID2SYM(rb_intern("utf8"));
     sym_version = ID2SYM(rb_intern("version"));
     sym_view = ID2SYM(rb_intern("view"));
+    sym_zstd = ID2SYM(rb_intern("zstd"));
+
+    cb_json_backend = sym_native;
 }
@@ -40,6 +40,15 @@ extern hrtime_t gethrtime(void);
 #define STR_NEW_CSTR(str) rb_str_new2((str))
 #endif
 
+#if defined(HAVE_RUBY_THREAD_H) && defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL) && defined(HAVE_RB_THREAD_CALL_WITH_GVL) && defined(HAVE_PIPE)
+#include <ruby/thread.h>
+#include <unistd.h>
+#include <fcntl.h>
+/* run lcb_wait() without GVL, see cb_wait(). The loop is interrupted
+ * through the pipe, which it is watching */
+#define CB_RELEASE_GVL 1
+#endif
+
 #ifdef HAVE_STDARG_PROTOTYPES
 #include <stdarg.h>
 #define va_init_list(a,b) va_start(a,b)
@@ -60,8 +69,45 @@ extern hrtime_t gethrtime(void);
 #define FMT_MARSHAL     0x1
 #define FMT_PLAIN       0x2
 
+/* the compression algorithms (see compression.c) */
+#define COMPRESS_LZ4    0x1
+#define COMPRESS_ZSTD   0x2
+
+/* the position of the response key in the request is unknown */
+#define KEY_INDEX_NONE ((size_t)-1)
+
+/* the encoding of the strings received from the server */
+#define ENCODING_EXTERNAL   0   /* Encoding.default_external */
+#define ENCODING_UTF8       1
+#define ENCODING_BINARY     2
+
 #define PACKET_HEADER_SIZE 24
 /* Structs */
+struct object_space_st
+{
+    VALUE *slots;           /* open addressing table of protected objects */
+    size_t capacity;        /* the number of slots, power of two */
+    size_t size;            /* the number of protected objects */
+    size_t used;            /* the number of non-empty slots (including removed) */
+};
+
+struct context_st;
+struct context_pool_st
+{
+    struct context_st **items;  /* all contexts allocated by the bucket */
+    size_t size;
+    size_t capacity;
+    size_t *free;           /* the stack of indexes of released contexts */
+    size_t nfree;
+};
+
+struct arena_st
+{
+    char *data;             /* the memory for command arguments, reused between operations */
+    size_t capacity;
+    int busy;               /* non-zero if the arena is used by some operation */
+};
+
 struct bucket_st
 {
     lcb_t handle;
@@ -75,10 +121,14 @@ struct bucket_st
     char *password;
     int async;
     int quiet;
+    int error_codes;         /* report errors as status codes (:errors => :codes) */
+    int encoding;            /* ENCODING_EXTERNAL, ENCODING_UTF8 or ENCODING_BINARY */
     VALUE default_format;    /* should update +default_flags+ on change */
     uint32_t default_flags;
     time_t default_ttl;
     time_t default_observe_timeout;
+    uint32_t compression;   /* COMPRESS_LZ4, COMPRESS_ZSTD or zero if disabled */
+    size_t compression_min_size; /* the values shorter than this are sent as is */
     uint32_t timeout;
     size_t threshold;       /* the number of bytes to trigger event loop, zero if don't care */
     size_t nbytes;          /* the number of bytes scheduled to be sent */
@@ -88,8 +138,19 @@ struct bucket_st
     char *key_prefix;
     VALUE key_prefix_val;
     char *node_list;
-    VALUE object_space;
+    struct object_space_st object_space;
+    struct arena_st arena;
+    struct context_pool_st contexts;
     VALUE self;             /* the pointer to bucket representation in ruby land */
+    int nogvl;              /* non-zero while event loop runs without GVL */
+    VALUE loop_thread;      /* the thread running the event loop or nil */
+    int wakeup_fds[2];      /* the pipe to interrupt the event loop from other thread */
+    void *wakeup_event;     /* the event watching the read end of +wakeup_fds+ */
+    int callback_state;     /* the tag of the error raised in callback, zero if none */
+    VALUE callback_error;   /* the object raised in callback while GVL was released */
+    int thread_safe;        /* the connection might be shared between threads */
+    int running;            /* non-zero while some thread is running event loop */
+    struct waiter_st *waiters; /* the threads parked until event loop round ends */
 };
 
 struct http_request_st;
@@ -98,6 +159,18 @@ struct context_st
     struct bucket_st* bucket;
     int extended;
     VALUE proc;
+    int arity;           /* cached arity of +proc+, valid if +arity_known+ */
+    int arity_known;
+    VALUE batch;         /* results collected for :batch_callback or nil */
+    VALUE keys;          /* the keys without prefix (String if single) or nil */
+    size_t key_next;     /* the index of the key expected in next response */
+    size_t key_index;    /* the index of the key of current response */
+    size_t *key_slots;   /* open addressing index of +keys+ (see cb_context_key) */
+    size_t key_nslots;
+    char *key_taken;     /* the keys for which the response was received */
+    VALUE window;        /* the rest of the split command or nil (see cb_context_window_next) */
+    size_t window_pos;   /* the index of the first key of the next window */
+    size_t window_size;  /* the number of keys in the last scheduled window */
     void *rv;
     VALUE exception;
     VALUE observe_options;
@@ -107,8 +180,34 @@ struct context_st
     int headers_built;
     struct http_request_st *request;
     int quiet;
+    int error_codes;
     int arith;           /* incr: +1, decr: -1, other: 0 */
+    int async;           /* the operation was scheduled in asynchronous mode */
+    int lazy;            /* wrap values into LazyValue instead of decoding */
     size_t nqueries;
+    size_t index;        /* the position in the context pool of the bucket */
+    size_t generation;   /* incremented each time the context is released */
+};
+
+#define VIEW_SECTION_NONE       0
+#define VIEW_SECTION_ROWS       1
+#define VIEW_SECTION_ERRORS     2
+#define VIEW_SECTION_TOTAL_ROWS 3
+
+/* The state of the splitter of view response into rows (see view_rows.c) */
+struct view_rows_st
+{
+    int depth;              /* the nesting level of JSON containers */
+    int in_string;
+    int escape;             /* the chunk has ended with backslash in the string */
+    int expect_key;         /* the next string on the top level is the key */
+    int reading_key;
+    int section;            /* VIEW_SECTION_* for the current top-level key */
+    int in_array;           /* inside the Array of rows or errors */
+    int capturing;          /* the row or total_rows is being collected */
+    char key[16];           /* the top-level key being read */
+    size_t nkey;
+    VALUE buf;              /* the part of the row received in previous chunks */
 };
 
 struct http_request_st {
@@ -120,8 +219,11 @@ struct http_request_st {
     int completed;
     lcb_http_request_t request;
     lcb_http_cmd_t cmd;
-    struct context_st *ctx;
+    const void *cookie;     /* resolves the context while it is alive (see context.c) */
+    VALUE rv;               /* the result of synchronous request */
     VALUE on_body_callback;
+    struct view_rows_st *rows;  /* non-NULL if the body is split into rows */
+    int paused;             /* the event loop has been stopped for the consumer */
 };
 
 struct timer_st
@@ -134,27 +236,82 @@ struct timer_st
     VALUE callback;
 };
 
+struct connection_pool_st
+{
+    size_t size;
+    VALUE *connections;
+    size_t nfree;
+    size_t *free;           /* the stack of indexes of available connections */
+    VALUE waiters;          /* the threads waiting for connection */
+};
+
+#define RESULT_CAS       0x01
+#define RESULT_FLAGS     0x02
+#define RESULT_COMPLETED 0x04
+#define RESULT_OBSERVE   0x08    /* from_master, ttp and ttr are set */
+#define RESULT_STATUS    0x10    /* rc and errmsg are set, error is built on demand */
+
+struct result_st
+{
+    VALUE operation;
+    VALUE error;
+    VALUE key;
+    VALUE value;
+    VALUE node;
+    VALUE headers;
+    VALUE status;
+    lcb_cas_t cas;
+    uint32_t flags;
+    lcb_time_t ttp;
+    lcb_time_t ttr;
+    int fields;             /* RESULT_* bits for the scalars which are set */
+    int completed;
+    int from_master;
+    lcb_error_t rc;
+    const char *errmsg;
+};
+
+struct lazy_value_st
+{
+    VALUE key;
+    VALUE raw;              /* the bytes as they were received */
+    uint32_t flags;
+    VALUE force_format;
+    VALUE value;            /* memoized result of decoding */
+    int decoded;
+    int encoding;
+};
+
 /* Classes */
 extern VALUE cBucket;
+extern VALUE cConnectionPool;
+extern VALUE cLazyValue;
 extern VALUE cCouchRequest;
 extern VALUE cResult;
 extern VALUE cTimer;
+extern VALUE cViewRowsParser;
 
 /* Modules */
 extern VALUE mCouchbase;
 extern VALUE mError;
 extern VALUE mMarshal;
 extern VALUE mMultiJson;
+extern VALUE cb_json_backend;
 extern VALUE mURI;
 
 /* Symbols */
 extern ID sym_add;
+extern ID sym_algo;
 extern ID sym_append;
 extern ID sym_assemble_hash;
+extern ID sym_batch_callback;
+extern ID sym_binary;
 extern ID sym_body;
 extern ID sym_bucket;
 extern ID sym_cas;
 extern ID sym_chunked;
+extern ID sym_codes;
+extern ID sym_compression;
 extern ID sym_content_type;
 extern ID sym_create;
 extern ID sym_decrement;
@@ -166,8 +323,13 @@ extern ID sym_delete;
 extern ID sym_delta;
 extern ID sym_development;
 extern ID sym_document;
+extern ID sym_encoded;
+extern ID sym_encoding;
 extern ID sym_environment;
+extern ID sym_errors;
+extern ID sym_exceptions;
 extern ID sym_extended;
+extern ID sym_external;
 extern ID sym_flags;
 extern ID sym_format;
 extern ID sym_found;
@@ -177,10 +339,15 @@ extern ID sym_http_request;
 extern ID sym_increment;
 extern ID sym_initial;
 extern ID sym_key_prefix;
+extern ID sym_lazy;
 extern ID sym_lock;
+extern ID sym_lz4;
 extern ID sym_management;
 extern ID sym_marshal;
 extern ID sym_method;
+extern ID sym_min_size;
+extern ID sym_multi_json;
+extern ID sym_native;
 extern ID sym_node_list;
 extern ID sym_not_found;
 extern ID sym_num_replicas;
@@ -198,17 +365,22 @@ extern ID sym_put;
 extern ID sym_quiet;
 extern ID sym_replace;
 extern ID sym_replica;
+extern ID sym_rows;
 extern ID sym_send_threshold;
 extern ID sym_set;
 extern ID sym_stats;
+extern ID sym_thread_safe;
 extern ID sym_timeout;
+extern ID sym_total_rows;
 extern ID sym_touch;
 extern ID sym_ttl;
 extern ID sym_type;
 extern ID sym_unlock;
 extern ID sym_username;
+extern ID sym_utf8;
 extern ID sym_version;
 extern ID sym_view;
+extern ID sym_zstd;
 extern ID id_arity;
 extern ID id_call;
 extern ID id_delete;
@@ -230,6 +402,7 @@ extern ID id_iv_status;
 extern ID id_iv_time_to_persist;
 extern ID id_iv_time_to_replicate;
 extern ID id_iv_value;
+extern ID id_keys;
 extern ID id_load;
 extern ID id_match;
 extern ID id_observe_and_wait;
@@ -273,20 +446,55 @@ extern VALUE eBucketNotFoundError;     /* LCB_BUCKET_ENOENT = 0x18   */
 extern VALUE eClientNoMemoryError;     /* LCB_CLIENT_ENOMEM = 0x19   */
 extern VALUE eClientTmpFailError;      /* LCB_CLIENT_ETMPFAIL = 0x20 */
 
-void strip_key_prefix(struct bucket_st *bucket, VALUE key);
 VALUE cb_check_error(lcb_error_t rc, const char *msg, VALUE key);
 VALUE cb_check_error_with_status(lcb_error_t rc, const char *msg, VALUE key, lcb_http_status_t status);
+int cb_error_key_status_p(lcb_error_t rc);
+VALUE cb_error_code_get(lcb_error_t rc);
+int cb_errors_parse(VALUE arg);
 VALUE cb_gc_protect(struct bucket_st *bucket, VALUE val);
 VALUE cb_gc_unprotect(struct bucket_st *bucket, VALUE val);
+void cb_gc_mark_protected(struct bucket_st *bucket);
+struct context_st *cb_context_alloc(struct bucket_st *bucket);
+void cb_context_free(struct context_st *ctx);
+void cb_context_pool_destroy(struct bucket_st *bucket);
+const void *cb_context_cookie(struct context_st *ctx);
+struct context_st *cb_context_resolve(struct bucket_st *bucket, const void *cookie);
+void cb_context_yield(struct context_st *ctx, VALUE res);
+void cb_context_finish(struct context_st *ctx);
+VALUE cb_context_check_error(struct context_st *ctx, lcb_error_t rc, const char *msg, VALUE key);
+VALUE cb_context_key(struct context_st *ctx, const char *key, size_t nkey);
+void cb_context_window_next(struct context_st *ctx);
+int cb_proc_arity(VALUE recv);
+VALUE cb_proc_call_argv(VALUE recv, int arity, int argc, VALUE *argv);
 VALUE cb_proc_call(VALUE recv, int argc, ...);
 int cb_first_value_i(VALUE key, VALUE value, VALUE arg);
 void cb_build_headers(struct context_st *ctx, const char * const *headers);
 void maybe_do_loop(struct bucket_st *bucket);
+void cb_wait(struct bucket_st *bucket, struct context_st *ctx);
+void cb_wait_idle(struct bucket_st *bucket);
+void cb_invoke_callback(lcb_t handle, VALUE (*func)(VALUE), VALUE arg);
 VALUE unify_key(struct bucket_st *bucket, VALUE key, int apply_prefix);
 VALUE encode_value(VALUE val, uint32_t flags);
-VALUE decode_value(VALUE blob, uint32_t flags, VALUE force_format);
+VALUE decode_value(VALUE blob, uint32_t flags, VALUE force_format, int encoding);
+VALUE decode_bytes(const char *bytes, size_t nbytes, uint32_t flags, VALUE force_format, int encoding);
+VALUE cb_str_new(int encoding, const char *ptr, size_t len);
+VALUE cb_str_associate(VALUE str, int encoding);
+int cb_encoding_parse(VALUE arg);
+VALUE cb_encoding_get(int encoding);
+VALUE cb_json_encode(VALUE val);
+VALUE cb_json_decode(const char *ptr, size_t len);
+struct view_rows_st *cb_view_rows_alloc(void);
+void cb_view_rows_free(struct view_rows_st *rows);
+VALUE cb_view_rows_feed(struct view_rows_st *rows, const char *ptr, size_t len);
+VALUE cb_view_rows_parser_alloc(VALUE klass);
+VALUE cb_view_rows_parser_feed(VALUE self, VALUE chunk);
 uint32_t flags_set_format(uint32_t flags, ID format);
 ID flags_get_format(uint32_t flags);
+void cb_compression_parse(VALUE arg, uint32_t *algo, size_t *min_size);
+VALUE cb_compression_get(uint32_t algo, size_t min_size);
+VALUE cb_compress_value(VALUE blob, uint32_t algo, size_t min_size);
+int cb_compressed_p(const char *bytes, size_t nbytes);
+VALUE cb_decompress_value(const char *bytes, size_t nbytes);
 
 void storage_callback(lcb_t handle, const void *cookie, lcb_storage_t operation, lcb_error_t error, const lcb_store_resp_t *resp);
 void get_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_get_resp_t *resp);
@@ -321,6 +529,8 @@ VALUE cb_bucket_decr(int argc, VALUE *argv, VALUE self);
 VALUE cb_bucket_unlock(int argc, VALUE *argv, VALUE self);
 VALUE cb_bucket_run(int argc, VALUE *argv, VALUE self);
 VALUE cb_bucket_stop(VALUE self);
+VALUE cb_bucket_async_schedule(VALUE self);
+VALUE cb_bucket_async_wait(VALUE self);
 VALUE cb_bucket_version(int argc, VALUE *argv, VALUE self);
 VALUE cb_bucket_disconnect(VALUE self);
 VALUE cb_bucket_reconnect(int argc, VALUE *argv, VALUE self);
@@ -328,6 +538,7 @@ VALUE cb_bucket_make_http_request(int argc, VALUE *argv, VALUE self);
 VALUE cb_bucket_observe(int argc, VALUE *argv, VALUE self);
 VALUE cb_bucket_connected_p(VALUE self);
 VALUE cb_bucket_async_p(VALUE self);
+VALUE cb_bucket_thread_safe_p(VALUE self);
 VALUE cb_bucket_quiet_get(VALUE self);
 VALUE cb_bucket_quiet_set(VALUE self, VALUE val);
 VALUE cb_bucket_default_flags_get(VALUE self);
@@ -352,6 +563,12 @@ VALUE cb_bucket_environment_get(VALUE self);
 VALUE cb_bucket_num_replicas_get(VALUE self);
 VALUE cb_bucket_default_observe_timeout_get(VALUE self);
 VALUE cb_bucket_default_observe_timeout_set(VALUE self, VALUE val);
+VALUE cb_bucket_compression_get(VALUE self);
+VALUE cb_bucket_compression_set(VALUE self, VALUE val);
+VALUE cb_bucket_errors_get(VALUE self);
+VALUE cb_bucket_errors_set(VALUE self, VALUE val);
+VALUE cb_bucket_encoding_get(VALUE self);
+VALUE cb_bucket_encoding_set(VALUE self, VALUE val);
 
 VALUE cb_http_request_alloc(VALUE klass);
 VALUE cb_http_request_init(int argc, VALUE *argv, VALUE self);
@@ -364,8 +581,46 @@ VALUE cb_http_request_path_get(VALUE self);
 VALUE cb_http_request_extended_get(VALUE self);
 VALUE cb_http_request_chunked_get(VALUE self);
 
+VALUE cb_result_alloc(VALUE klass);
+VALUE cb_result_new(VALUE operation, VALUE key, VALUE error);
+VALUE cb_result_init_copy(VALUE copy, VALUE orig);
+void cb_result_set_status(VALUE res, lcb_error_t rc, const char *msg);
+VALUE cb_result_error_code(VALUE self);
 VALUE cb_result_success_p(VALUE self);
 VALUE cb_result_inspect(VALUE self);
+VALUE cb_result_operation_get(VALUE self);
+VALUE cb_result_error_get(VALUE self);
+VALUE cb_result_key_get(VALUE self);
+VALUE cb_result_value_get(VALUE self);
+VALUE cb_result_node_get(VALUE self);
+VALUE cb_result_headers_get(VALUE self);
+VALUE cb_result_status_get(VALUE self);
+VALUE cb_result_cas_get(VALUE self);
+VALUE cb_result_flags_get(VALUE self);
+VALUE cb_result_completed_get(VALUE self);
+VALUE cb_result_from_master_get(VALUE self);
+VALUE cb_result_time_to_persist_get(VALUE self);
+VALUE cb_result_time_to_replicate_get(VALUE self);
+
+VALUE cb_connection_pool_alloc(VALUE klass);
+VALUE cb_connection_pool_init(int argc, VALUE *argv, VALUE self);
+VALUE cb_connection_pool_inspect(VALUE self);
+VALUE cb_connection_pool_checkout(VALUE self);
+VALUE cb_connection_pool_checkin(VALUE self, VALUE connection);
+VALUE cb_connection_pool_with(VALUE self);
+VALUE cb_connection_pool_size(VALUE self);
+VALUE cb_connection_pool_available(VALUE self);
+
+VALUE cb_json_backend_get(VALUE self);
+VALUE cb_json_backend_set(VALUE self, VALUE backend);
+
+VALUE cb_lazy_value_alloc(VALUE klass);
+VALUE cb_lazy_value_new(VALUE key, const char *bytes, size_t nbytes, uint32_t flags, VALUE force_format, int encoding);
+VALUE cb_lazy_value_value(VALUE self);
+VALUE cb_lazy_value_raw(VALUE self);
+VALUE cb_lazy_value_flags(VALUE self);
+VALUE cb_lazy_value_decoded_p(VALUE self);
+VALUE cb_lazy_value_inspect(VALUE self);
 
 VALUE cb_timer_alloc(VALUE klass);
 VALUE cb_timer_inspect(VALUE self);
@@ -426,6 +681,10 @@ struct params_st
             lcb_cas_t cas;
             lcb_datatype_t datatype;
             VALUE observe;
+            uint32_t compression;
+            size_t compression_min_size;
+            /* the values are Strings encoded in the format already */
+            int encoded;
         } store;
         struct {
             /* number of items */
@@ -446,9 +705,9 @@ struct params_st
             unsigned int quiet : 1;
             /* arguments given in form of hash key-ttl to "get and touch" */
             unsigned int gat : 1;
+            unsigned int lazy : 1;
             lcb_time_t ttl;
             VALUE forced_format;
-            VALUE keys_ary;
         } get;
         struct {
             /* number of items */
@@ -509,10 +768,46 @@ struct params_st
     size_t idx;
     /* the approximate size of the data to be sent */
     size_t npayload;
+    /* the memory for items and pointers arrays */
+    void *block;
+    /* 1 if the block belongs to the arena of the bucket */
+    int from_arena;
+    /* 1 if the results should be yielded to the block at once */
+    int batch;
+    /* 1 if the errors should be reported as status codes */
+    int error_codes;
+    /* the keys as they were passed to the operation, converted to String.
+     * The command with the single key keeps the String itself */
+    VALUE keys;
+    /* the rest of the command when it is too big to be scheduled at once */
+    VALUE window;
+    /* the index of the first key of the next window */
+    size_t window_pos;
+    /* the number of keys in all windows */
+    size_t total;
 };
 
 void cb_params_destroy(struct params_st *params);
 void cb_params_build(struct params_st *params, int argc, VALUE argv);
+void cb_params_build_window(struct params_st *params, struct bucket_st *bucket, VALUE window, size_t *pos);
+size_t cb_params_window_total(VALUE window);
+
+/* The state of the function, which fills the context and schedules the
+ * command (see cb_context_schedule) */
+struct schedule_st
+{
+    struct bucket_st *bucket;
+    struct params_st *params;   /* NULL if the command doesn't have them */
+    struct context_st *ctx;
+    VALUE proc;
+    void *rv;
+    void *data;             /* the operation specific state */
+    lcb_error_t (*func)(struct schedule_st *sched);
+    lcb_error_t err;
+};
+
+struct context_st *cb_context_schedule(struct schedule_st *sched,
+        lcb_error_t (*func)(struct schedule_st *sched), const char *msg, VALUE key);
 
 
 #endif
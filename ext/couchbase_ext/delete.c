@@ -22,14 +22,14 @@ delete_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_r
 {
     struct context_st *ctx = (struct context_st *)cookie;
     struct bucket_st *bucket = ctx->bucket;
+    const char *msg = "failed to remove value";
     VALUE key, *rv = ctx->rv, exc = Qnil, res;
 
     ctx->nqueries--;
-    key = STR_NEW((const char*)resp->v.v0.key, resp->v.v0.nkey);
-    strip_key_prefix(bucket, key);
+    key = cb_context_key(ctx, (const char*)resp->v.v0.key, resp->v.v0.nkey);
 
     if (error != LCB_KEY_ENOENT || !ctx->quiet) {
-        exc = cb_check_error(error, "failed to remove value", key);
+        exc = cb_context_check_error(ctx, error, msg, key);
         if (exc != Qnil) {
             rb_ivar_set(exc, id_iv_operation, sym_delete);
             if (NIL_P(ctx->exception)) {
@@ -37,23 +37,37 @@ delete_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_r
             }
         }
     }
-    if (bucket->async) {    /* asynchronous */
+    if (ctx->async) {    /* asynchronous */
         if (ctx->proc != Qnil) {
-            res = rb_class_new_instance(0, NULL, cResult);
-            rb_ivar_set(res, id_iv_error, exc);
-            rb_ivar_set(res, id_iv_operation, sym_delete);
-            rb_ivar_set(res, id_iv_key, key);
-            cb_proc_call(ctx->proc, 1, res);
+            res = cb_result_new(sym_delete, key, exc);
+            if (ctx->error_codes) {
+                cb_result_set_status(res, error, msg);
+            }
+            cb_context_yield(ctx, res);
         }
     } else {                /* synchronous */
         rb_hash_aset(*rv, key, (error == LCB_SUCCESS) ? Qtrue : Qfalse);
     }
+    cb_context_window_next(ctx);
     if (ctx->nqueries == 0) {
-        cb_gc_unprotect(bucket, ctx->proc);
+        cb_context_finish(ctx);
     }
     (void)handle;
 }
 
+/* Fill the context and schedule the command (see cb_context_schedule()) */
+    static lcb_error_t
+do_schedule(struct schedule_st *sched)
+{
+    struct params_st *params = sched->params;
+    struct context_st *ctx = sched->ctx;
+
+    ctx->quiet = params->cmd.remove.quiet;
+    ctx->nqueries = params->cmd.remove.num;
+    return lcb_remove(params->bucket->handle, cb_context_cookie(ctx),
+            params->cmd.remove.num, params->cmd.remove.ptr);
+}
+
 /*
  * Delete the specified key
  *
@@ -66,6 +80,11 @@ delete_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_r
  *     operation won't raise error for missing key, it will return +nil+.
  *     Otherwise it will raise error in synchronous mode. In asynchronous
  *     mode this option ignored.
+ *   @option options [true, false] :batch_callback (false) Yield the Array
+ *     of results once, when all keys have been deleted (see {Bucket#get}).
+ *   @option options [Symbol] :errors (self.errors) Report the errors as
+ *     status codes ({Result#error_code}) instead of exceptions. See
+ *     {Bucket#initialize}.
  *   @option options [Fixnum] :cas The CAS value for an object. This value
  *     created on the server and is guaranteed to be unique for each value of
  *     a given key. This value is used to provide simple optimistic
@@ -103,8 +122,8 @@ cb_bucket_delete(int argc, VALUE *argv, VALUE self)
     struct context_st *ctx;
     VALUE rv, exc;
     VALUE args, proc;
-    lcb_error_t err;
     struct params_st params;
+    struct schedule_st sched;
 
     if (bucket->handle == NULL) {
         rb_raise(eConnectError, "closed connection");
@@ -117,38 +136,26 @@ cb_bucket_delete(int argc, VALUE *argv, VALUE self)
     memset(&params, 0, sizeof(struct params_st));
     params.type = cmd_remove;
     params.bucket = bucket;
-    cb_params_build(&params, RARRAY_LEN(args), args);
-
-    ctx = xcalloc(1, sizeof(struct context_st));
-    if (ctx == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for context");
-    }
-    ctx->quiet = params.cmd.remove.quiet;
-    ctx->proc = cb_gc_protect(bucket, proc);
     rv = rb_hash_new();
-    ctx->rv = &rv;
-    ctx->bucket = bucket;
-    ctx->exception = Qnil;
-    ctx->nqueries = params.cmd.remove.num;
-    err = lcb_remove(bucket->handle, (const void *)ctx,
-            params.cmd.remove.num, params.cmd.remove.ptr);
-    cb_params_destroy(&params);
-    exc = cb_check_error(err, "failed to schedule delete request", Qnil);
-    if (exc != Qnil) {
-        xfree(ctx);
-        rb_exc_raise(exc);
-    }
+    cb_params_build(&params, RARRAY_LEN(args), args);
+    sched.bucket = bucket;
+    sched.params = &params;
+    sched.proc = proc;
+    sched.rv = &rv;
+    ctx = cb_context_schedule(&sched, do_schedule, "failed to schedule delete request", Qnil);
     bucket->nbytes += params.npayload;
+    ctx->window_size = ctx->nqueries;
+    cb_context_window_next(ctx);
     if (bucket->async) {
         maybe_do_loop(bucket);
         return Qnil;
     } else {
         if (ctx->nqueries > 0) {
             /* we have some operations pending */
-            lcb_wait(bucket->handle);
+            cb_wait(bucket, ctx);
         }
         exc = ctx->exception;
-        xfree(ctx);
+        cb_context_free(ctx);
         if (exc != Qnil) {
             rb_exc_raise(cb_gc_unprotect(bucket, exc));
         }
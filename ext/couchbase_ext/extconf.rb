@@ -127,6 +127,18 @@ have_header("sys/time.h")
 have_func("clock_gettime")
 have_func("gettimeofday")
 have_func("QueryPerformanceCounter")
+# ruby 2.0+ allows to run the event loop without holding GVL
+have_header("ruby/thread.h")
+have_func("rb_thread_call_without_gvl", "ruby/thread.h")
+have_func("rb_thread_call_with_gvl", "ruby/thread.h")
+have_func("pipe", "unistd.h")
+# optional compression libraries for the values
+if have_header("lz4.h") && have_library("lz4", "LZ4_compress_default", "lz4.h")
+  define("HAVE_LZ4")
+end
+if have_header("zstd.h") && have_library("zstd", "ZSTD_compress", "zstd.h")
+  define("HAVE_ZSTD")
+end
 define("_GNU_SOURCE")
 create_header("couchbase_config.h")
 create_makefile("couchbase_ext")
@@ -17,19 +17,30 @@
 
 #include "couchbase_ext.h"
 
+/* The results of synchronous get, stored by the position of the key in
+ * the request. The Array or Hash for the application is built once all
+ * responses have been received */
+struct get_results_st
+{
+    VALUE values;   /* the values or [value, flags, cas] tuples */
+    VALUE found;    /* String with non-zero byte for each received value */
+};
+
     void
 get_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_get_resp_t *resp)
 {
     struct context_st *ctx = (struct context_st *)cookie;
     struct bucket_st *bucket = ctx->bucket;
-    VALUE key, val, flags, cas, *rv = ctx->rv, exc = Qnil, res;
+    const char *msg = "failed to get value";
+    VALUE key, val, exc = Qnil, res;
+    struct get_results_st *results;
+    struct result_st *r;
 
     ctx->nqueries--;
-    key = STR_NEW((const char*)resp->v.v0.key, resp->v.v0.nkey);
-    strip_key_prefix(bucket, key);
+    key = cb_context_key(ctx, (const char*)resp->v.v0.key, resp->v.v0.nkey);
 
     if (error != LCB_KEY_ENOENT || !ctx->quiet) {
-        exc = cb_check_error(error, "failed to get value", key);
+        exc = cb_context_check_error(ctx, error, msg, key);
         if (exc != Qnil) {
             rb_ivar_set(exc, id_iv_operation, sym_get);
             if (NIL_P(ctx->exception)) {
@@ -38,12 +49,16 @@ get_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_get_
         }
     }
 
-    flags = ULONG2NUM(resp->v.v0.flags);
-    cas = ULL2NUM(resp->v.v0.cas);
     val = Qnil;
-    if (resp->v.v0.nbytes != 0) {
-        val = decode_value(STR_NEW((const char*)resp->v.v0.bytes, resp->v.v0.nbytes),
-                resp->v.v0.flags, ctx->force_format);
+    if (ctx->lazy) {
+        if (error == LCB_SUCCESS) {
+            val = cb_lazy_value_new(key, (const char*)resp->v.v0.bytes,
+                    resp->v.v0.nbytes, resp->v.v0.flags, ctx->force_format,
+                    bucket->encoding);
+        }
+    } else if (resp->v.v0.nbytes != 0) {
+        val = decode_bytes((const char*)resp->v.v0.bytes, resp->v.v0.nbytes,
+                resp->v.v0.flags, ctx->force_format, bucket->encoding);
         if (val == Qundef) {
             if (ctx->exception != Qnil) {
                 cb_gc_unprotect(bucket, ctx->exception);
@@ -56,38 +71,82 @@ get_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_get_
     } else if (flags_get_format(resp->v.v0.flags) == sym_plain) {
         val = STR_NEW_CSTR("");
     }
-    if (bucket->async) { /* asynchronous */
+    if (ctx->async) { /* asynchronous */
         if (ctx->proc != Qnil) {
-            res = rb_class_new_instance(0, NULL, cResult);
-            rb_ivar_set(res, id_iv_error, exc);
-            rb_ivar_set(res, id_iv_operation, sym_get);
-            rb_ivar_set(res, id_iv_key, key);
-            rb_ivar_set(res, id_iv_value, val);
-            rb_ivar_set(res, id_iv_flags, flags);
-            rb_ivar_set(res, id_iv_cas, cas);
-            cb_proc_call(ctx->proc, 1, res);
+            res = cb_result_new(sym_get, key, exc);
+            if (ctx->error_codes) {
+                cb_result_set_status(res, error, msg);
+            }
+            r = DATA_PTR(res);
+            r->value = val;
+            r->flags = resp->v.v0.flags;
+            r->cas = resp->v.v0.cas;
+            r->fields |= RESULT_FLAGS | RESULT_CAS;
+            cb_context_yield(ctx, res);
         }
     } else {                /* synchronous */
-        if (NIL_P(exc) && error != LCB_KEY_ENOENT) {
+        if (error == LCB_SUCCESS && ctx->key_index != KEY_INDEX_NONE) {
+            results = ctx->rv;
             if (ctx->extended) {
-                rb_hash_aset(*rv, key, rb_ary_new3(3, val, flags, cas));
-            } else {
-                rb_hash_aset(*rv, key, val);
+                val = rb_ary_new3(3, val, ULONG2NUM(resp->v.v0.flags),
+                        ULL2NUM(resp->v.v0.cas));
             }
+            rb_ary_store(results->values, ctx->key_index, val);
+            RSTRING_PTR(results->found)[ctx->key_index] = 1;
         }
     }
 
+    cb_context_window_next(ctx);
     if (ctx->nqueries == 0) {
-        cb_gc_unprotect(bucket, ctx->proc);
+        cb_context_finish(ctx);
     }
     (void)handle;
 }
 
+/* Fill the context and schedule the command (see cb_context_schedule()) */
+    static lcb_error_t
+do_schedule(struct schedule_st *sched)
+{
+    struct params_st *params = sched->params;
+    struct bucket_st *bucket = params->bucket;
+    struct get_results_st *results = sched->data;
+    struct context_st *ctx = sched->ctx;
+    size_t nkeys;
+
+    ctx->extended = params->cmd.get.extended;
+    ctx->quiet = params->cmd.get.quiet;
+    ctx->force_format = params->cmd.get.forced_format;
+    ctx->lazy = params->cmd.get.lazy;
+    nkeys = NIL_P(params->window) ? params->cmd.get.num : params->total;
+    if (!bucket->async) {
+        results->values = rb_ary_new2(nkeys);
+        if (nkeys > 0) {
+            rb_ary_store(results->values, nkeys - 1, Qnil);
+        }
+        results->found = rb_str_new(NULL, nkeys);
+        memset(RSTRING_PTR(results->found), 0, nkeys);
+        ctx->rv = results;
+    }
+    ctx->nqueries = params->cmd.get.num;
+    if (params->cmd.get.replica) {
+        return lcb_get_replica(bucket->handle, cb_context_cookie(ctx),
+                params->cmd.get.num, params->cmd.get.ptr_gr);
+    } else {
+        return lcb_get(bucket->handle, cb_context_cookie(ctx),
+                params->cmd.get.num, params->cmd.get.ptr);
+    }
+}
+
 /*
  * Obtain an object stored in Couchbase by given key.
  *
  * @since 1.0.0
  *
+ * The requests for many keys (more than 4096) are sent in windows: the
+ * next window is scheduled when the responses for the previous one have
+ * been received. The same applies to {Bucket#set}, {Bucket#delete} and
+ * {Bucket#touch}, which also limit the size of the values in flight.
+ *
  * @see http://couchbase.com/docs/couchbase-manual-2.0/couchbase-architecture-apis-memcached-protocol-additions.html#couchbase-architecture-apis-memcached-protocol-additions-getl
  *
  * @overload get(*keys, options = {})
@@ -120,6 +179,16 @@ get_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_get_
  *     or in case of "get and touch" multimple keys.
  *   @option options [true, false] :replica (false) Read key from replica
  *     node. Options +:ttl+ and +:lock+ are not compatible with +:replica+.
+ *   @option options [true, false] :lazy (false) Return {LazyValue}
+ *     wrappers instead of values. The value is decoded when
+ *     {LazyValue#value} is called for the first time, therefore the
+ *     decoding errors are raised there.
+ *   @option options [true, false] :batch_callback (false) In asynchronous
+ *     mode collect the results for all keys and yield them to the block
+ *     once, as an Array of {Result}, when the last response arrives.
+ *   @option options [Symbol] :errors (self.errors) Report the errors as
+ *     status codes ({Result#error_code}) instead of exceptions. See
+ *     {Bucket#initialize}.
  *
  *   @yieldparam ret [Result] the result of operation in asynchronous mode
  *     (valid attributes: +error+, +operation+, +key+, +value+, +flags+,
@@ -174,6 +243,17 @@ get_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_get_
  *       end
  *     end
  *
+ *   @example Asynchronous get with single callback for all keys
+ *     c.run do
+ *       c.get("foo", "bar", "baz", :batch_callback => true) do |results|
+ *         results.map(&:key)    #=> ["foo", "bar", "baz"] in any order
+ *       end
+ *     end
+ *
+ *   @example Decode only values which are actually used
+ *     docs = c.get(keys, :lazy => true, :assemble_hash => true)
+ *     docs["foo"].value       #=> decoded on first access
+ *
  *   @example Get and lock key using default timeout
  *     c.get("foo", :lock => true)
  *
@@ -216,9 +296,11 @@ cb_bucket_get(int argc, VALUE *argv, VALUE self)
 {
     struct bucket_st *bucket = DATA_PTR(self);
     struct context_st *ctx;
-    VALUE args, rv, proc, exc;
-    size_t ii;
-    lcb_error_t err = LCB_SUCCESS;
+    VALUE args, rv, proc, exc, *keys, *values;
+    struct get_results_st results;
+    struct schedule_st sched;
+    const char *found;
+    size_t ii, nkeys;
     struct params_st params;
 
     if (bucket->handle == NULL) {
@@ -231,46 +313,26 @@ cb_bucket_get(int argc, VALUE *argv, VALUE self)
     memset(&params, 0, sizeof(struct params_st));
     params.type = cmd_get;
     params.bucket = bucket;
-    params.cmd.get.keys_ary = cb_gc_protect(bucket, rb_ary_new());
     cb_params_build(&params, RARRAY_LEN(args), args);
-    ctx = xcalloc(1, sizeof(struct context_st));
-    if (ctx == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for context");
-    }
-    ctx->extended = params.cmd.get.extended;
-    ctx->quiet = params.cmd.get.quiet;
-    ctx->force_format = params.cmd.get.forced_format;
-    ctx->proc = cb_gc_protect(bucket, proc);
-    ctx->bucket = bucket;
-    rv = rb_hash_new();
-    ctx->rv = &rv;
-    ctx->exception = Qnil;
-    ctx->nqueries = params.cmd.get.num;
-    if (params.cmd.get.replica) {
-        err = lcb_get_replica(bucket->handle, (const void *)ctx,
-                params.cmd.get.num, params.cmd.get.ptr_gr);
-    } else {
-        err = lcb_get(bucket->handle, (const void *)ctx,
-                params.cmd.get.num, params.cmd.get.ptr);
-    }
-    cb_params_destroy(&params);
-    cb_gc_unprotect(bucket, params.cmd.get.keys_ary);
-    exc = cb_check_error(err, "failed to schedule get request", Qnil);
-    if (exc != Qnil) {
-        xfree(ctx);
-        rb_exc_raise(exc);
-    }
+    sched.bucket = bucket;
+    sched.params = &params;
+    sched.proc = proc;
+    sched.rv = NULL;
+    sched.data = &results;
+    ctx = cb_context_schedule(&sched, do_schedule, "failed to schedule get request", Qnil);
     bucket->nbytes += params.npayload;
+    ctx->window_size = ctx->nqueries;
+    cb_context_window_next(ctx);
     if (bucket->async) {
         maybe_do_loop(bucket);
         return Qnil;
     } else {
         if (ctx->nqueries > 0) {
             /* we have some operations pending */
-            lcb_wait(bucket->handle);
+            cb_wait(bucket, ctx);
         }
         exc = ctx->exception;
-        xfree(ctx);
+        cb_context_free(ctx);
         if (exc != Qnil) {
             cb_gc_unprotect(bucket, exc);
             rb_exc_raise(exc);
@@ -278,22 +340,30 @@ cb_bucket_get(int argc, VALUE *argv, VALUE self)
         if (bucket->exception != Qnil) {
             rb_exc_raise(bucket->exception);
         }
+        values = RARRAY_PTR(results.values);
         if (params.cmd.get.gat || params.cmd.get.assemble_hash ||
                 (params.cmd.get.extended && (params.cmd.get.num > 1 || params.cmd.get.array))) {
+            /* the keys of all windows have been appended to the first ones */
+            if (TYPE(params.keys) == T_STRING) {
+                keys = &params.keys;
+                nkeys = 1;
+            } else {
+                keys = RARRAY_PTR(params.keys);
+                nkeys = RARRAY_LEN(params.keys);
+            }
+            found = RSTRING_PTR(results.found);
+            rv = rb_hash_new();
+            for (ii = 0; ii < nkeys; ++ii) {
+                if (found[ii]) {
+                    rb_hash_aset(rv, keys[ii], values[ii]);
+                }
+            }
             return rv;  /* return as a hash {key => [value, flags, cas], ...} */
         }
         if (params.cmd.get.num > 1 || params.cmd.get.array) {
-            VALUE *keys_ptr, ret;
-            ret = rb_ary_new();
-            keys_ptr = RARRAY_PTR(params.cmd.get.keys_ary);
-            for (ii = 0; ii < params.cmd.get.num; ++ii) {
-                rb_ary_push(ret, rb_hash_aref(rv, keys_ptr[ii]));
-            }
-            return ret;  /* return as an array [value1, value2, ...] */
+            return results.values;  /* return as an array [value1, value2, ...] */
         } else {
-            VALUE vv = Qnil;
-            rb_hash_foreach(rv, cb_first_value_i, (VALUE)&vv);
-            return vv;
+            return values[0];
         }
     }
 }
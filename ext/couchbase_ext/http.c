@@ -23,36 +23,42 @@ http_complete_callback(lcb_http_request_t request, lcb_t handle, const void *coo
     struct context_st *ctx = (struct context_st *)cookie;
     struct bucket_st *bucket = ctx->bucket;
     VALUE *rv = ctx->rv, key, val, res;
+    struct result_st *r;
 
     ctx->request->completed = 1;
+    ctx->nqueries--;
     key = STR_NEW((const char*)resp->v.v0.path, resp->v.v0.npath);
     ctx->exception = cb_check_error_with_status(error,
             "failed to execute HTTP request", key, resp->v.v0.status);
     if (ctx->exception != Qnil) {
         cb_gc_protect(bucket, ctx->exception);
     }
-    val = resp->v.v0.nbytes ? STR_NEW((const char*)resp->v.v0.bytes, resp->v.v0.nbytes) : Qnil;
+    if (ctx->request->rows) {
+        val = cb_view_rows_feed(ctx->request->rows, (const char*)resp->v.v0.bytes, resp->v.v0.nbytes);
+    } else {
+        val = resp->v.v0.nbytes ? cb_str_new(bucket->encoding, (const char*)resp->v.v0.bytes, resp->v.v0.nbytes) : Qnil;
+    }
     if (resp->v.v0.headers) {
         cb_build_headers(ctx, resp->v.v0.headers);
         cb_gc_unprotect(bucket, ctx->headers_val);
     }
     if (ctx->extended) {
-        res = rb_class_new_instance(0, NULL, cResult);
-        rb_ivar_set(res, id_iv_error, ctx->exception);
-        rb_ivar_set(res, id_iv_operation, sym_http_request);
-        rb_ivar_set(res, id_iv_key, key);
-        rb_ivar_set(res, id_iv_value, val);
-        rb_ivar_set(res, id_iv_completed, Qtrue);
-        rb_ivar_set(res, id_iv_headers, ctx->headers_val);
+        res = cb_result_new(sym_http_request, key, ctx->exception);
+        r = DATA_PTR(res);
+        r->value = val;
+        r->headers = ctx->headers_val;
+        r->completed = 1;
+        r->fields |= RESULT_COMPLETED;
     } else {
         res = val;
     }
     if (ctx->proc != Qnil) {
-        cb_proc_call(ctx->proc, 1, res);
+        cb_context_yield(ctx, res);
     }
-    if (!bucket->async && ctx->exception == Qnil) {
+    if (!ctx->async && ctx->exception == Qnil) {
         *rv = res;
     }
+    cb_context_finish(ctx);
     (void)handle;
     (void)request;
 }
@@ -63,11 +69,17 @@ http_data_callback(lcb_http_request_t request, lcb_t handle, const void *cookie,
     struct context_st *ctx = (struct context_st *)cookie;
     struct bucket_st *bucket = ctx->bucket;
     VALUE key, val, res;
+    struct result_st *r;
 
     key = STR_NEW((const char*)resp->v.v0.path, resp->v.v0.npath);
     ctx->exception = cb_check_error_with_status(error,
             "failed to execute HTTP request", key, resp->v.v0.status);
-    val = resp->v.v0.nbytes ? STR_NEW((const char*)resp->v.v0.bytes, resp->v.v0.nbytes) : Qnil;
+    if (ctx->request->rows) {
+        /* pass the rows completed by this chunk instead of the bytes */
+        val = cb_view_rows_feed(ctx->request->rows, (const char*)resp->v.v0.bytes, resp->v.v0.nbytes);
+    } else {
+        val = resp->v.v0.nbytes ? cb_str_new(bucket->encoding, (const char*)resp->v.v0.bytes, resp->v.v0.nbytes) : Qnil;
+    }
     if (ctx->exception != Qnil) {
         cb_gc_protect(bucket, ctx->exception);
         lcb_cancel_http_request(bucket->handle, request);
@@ -77,17 +89,16 @@ http_data_callback(lcb_http_request_t request, lcb_t handle, const void *cookie,
     }
     if (ctx->proc != Qnil) {
         if (ctx->extended) {
-            res = rb_class_new_instance(0, NULL, cResult);
-            rb_ivar_set(res, id_iv_error, ctx->exception);
-            rb_ivar_set(res, id_iv_operation, sym_http_request);
-            rb_ivar_set(res, id_iv_key, key);
-            rb_ivar_set(res, id_iv_value, val);
-            rb_ivar_set(res, id_iv_completed, Qfalse);
-            rb_ivar_set(res, id_iv_headers, ctx->headers_val);
+            res = cb_result_new(sym_http_request, key, ctx->exception);
+            r = DATA_PTR(res);
+            r->value = val;
+            r->headers = ctx->headers_val;
+            r->completed = 0;
+            r->fields |= RESULT_COMPLETED;
         } else {
             res = val;
         }
-        cb_proc_call(ctx->proc, 1, res);
+        cb_context_yield(ctx, res);
     }
     (void)handle;
 }
@@ -106,6 +117,9 @@ cb_http_request_free(void *ptr)
         xfree((char *)request->cmd.v.v0.content_type);
         xfree((char *)request->cmd.v.v0.path);
         xfree((char *)request->cmd.v.v0.body);
+        if (request->rows) {
+            cb_view_rows_free(request->rows);
+        }
         xfree(request);
     }
 }
@@ -116,6 +130,10 @@ cb_http_request_mark(void *ptr)
     struct http_request_st *request = ptr;
     if (request) {
         rb_gc_mark(request->on_body_callback);
+        rb_gc_mark(request->rv);
+        if (request->rows) {
+            rb_gc_mark(request->rows->buf);
+        }
     }
 }
 
@@ -193,6 +211,9 @@ cb_http_request_init(int argc, VALUE *argv, VALUE self)
         Check_Type(opts, T_HASH);
         request->extended = RTEST(rb_hash_aref(opts, sym_extended));
         request->cmd.v.v0.chunked = RTEST(rb_hash_aref(opts, sym_chunked));
+        if (RTEST(rb_hash_aref(opts, sym_rows))) {
+            request->rows = cb_view_rows_alloc();
+        }
         if ((arg = rb_hash_aref(opts, sym_type)) != Qnil) {
             if (arg == sym_view) {
                 request->type = LCB_HTTP_TYPE_VIEW;
@@ -246,6 +267,44 @@ cb_http_request_on_body(VALUE self)
     return old;
 }
 
+/* Fill the context and schedule the request (see cb_context_schedule()) */
+    static lcb_error_t
+do_schedule(struct schedule_st *sched)
+{
+    struct http_request_st *req = sched->data;
+    struct context_st *ctx = sched->ctx;
+
+    ctx->extended = req->extended;
+    ctx->request = req;
+    ctx->headers_val = cb_gc_protect(req->bucket, rb_hash_new());
+    ctx->nqueries = 1;
+    return lcb_make_http_request(req->bucket->handle, cb_context_cookie(ctx),
+            req->type, &req->cmd, &req->request);
+}
+
+/* Run the event loop for synchronous request until it completes or gets
+ * paused. Releases the context of completed request and returns its
+ * result */
+    static VALUE
+do_wait(struct http_request_st *req, struct context_st *ctx)
+{
+    VALUE exc, rv;
+
+    cb_wait(req->bucket, ctx);
+    if (!req->completed) {
+        return Qnil;
+    }
+    exc = ctx->exception;
+    rv = req->rv;
+    req->rv = Qnil;
+    cb_context_free(ctx);
+    if (exc != Qnil) {
+        cb_gc_unprotect(req->bucket, exc);
+        rb_exc_raise(exc);
+    }
+    return rv;
+}
+
 /*
  * Execute {Bucket::CouchRequest}
  *
@@ -256,55 +315,34 @@ cb_http_request_perform(VALUE self)
 {
     struct http_request_st *req = DATA_PTR(self);
     struct context_st *ctx;
-    VALUE rv, exc;
-    lcb_error_t err;
     struct bucket_st *bucket;
+    struct schedule_st sched;
 
-    ctx = xcalloc(1, sizeof(struct context_st));
-    if (ctx == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory");
-    }
-    rv = Qnil;
-    ctx->rv = &rv;
-    ctx->bucket = bucket = req->bucket;
-    ctx->proc = rb_block_given_p() ? rb_block_proc() : req->on_body_callback;
-    ctx->extended = req->extended;
-    ctx->request = req;
-    ctx->headers_val = cb_gc_protect(bucket, rb_hash_new());
-
-    err = lcb_make_http_request(bucket->handle, (const void *)ctx,
-            req->type, &req->cmd, &req->request);
-    exc = cb_check_error(err, "failed to schedule document request",
+    bucket = req->bucket;
+    /* the request might be paused, and the result is delivered after
+     * this frame is gone */
+    req->rv = Qnil;
+    memset(&sched, 0, sizeof(struct schedule_st));
+    sched.bucket = bucket;
+    sched.proc = rb_block_given_p() ? rb_block_proc() : req->on_body_callback;
+    sched.rv = &req->rv;
+    sched.data = req;
+    ctx = cb_context_schedule(&sched, do_schedule, "failed to schedule document request",
             STR_NEW(req->cmd.v.v0.path, req->cmd.v.v0.npath));
-    if (exc != Qnil) {
-        xfree(ctx);
-        rb_exc_raise(exc);
-    }
     req->running = 1;
-    req->ctx = ctx;
+    req->cookie = cb_context_cookie(ctx);
+    req->paused = 0;
     if (bucket->async) {
         return Qnil;
-    } else {
-        lcb_wait(bucket->handle);
-        if (req->completed) {
-            exc = ctx->exception;
-            xfree(ctx);
-            if (exc != Qnil) {
-                cb_gc_unprotect(bucket, exc);
-                rb_exc_raise(exc);
-            }
-            return rv;
-        } else {
-            return Qnil;
-        }
     }
-    return Qnil;
+    return do_wait(req, ctx);
 }
 
     VALUE
 cb_http_request_pause(VALUE self)
 {
     struct http_request_st *req = DATA_PTR(self);
+    req->paused = 1;
     req->bucket->io->stop_event_loop(req->bucket->io);
     return Qnil;
 }
@@ -312,21 +350,18 @@ cb_http_request_pause(VALUE self)
     VALUE
 cb_http_request_continue(VALUE self)
 {
-    VALUE exc, *rv;
     struct http_request_st *req = DATA_PTR(self);
+    struct context_st *ctx;
 
     if (req->running) {
-        lcb_wait(req->bucket->handle);
-        if (req->completed) {
-            exc = req->ctx->exception;
-            rv = req->ctx->rv;
-            xfree(req->ctx);
-            if (exc != Qnil) {
-                cb_gc_unprotect(req->bucket, exc);
-                rb_exc_raise(exc);
-            }
-            return *rv;
+        /* the context of asynchronous request is released as soon as it
+         * completes, and the cookie doesn't resolve anymore */
+        ctx = cb_context_resolve(req->bucket, req->cookie);
+        if (ctx == NULL) {
+            return Qnil;
         }
+        req->paused = 0;
+        return do_wait(req, ctx);
     } else {
         cb_http_request_perform(self);
     }
@@ -383,6 +418,12 @@ cb_http_request_extended_get(VALUE self)
  * @option options [Boolean] :extended (false) set it to +true+ if the
  *   {Couchbase::Result} object needed. The response chunk will be
  *   accessible through +#value+ attribute.
+ * @option options [Boolean] :rows (false) split the view response into
+ *   items. Each chunk will be the Array of the pairs +[kind, item]+ for
+ *   the items completed by the chunk, where +kind+ is +:rows+, +:errors+
+ *   or +:total_rows+. The item is decoded with built-in JSON codec, or
+ *   passed as String with raw JSON when +:multi_json+ backend is selected
+ *   (see {Couchbase.json_backend=}).
  * @yieldparam [String,Couchbase::Result] res the response chunk if the
  *   :extended option is +false+ and result object otherwise
  *
@@ -0,0 +1,733 @@
+/* vim: ft=c et ts=8 sts=4 sw=4 cino=
+ *
+ *   Copyright 2011, 2012 Couchbase, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "couchbase_ext.h"
+#include <math.h>
+
+/* Built-in codec for the :document format. It covers the core types
+ * (Hash, Array, String, Symbol, Integer, Float, true, false and nil).
+ * Both encoder and decoder return Qundef instead of raising exceptions,
+ * so that the caller could fall back to MultiJson for the values the
+ * codec doesn't know about. The only exception is a string which cannot
+ * be represented as UTF-8: the encoder raises ValueFormat error for it,
+ * and the decoder rejects malformed UTF-8 in the string literals. */
+
+#define JSON_MAX_NESTING 512
+
+#ifdef HAVE_RUBY_ENCODING_H
+#define JSON_STR_NEW(ptr, len) rb_enc_str_new((ptr), (len), rb_utf8_encoding())
+#else
+#define JSON_STR_NEW(ptr, len) rb_str_new((ptr), (len))
+#endif
+
+VALUE cb_json_backend;
+
+struct json_parser_st {
+    const char *ptr;
+    const char *end;
+    int depth;
+};
+
+static VALUE parse_value(struct json_parser_st *parser);
+
+    static inline void
+skip_whitespace(struct json_parser_st *parser)
+{
+    while (parser->ptr < parser->end) {
+        switch (*parser->ptr) {
+            case ' ':
+            case '\t':
+            case '\n':
+            case '\r':
+                parser->ptr++;
+                break;
+            default:
+                return;
+        }
+    }
+}
+
+    static inline int
+parse_hex4(const char *ptr, unsigned long *out)
+{
+    unsigned long cp = 0;
+    int ii;
+
+    for (ii = 0; ii < 4; ++ii) {
+        char c = ptr[ii];
+        cp <<= 4;
+        if (c >= '0' && c <= '9') {
+            cp |= (unsigned long)(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            cp |= (unsigned long)(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            cp |= (unsigned long)(c - 'A' + 10);
+        } else {
+            return 0;
+        }
+    }
+    *out = cp;
+    return 1;
+}
+
+    static inline size_t
+utf8_encode(unsigned long cp, char *buf)
+{
+    if (cp < 0x80) {
+        buf[0] = (char)cp;
+        return 1;
+    } else if (cp < 0x800) {
+        buf[0] = (char)(0xC0 | (cp >> 6));
+        buf[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    } else if (cp < 0x10000) {
+        buf[0] = (char)(0xE0 | (cp >> 12));
+        buf[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        buf[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    } else {
+        buf[0] = (char)(0xF0 | (cp >> 18));
+        buf[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        buf[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        buf[3] = (char)(0x80 | (cp & 0x3F));
+        return 4;
+    }
+}
+
+/* Returns the length of the well-formed UTF-8 sequence starting at ptr
+ * (RFC 3629: no overlong forms, surrogates or code points above U+10FFFF),
+ * or zero if the bytes are malformed. */
+    static inline size_t
+utf8_sequence_length(const char *ptr, const char *end)
+{
+    const unsigned char *p = (const unsigned char *)ptr;
+    size_t len = (size_t)(end - ptr), ii, need;
+    unsigned char lo = 0x80, hi = 0xBF;
+
+    if (p[0] < 0x80) {
+        return 1;
+    } else if (p[0] >= 0xC2 && p[0] <= 0xDF) {
+        need = 2;
+    } else if (p[0] >= 0xE0 && p[0] <= 0xEF) {
+        need = 3;
+        if (p[0] == 0xE0) {
+            lo = 0xA0;
+        } else if (p[0] == 0xED) {
+            hi = 0x9F;
+        }
+    } else if (p[0] >= 0xF0 && p[0] <= 0xF4) {
+        need = 4;
+        if (p[0] == 0xF0) {
+            lo = 0x90;
+        } else if (p[0] == 0xF4) {
+            hi = 0x8F;
+        }
+    } else {
+        return 0;
+    }
+    if (len < need || p[1] < lo || p[1] > hi) {
+        return 0;
+    }
+    for (ii = 2; ii < need; ++ii) {
+        if (p[ii] < 0x80 || p[ii] > 0xBF) {
+            return 0;
+        }
+    }
+    return need;
+}
+
+/* Expects parser->ptr right after the opening quote */
+    static VALUE
+parse_string(struct json_parser_st *parser)
+{
+    const char *start = parser->ptr, *p = start;
+    VALUE str;
+
+    /* fast path: no escape sequences, the string is copied as is */
+    while (p < parser->end && *p != '"' && *p != '\\') {
+        if ((unsigned char)*p < 0x20) {
+            return Qundef;
+        } else if ((unsigned char)*p >= 0x80) {
+            size_t nn = utf8_sequence_length(p, parser->end);
+            if (nn == 0) {
+                return Qundef;
+            }
+            p += nn;
+            continue;
+        }
+        p++;
+    }
+    if (p == parser->end) {
+        return Qundef;
+    }
+    if (*p == '"') {
+        parser->ptr = p + 1;
+        return JSON_STR_NEW(start, p - start);
+    }
+
+    str = JSON_STR_NEW(start, p - start);
+    while (p < parser->end) {
+        const char *run = p;
+        char buf[8];
+        unsigned long cp;
+
+        while (p < parser->end && *p != '"' && *p != '\\') {
+            if ((unsigned char)*p < 0x20) {
+                return Qundef;
+            } else if ((unsigned char)*p >= 0x80) {
+                size_t nn = utf8_sequence_length(p, parser->end);
+                if (nn == 0) {
+                    return Qundef;
+                }
+                p += nn;
+                continue;
+            }
+            p++;
+        }
+        if (p > run) {
+            rb_str_buf_cat(str, run, p - run);
+        }
+        if (p == parser->end) {
+            return Qundef;
+        }
+        if (*p == '"') {
+            parser->ptr = p + 1;
+            return str;
+        }
+        /* escape sequence */
+        if (++p == parser->end) {
+            return Qundef;
+        }
+        switch (*p) {
+            case '"':  buf[0] = '"';  break;
+            case '\\': buf[0] = '\\'; break;
+            case '/':  buf[0] = '/';  break;
+            case 'b':  buf[0] = '\b'; break;
+            case 'f':  buf[0] = '\f'; break;
+            case 'n':  buf[0] = '\n'; break;
+            case 'r':  buf[0] = '\r'; break;
+            case 't':  buf[0] = '\t'; break;
+            case 'u':
+                if (parser->end - p < 5 || !parse_hex4(p + 1, &cp)) {
+                    return Qundef;
+                }
+                p += 4;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    unsigned long lo;
+                    /* surrogate pair */
+                    if (parser->end - p < 7 || p[1] != '\\' || p[2] != 'u'
+                            || !parse_hex4(p + 3, &lo)
+                            || lo < 0xDC00 || lo > 0xDFFF) {
+                        return Qundef;
+                    }
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    p += 6;
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    return Qundef;
+                }
+                rb_str_buf_cat(str, buf, utf8_encode(cp, buf));
+                p++;
+                continue;
+            default:
+                return Qundef;
+        }
+        rb_str_buf_cat(str, buf, 1);
+        p++;
+    }
+    return Qundef;
+}
+
+    static VALUE
+parse_number(struct json_parser_st *parser)
+{
+    const char *start = parser->ptr, *p = start;
+    int is_float = 0;
+    size_t ndigits = 0;
+    char buf[64];
+    VALUE tmp = Qnil, val;
+    char *cstr;
+
+    if (p < parser->end && *p == '-') {
+        p++;
+    }
+    if (p == parser->end || *p < '0' || *p > '9') {
+        return Qundef;
+    }
+    if (*p == '0') {
+        p++;
+        ndigits++;
+    } else {
+        while (p < parser->end && *p >= '0' && *p <= '9') {
+            p++;
+            ndigits++;
+        }
+    }
+    if (p < parser->end && *p == '.') {
+        is_float = 1;
+        p++;
+        if (p == parser->end || *p < '0' || *p > '9') {
+            return Qundef;
+        }
+        while (p < parser->end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    if (p < parser->end && (*p == 'e' || *p == 'E')) {
+        is_float = 1;
+        p++;
+        if (p < parser->end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        if (p == parser->end || *p < '0' || *p > '9') {
+            return Qundef;
+        }
+        while (p < parser->end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    parser->ptr = p;
+
+    if (!is_float && ndigits < 19) {
+        /* fits into the long long, no need to copy the digits */
+        const char *d = start;
+        LONG_LONG num = 0;
+        int neg = 0;
+
+        if (*d == '-') {
+            neg = 1;
+            d++;
+        }
+        for (; d < p; ++d) {
+            num = num * 10 + (*d - '0');
+        }
+        return LL2NUM(neg ? -num : num);
+    }
+
+    /* the response buffer isn't NUL-terminated */
+    if ((size_t)(p - start) < sizeof(buf)) {
+        memcpy(buf, start, p - start);
+        buf[p - start] = '\0';
+        cstr = buf;
+    } else {
+        tmp = rb_str_new(start, p - start);
+        cstr = RSTRING_PTR(tmp);
+    }
+    if (is_float) {
+        val = DBL2NUM(rb_cstr_to_dbl(cstr, 0));
+    } else {
+        val = rb_cstr2inum(cstr, 10);
+    }
+    RB_GC_GUARD(tmp);
+    return val;
+}
+
+    static inline int
+parse_literal(struct json_parser_st *parser, const char *lit, size_t len)
+{
+    if ((size_t)(parser->end - parser->ptr) < len
+            || memcmp(parser->ptr, lit, len) != 0) {
+        return 0;
+    }
+    parser->ptr += len;
+    return 1;
+}
+
+    static VALUE
+parse_array(struct json_parser_st *parser)
+{
+    VALUE ary = rb_ary_new(), val;
+
+    skip_whitespace(parser);
+    if (parser->ptr < parser->end && *parser->ptr == ']') {
+        parser->ptr++;
+        return ary;
+    }
+    while (parser->ptr < parser->end) {
+        val = parse_value(parser);
+        if (val == Qundef) {
+            return Qundef;
+        }
+        rb_ary_push(ary, val);
+        skip_whitespace(parser);
+        if (parser->ptr == parser->end) {
+            break;
+        }
+        if (*parser->ptr == ']') {
+            parser->ptr++;
+            return ary;
+        }
+        if (*parser->ptr != ',') {
+            break;
+        }
+        parser->ptr++;
+    }
+    return Qundef;
+}
+
+    static VALUE
+parse_object(struct json_parser_st *parser)
+{
+    VALUE hash = rb_hash_new(), key, val;
+
+    skip_whitespace(parser);
+    if (parser->ptr < parser->end && *parser->ptr == '}') {
+        parser->ptr++;
+        return hash;
+    }
+    while (parser->ptr < parser->end) {
+        if (*parser->ptr != '"') {
+            break;
+        }
+        parser->ptr++;
+        key = parse_string(parser);
+        if (key == Qundef) {
+            return Qundef;
+        }
+        skip_whitespace(parser);
+        if (parser->ptr == parser->end || *parser->ptr != ':') {
+            break;
+        }
+        parser->ptr++;
+        val = parse_value(parser);
+        if (val == Qundef) {
+            return Qundef;
+        }
+        rb_hash_aset(hash, key, val);
+        skip_whitespace(parser);
+        if (parser->ptr == parser->end) {
+            break;
+        }
+        if (*parser->ptr == '}') {
+            parser->ptr++;
+            return hash;
+        }
+        if (*parser->ptr != ',') {
+            break;
+        }
+        parser->ptr++;
+        skip_whitespace(parser);
+    }
+    return Qundef;
+}
+
+    static VALUE
+parse_value(struct json_parser_st *parser)
+{
+    VALUE val;
+
+    skip_whitespace(parser);
+    if (parser->ptr == parser->end) {
+        return Qundef;
+    }
+    switch (*parser->ptr) {
+        case '{':
+        case '[':
+            if (++parser->depth > JSON_MAX_NESTING) {
+                return Qundef;
+            }
+            val = (*parser->ptr++ == '{') ? parse_object(parser) : parse_array(parser);
+            parser->depth--;
+            return val;
+        case '"':
+            parser->ptr++;
+            return parse_string(parser);
+        case 't':
+            return parse_literal(parser, "true", 4) ? Qtrue : Qundef;
+        case 'f':
+            return parse_literal(parser, "false", 5) ? Qfalse : Qundef;
+        case 'n':
+            return parse_literal(parser, "null", 4) ? Qnil : Qundef;
+        default:
+            return parse_number(parser);
+    }
+}
+
+/* Decode JSON document from the raw buffer. Returns Qundef if the buffer
+ * doesn't contain valid JSON. Like patched MultiJson, it accepts scalar
+ * values on the top level. */
+    VALUE
+cb_json_decode(const char *ptr, size_t len)
+{
+    struct json_parser_st parser;
+    VALUE val;
+
+    parser.ptr = ptr;
+    parser.end = ptr + len;
+    parser.depth = 0;
+    val = parse_value(&parser);
+    if (val == Qundef) {
+        return Qundef;
+    }
+    skip_whitespace(&parser);
+    if (parser.ptr != parser.end) {
+        return Qundef;  /* trailing garbage */
+    }
+    return val;
+}
+
+struct json_generator_st {
+    VALUE buf;
+    int depth;
+    int failed;
+    int first;
+};
+
+static int generate_value(struct json_generator_st *gen, VALUE val);
+
+    static void
+generate_string(struct json_generator_st *gen, VALUE str)
+{
+    const char *p, *end, *run;
+    static const char hex[] = "0123456789abcdef";
+
+#ifdef HAVE_RUBY_ENCODING_H
+    {
+        rb_encoding *enc = rb_enc_get(str);
+        /* binary strings are checked byte by byte below */
+        if (enc != rb_utf8_encoding() && enc != rb_usascii_encoding()
+                && enc != rb_ascii8bit_encoding()) {
+            str = rb_str_conv_enc(str, enc, rb_utf8_encoding());
+            if (rb_enc_get(str) != rb_utf8_encoding()) {
+                rb_raise(eValueFormatError,
+                        "unable to convert string from %s to UTF-8",
+                        rb_enc_name(enc));
+            }
+        }
+    }
+#endif
+    p = run = RSTRING_PTR(str);
+    end = p + RSTRING_LEN(str);
+    rb_str_buf_cat(gen->buf, "\"", 1);
+    for (; p < end; ++p) {
+        unsigned char c = (unsigned char)*p;
+        const char *esc = NULL;
+        char ubuf[6];
+
+        if (c >= 0x80) {
+            size_t nn = utf8_sequence_length(p, end);
+            if (nn == 0) {
+                rb_raise(eValueFormatError,
+                        "string contains invalid UTF-8 byte sequence");
+            }
+            p += nn - 1;
+            continue;
+        }
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        if (p > run) {
+            rb_str_buf_cat(gen->buf, run, p - run);
+        }
+        switch (c) {
+            case '"':  esc = "\\\""; break;
+            case '\\': esc = "\\\\"; break;
+            case '\b': esc = "\\b";  break;
+            case '\f': esc = "\\f";  break;
+            case '\n': esc = "\\n";  break;
+            case '\r': esc = "\\r";  break;
+            case '\t': esc = "\\t";  break;
+        }
+        if (esc) {
+            rb_str_buf_cat(gen->buf, esc, 2);
+        } else {
+            ubuf[0] = '\\';
+            ubuf[1] = 'u';
+            ubuf[2] = '0';
+            ubuf[3] = '0';
+            ubuf[4] = hex[c >> 4];
+            ubuf[5] = hex[c & 0xF];
+            rb_str_buf_cat(gen->buf, ubuf, 6);
+        }
+        run = p + 1;
+    }
+    if (p > run) {
+        rb_str_buf_cat(gen->buf, run, p - run);
+    }
+    rb_str_buf_cat(gen->buf, "\"", 1);
+}
+
+    static int
+generate_pair_i(VALUE key, VALUE val, VALUE arg)
+{
+    struct json_generator_st *gen = (struct json_generator_st *)arg;
+
+    if (!gen->first) {
+        rb_str_buf_cat(gen->buf, ",", 1);
+    }
+    gen->first = 0;
+    switch (TYPE(key)) {
+        case T_STRING:
+            generate_string(gen, key);
+            break;
+        case T_SYMBOL:
+            generate_string(gen, rb_id2str(SYM2ID(key)));
+            break;
+        default:
+            /* let MultiJson decide how to stringify the key */
+            gen->failed = 1;
+            return ST_STOP;
+    }
+    rb_str_buf_cat(gen->buf, ":", 1);
+    if (!generate_value(gen, val)) {
+        return ST_STOP;
+    }
+    return ST_CONTINUE;
+}
+
+    static int
+generate_value(struct json_generator_st *gen, VALUE val)
+{
+    char buf[32];
+    long ii;
+
+    switch (TYPE(val)) {
+        case T_NIL:
+            rb_str_buf_cat(gen->buf, "null", 4);
+            break;
+        case T_TRUE:
+            rb_str_buf_cat(gen->buf, "true", 4);
+            break;
+        case T_FALSE:
+            rb_str_buf_cat(gen->buf, "false", 5);
+            break;
+        case T_FIXNUM:
+            ii = snprintf(buf, sizeof(buf), "%ld", FIX2LONG(val));
+            rb_str_buf_cat(gen->buf, buf, ii);
+            break;
+        case T_BIGNUM:
+            rb_str_buf_append(gen->buf, rb_big2str(val, 10));
+            break;
+        case T_FLOAT:
+            {
+                double d = RFLOAT_VALUE(val);
+                if (isnan(d) || isinf(d)) {
+                    gen->failed = 1;
+                    return 0;
+                }
+                rb_str_buf_append(gen->buf, rb_funcall(val, id_to_s, 0));
+            }
+            break;
+        case T_STRING:
+            generate_string(gen, val);
+            break;
+        case T_SYMBOL:
+            generate_string(gen, rb_id2str(SYM2ID(val)));
+            break;
+        case T_ARRAY:
+            if (++gen->depth > JSON_MAX_NESTING) {
+                gen->failed = 1;
+                return 0;
+            }
+            rb_str_buf_cat(gen->buf, "[", 1);
+            for (ii = 0; ii < RARRAY_LEN(val); ++ii) {
+                if (ii > 0) {
+                    rb_str_buf_cat(gen->buf, ",", 1);
+                }
+                if (!generate_value(gen, rb_ary_entry(val, ii))) {
+                    return 0;
+                }
+            }
+            rb_str_buf_cat(gen->buf, "]", 1);
+            gen->depth--;
+            break;
+        case T_HASH:
+            if (++gen->depth > JSON_MAX_NESTING) {
+                gen->failed = 1;
+                return 0;
+            }
+            rb_str_buf_cat(gen->buf, "{", 1);
+            gen->first = 1;
+            rb_hash_foreach(val, generate_pair_i, (VALUE)gen);
+            if (gen->failed) {
+                return 0;
+            }
+            gen->first = 0;
+            rb_str_buf_cat(gen->buf, "}", 1);
+            gen->depth--;
+            break;
+        default:
+            /* custom objects might define #to_json or #as_json */
+            gen->failed = 1;
+            return 0;
+    }
+    return 1;
+}
+
+/* Encode the value to JSON. Returns Qundef if it contains the objects
+ * which aren't supported by built-in codec. */
+    VALUE
+cb_json_encode(VALUE val)
+{
+    struct json_generator_st gen;
+
+    gen.buf = rb_str_buf_new(256);
+    gen.depth = 0;
+    gen.failed = 0;
+    gen.first = 0;
+    if (!generate_value(&gen, val) || gen.failed) {
+        return Qundef;
+    }
+#ifdef HAVE_RUBY_ENCODING_H
+    rb_enc_associate(gen.buf, rb_utf8_encoding());
+#endif
+    return gen.buf;
+}
+
+/*
+ * Returns the JSON library used for the +:document+ format
+ *
+ * @since 1.2.0
+ *
+ * @return [Symbol] +:native+ for built-in codec (default) or
+ *   +:multi_json+ when the documents are handled by MultiJson
+ */
+    VALUE
+cb_json_backend_get(VALUE self)
+{
+    (void)self;
+    return cb_json_backend;
+}
+
+/*
+ * Select the JSON library for the +:document+ format
+ *
+ * @since 1.2.0
+ *
+ * The built-in codec handles core types only. The values with other
+ * objects (e.g. responding to +#to_json+) are passed to MultiJson anyway.
+ * Use +:multi_json+ backend if the application needs custom options of
+ * the JSON engine for all documents.
+ *
+ * @example Fall back to MultiJson
+ *   Couchbase.json_backend = :multi_json
+ *
+ * @param [Symbol] backend +:native+ or +:multi_json+
+ *
+ * @raise [ArgumentError] for unknown backend
+ *
+ * @return [Symbol]
+ */
+    VALUE
+cb_json_backend_set(VALUE self, VALUE backend)
+{
+    if (backend != sym_native && backend != sym_multi_json) {
+        rb_raise(rb_eArgError, "unknown JSON backend, expected :native or :multi_json");
+    }
+    cb_json_backend = backend;
+    (void)self;
+    return backend;
+}
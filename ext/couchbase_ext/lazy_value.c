@@ -0,0 +1,183 @@
+/* vim: ft=c et ts=8 sts=4 sw=4 cino=
+ *
+ *   Copyright 2011, 2012 Couchbase, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "couchbase_ext.h"
+
+    void
+cb_lazy_value_free(void *ptr)
+{
+    xfree(ptr);
+}
+
+    void
+cb_lazy_value_mark(void *ptr)
+{
+    struct lazy_value_st *lazy = ptr;
+
+    if (lazy) {
+        rb_gc_mark(lazy->key);
+        rb_gc_mark(lazy->raw);
+        rb_gc_mark(lazy->force_format);
+        rb_gc_mark(lazy->value);
+    }
+}
+
+    VALUE
+cb_lazy_value_alloc(VALUE klass)
+{
+    VALUE obj;
+    struct lazy_value_st *lazy;
+
+    /* allocate new lazy value struct and set it to zero */
+    obj = Data_Make_Struct(klass, struct lazy_value_st,
+            cb_lazy_value_mark, cb_lazy_value_free, lazy);
+    lazy->key = Qnil;
+    lazy->raw = Qnil;
+    lazy->force_format = Qnil;
+    lazy->value = Qnil;
+    return obj;
+}
+
+/* Wrap the response bytes. The value will be decoded on first access */
+    VALUE
+cb_lazy_value_new(VALUE key, const char *bytes, size_t nbytes,
+        uint32_t flags, VALUE force_format, int encoding)
+{
+    VALUE obj = cb_lazy_value_alloc(cLazyValue);
+    struct lazy_value_st *lazy = DATA_PTR(obj);
+
+    lazy->key = key;
+    lazy->raw = cb_str_new(encoding, bytes, nbytes);
+    lazy->encoding = encoding;
+    lazy->flags = flags;
+    lazy->force_format = force_format;
+    return obj;
+}
+
+/*
+ * Returns decoded value
+ *
+ * @since 1.2.0
+ *
+ * The value is decoded only once, on the first call.
+ *
+ * @raise [Couchbase::Error::ValueFormat] if the value cannot be decoded
+ *
+ * @return [Object]
+ */
+    VALUE
+cb_lazy_value_value(VALUE self)
+{
+    struct lazy_value_st *lazy = DATA_PTR(self);
+    VALUE val, exc;
+
+    if (lazy->decoded) {
+        return lazy->value;
+    }
+    if (RSTRING_LEN(lazy->raw) != 0) {
+        val = decode_value(lazy->raw, lazy->flags, lazy->force_format, lazy->encoding);
+        if (val == Qundef) {
+            exc = rb_exc_new2(eValueFormatError, "unable to convert value");
+            rb_ivar_set(exc, id_iv_operation, sym_get);
+            rb_ivar_set(exc, id_iv_key, lazy->key);
+            rb_exc_raise(exc);
+        }
+    } else if (flags_get_format(lazy->flags) == sym_plain) {
+        val = STR_NEW_CSTR("");
+    } else {
+        val = Qnil;
+    }
+    lazy->value = val;
+    lazy->decoded = 1;
+    return val;
+}
+
+/*
+ * Returns the bytes received from the server
+ *
+ * @since 1.2.0
+ *
+ * @return [String]
+ */
+    VALUE
+cb_lazy_value_raw(VALUE self)
+{
+    struct lazy_value_st *lazy = DATA_PTR(self);
+    return lazy->raw;
+}
+
+/*
+ * Returns the flags of the value
+ *
+ * @since 1.2.0
+ *
+ * @return [Fixnum]
+ */
+    VALUE
+cb_lazy_value_flags(VALUE self)
+{
+    struct lazy_value_st *lazy = DATA_PTR(self);
+    return ULONG2NUM(lazy->flags);
+}
+
+/*
+ * Check if the value has been decoded already
+ *
+ * @since 1.2.0
+ *
+ * @return [true, false]
+ */
+    VALUE
+cb_lazy_value_decoded_p(VALUE self)
+{
+    struct lazy_value_st *lazy = DATA_PTR(self);
+    return lazy->decoded ? Qtrue : Qfalse;
+}
+
+/*
+ * Returns a string containing a human-readable representation of the
+ * LazyValue.
+ *
+ * @since 1.2.0
+ *
+ * @return [String]
+ */
+    VALUE
+cb_lazy_value_inspect(VALUE self)
+{
+    struct lazy_value_st *lazy = DATA_PTR(self);
+    VALUE str;
+    char buf[100];
+
+    str = rb_str_buf_new2("#<");
+    rb_str_buf_cat2(str, rb_obj_classname(self));
+    snprintf(buf, 100, ":%p key=", (void *)self);
+    rb_str_buf_cat2(str, buf);
+    rb_str_append(str, rb_inspect(lazy->key));
+    snprintf(buf, 100, " flags=0x%x", (unsigned int)lazy->flags);
+    rb_str_buf_cat2(str, buf);
+    if (lazy->decoded) {
+        rb_str_buf_cat2(str, " value=");
+        rb_str_append(str, rb_inspect(lazy->value));
+    } else {
+        snprintf(buf, 100, " bytes=%ld", (long)RSTRING_LEN(lazy->raw));
+        rb_str_buf_cat2(str, buf);
+    }
+    rb_str_buf_cat2(str, ">");
+
+    return str;
+}
@@ -23,38 +23,38 @@ observe_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_
     struct context_st *ctx = (struct context_st *)cookie;
     struct bucket_st *bucket = ctx->bucket;
     VALUE key, res, *rv = ctx->rv;
+    struct result_st *r;
 
     if (resp->v.v0.key) {
-        key = STR_NEW((const char*)resp->v.v0.key, resp->v.v0.nkey);
+        key = cb_context_key(ctx, (const char*)resp->v.v0.key, resp->v.v0.nkey);
         ctx->exception = cb_check_error(error, "failed to execute observe request", key);
         if (ctx->exception) {
             cb_gc_protect(bucket, ctx->exception);
         }
-        res = rb_class_new_instance(0, NULL, cResult);
-        rb_ivar_set(res, id_iv_completed, Qfalse);
-        rb_ivar_set(res, id_iv_error, ctx->exception);
-        rb_ivar_set(res, id_iv_operation, sym_observe);
-        rb_ivar_set(res, id_iv_key, key);
-        rb_ivar_set(res, id_iv_cas, ULL2NUM(resp->v.v0.cas));
-        rb_ivar_set(res, id_iv_from_master, resp->v.v0.from_master ? Qtrue : Qfalse);
-        rb_ivar_set(res, id_iv_time_to_persist, ULONG2NUM(resp->v.v0.ttp));
-        rb_ivar_set(res, id_iv_time_to_replicate, ULONG2NUM(resp->v.v0.ttr));
+        res = cb_result_new(sym_observe, key, ctx->exception);
+        r = DATA_PTR(res);
+        r->completed = 0;
+        r->cas = resp->v.v0.cas;
+        r->from_master = resp->v.v0.from_master;
+        r->ttp = resp->v.v0.ttp;
+        r->ttr = resp->v.v0.ttr;
+        r->fields |= RESULT_COMPLETED | RESULT_CAS | RESULT_OBSERVE;
         switch (resp->v.v0.status) {
             case LCB_OBSERVE_FOUND:
-                rb_ivar_set(res, id_iv_status, sym_found);
+                r->status = sym_found;
                 break;
             case LCB_OBSERVE_PERSISTED:
-                rb_ivar_set(res, id_iv_status, sym_persisted);
+                r->status = sym_persisted;
                 break;
             case LCB_OBSERVE_NOT_FOUND:
-                rb_ivar_set(res, id_iv_status, sym_not_found);
+                r->status = sym_not_found;
                 break;
             default:
-                rb_ivar_set(res, id_iv_status, Qnil);
+                r->status = Qnil;
         }
-        if (bucket->async) { /* asynchronous */
+        if (ctx->async) { /* asynchronous */
             if (ctx->proc != Qnil) {
-                cb_proc_call(ctx->proc, 1, res);
+                cb_context_yield(ctx, res);
             }
         } else {             /* synchronous */
             if (NIL_P(ctx->exception)) {
@@ -67,17 +67,33 @@ observe_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_
             }
         }
     } else {
-        if (bucket->async && ctx->proc != Qnil) {
-            res = rb_class_new_instance(0, NULL, cResult);
-            rb_ivar_set(res, id_iv_completed, Qtrue);
-            cb_proc_call(ctx->proc, 1, res);
+        if (ctx->async && ctx->proc != Qnil) {
+            res = cb_result_new(Qnil, Qnil, Qnil);
+            r = DATA_PTR(res);
+            r->completed = 1;
+            r->fields |= RESULT_COMPLETED;
+            cb_context_yield(ctx, res);
         }
         ctx->nqueries--;
-        cb_gc_unprotect(bucket, ctx->proc);
+        if (ctx->nqueries == 0) {
+            cb_context_finish(ctx);
+        }
     }
     (void)handle;
 }
 
+/* Fill the context and schedule the command (see cb_context_schedule()) */
+    static lcb_error_t
+do_schedule(struct schedule_st *sched)
+{
+    struct params_st *params = sched->params;
+    struct context_st *ctx = sched->ctx;
+
+    ctx->nqueries = params->cmd.observe.num;
+    return lcb_observe(params->bucket->handle, cb_context_cookie(ctx),
+            params->cmd.observe.num, params->cmd.observe.ptr);
+}
+
 /*
  * Observe key state
  *
@@ -113,8 +129,8 @@ cb_bucket_observe(int argc, VALUE *argv, VALUE self)
     struct bucket_st *bucket = DATA_PTR(self);
     struct context_st *ctx;
     VALUE args, rv, proc, exc;
-    lcb_error_t err;
     struct params_st params;
+    struct schedule_st sched;
 
     if (bucket->handle == NULL) {
         rb_raise(eConnectError, "closed connection");
@@ -126,25 +142,13 @@ cb_bucket_observe(int argc, VALUE *argv, VALUE self)
     memset(&params, 0, sizeof(struct params_st));
     params.type = cmd_observe;
     params.bucket = bucket;
-    cb_params_build(&params, RARRAY_LEN(args), args);
-    ctx = xcalloc(1, sizeof(struct context_st));
-    if (ctx == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for context");
-    }
-    ctx->proc = cb_gc_protect(bucket, proc);
-    ctx->bucket = bucket;
     rv = rb_hash_new();
-    ctx->rv = &rv;
-    ctx->exception = Qnil;
-    ctx->nqueries = params.cmd.observe.num;
-    err = lcb_observe(bucket->handle, (const void *)ctx,
-            params.cmd.observe.num, params.cmd.observe.ptr);
-    cb_params_destroy(&params);
-    exc = cb_check_error(err, "failed to schedule observe request", Qnil);
-    if (exc != Qnil) {
-        xfree(ctx);
-        rb_exc_raise(exc);
-    }
+    cb_params_build(&params, RARRAY_LEN(args), args);
+    sched.bucket = bucket;
+    sched.params = &params;
+    sched.proc = proc;
+    sched.rv = &rv;
+    ctx = cb_context_schedule(&sched, do_schedule, "failed to schedule observe request", Qnil);
     bucket->nbytes += params.npayload;
     if (bucket->async) {
         maybe_do_loop(bucket);
@@ -152,10 +156,10 @@ cb_bucket_observe(int argc, VALUE *argv, VALUE self)
     } else {
         if (ctx->nqueries > 0) {
             /* we have some operations pending */
-            lcb_wait(bucket->handle);
+            cb_wait(bucket, ctx);
         }
         exc = ctx->exception;
-        xfree(ctx);
+        cb_context_free(ctx);
         if (exc != Qnil) {
             cb_gc_unprotect(bucket, exc);
             rb_exc_raise(exc);
@@ -17,6 +17,212 @@
 
 #include "couchbase_ext.h"
 
+/* The attributes are kept in C struct and converted to ruby objects only
+ * when the application asks for them. The instance variables (e.g. set
+ * by Result#initialize or #instance_variable_set) take precedence over
+ * the values from the struct. */
+    static inline int
+result_ivar_p(VALUE self, ID iv)
+{
+#ifdef FL_EXIVAR
+    if (!FL_TEST(self, FL_EXIVAR)) {
+        return 0;
+    }
+#endif
+    return rb_ivar_defined(self, iv);
+}
+
+    void
+cb_result_free(void *ptr)
+{
+    xfree(ptr);
+}
+
+    void
+cb_result_mark(void *ptr)
+{
+    struct result_st *res = ptr;
+
+    if (res) {
+        rb_gc_mark(res->operation);
+        rb_gc_mark(res->error);
+        rb_gc_mark(res->key);
+        rb_gc_mark(res->value);
+        rb_gc_mark(res->node);
+        rb_gc_mark(res->headers);
+        rb_gc_mark(res->status);
+    }
+}
+
+    VALUE
+cb_result_alloc(VALUE klass)
+{
+    VALUE obj;
+    struct result_st *res;
+
+    /* allocate new result struct and set it to zero */
+    obj = Data_Make_Struct(klass, struct result_st,
+            cb_result_mark, cb_result_free, res);
+    res->operation = Qnil;
+    res->error = Qnil;
+    res->key = Qnil;
+    res->value = Qnil;
+    res->node = Qnil;
+    res->headers = Qnil;
+    res->status = Qnil;
+    return obj;
+}
+
+    VALUE
+cb_result_new(VALUE operation, VALUE key, VALUE error)
+{
+    VALUE obj = cb_result_alloc(cResult);
+    struct result_st *res = DATA_PTR(obj);
+
+    res->operation = operation;
+    res->key = key;
+    res->error = error;
+    return obj;
+}
+
+/* Attach the status of the operation instead of the exception object
+ * (see :errors => :codes). The exception is created by Result#error */
+    void
+cb_result_set_status(VALUE obj, lcb_error_t rc, const char *msg)
+{
+    struct result_st *res = DATA_PTR(obj);
+
+    res->rc = rc;
+    res->errmsg = msg;
+    res->fields |= RESULT_STATUS;
+}
+
+    VALUE
+cb_result_init_copy(VALUE copy, VALUE orig)
+{
+    if (copy == orig) {
+        return copy;
+    }
+    if (TYPE(orig) != T_DATA || TYPE(copy) != T_DATA ||
+            RDATA(orig)->dfree != (RUBY_DATA_FUNC)cb_result_free) {
+        rb_raise(rb_eTypeError, "wrong argument type");
+    }
+    memcpy(DATA_PTR(copy), DATA_PTR(orig), sizeof(struct result_st));
+    return copy;
+}
+
+#define DEFINE_RESULT_READER(name) \
+    VALUE \
+    cb_result_##name##_get(VALUE self) \
+    { \
+        if (result_ivar_p(self, id_iv_##name)) { \
+            return rb_ivar_get(self, id_iv_##name); \
+        } \
+        return ((struct result_st *)DATA_PTR(self))->name; \
+    }
+
+DEFINE_RESULT_READER(operation)
+DEFINE_RESULT_READER(key)
+DEFINE_RESULT_READER(value)
+DEFINE_RESULT_READER(node)
+DEFINE_RESULT_READER(headers)
+DEFINE_RESULT_READER(status)
+
+    VALUE
+cb_result_error_get(VALUE self)
+{
+    struct result_st *res = DATA_PTR(self);
+    VALUE exc;
+
+    if (result_ivar_p(self, id_iv_error)) {
+        return rb_ivar_get(self, id_iv_error);
+    }
+    if (NIL_P(res->error) && (res->fields & RESULT_STATUS)) {
+        exc = cb_check_error(res->rc, res->errmsg, res->key);
+        if (exc != Qnil) {
+            rb_ivar_set(exc, id_iv_operation, res->operation);
+            if (res->fields & RESULT_CAS) {
+                rb_ivar_set(exc, id_iv_cas, ULL2NUM(res->cas));
+            }
+        }
+        res->error = exc;
+        res->fields &= ~RESULT_STATUS;
+    }
+    return res->error;
+}
+
+    VALUE
+cb_result_cas_get(VALUE self)
+{
+    struct result_st *res = DATA_PTR(self);
+
+    if (result_ivar_p(self, id_iv_cas)) {
+        return rb_ivar_get(self, id_iv_cas);
+    }
+    return (res->fields & RESULT_CAS) ? ULL2NUM(res->cas) : Qnil;
+}
+
+    VALUE
+cb_result_flags_get(VALUE self)
+{
+    struct result_st *res = DATA_PTR(self);
+
+    if (result_ivar_p(self, id_iv_flags)) {
+        return rb_ivar_get(self, id_iv_flags);
+    }
+    return (res->fields & RESULT_FLAGS) ? ULONG2NUM(res->flags) : Qnil;
+}
+
+    VALUE
+cb_result_completed_get(VALUE self)
+{
+    struct result_st *res = DATA_PTR(self);
+
+    if (result_ivar_p(self, id_iv_completed)) {
+        return rb_ivar_get(self, id_iv_completed);
+    }
+    if (res->fields & RESULT_COMPLETED) {
+        return res->completed ? Qtrue : Qfalse;
+    }
+    return Qnil;
+}
+
+    VALUE
+cb_result_from_master_get(VALUE self)
+{
+    struct result_st *res = DATA_PTR(self);
+
+    if (result_ivar_p(self, id_iv_from_master)) {
+        return rb_ivar_get(self, id_iv_from_master);
+    }
+    if (res->fields & RESULT_OBSERVE) {
+        return res->from_master ? Qtrue : Qfalse;
+    }
+    return Qnil;
+}
+
+    VALUE
+cb_result_time_to_persist_get(VALUE self)
+{
+    struct result_st *res = DATA_PTR(self);
+
+    if (result_ivar_p(self, id_iv_time_to_persist)) {
+        return rb_ivar_get(self, id_iv_time_to_persist);
+    }
+    return (res->fields & RESULT_OBSERVE) ? ULONG2NUM(res->ttp) : Qnil;
+}
+
+    VALUE
+cb_result_time_to_replicate_get(VALUE self)
+{
+    struct result_st *res = DATA_PTR(self);
+
+    if (result_ivar_p(self, id_iv_time_to_replicate)) {
+        return rb_ivar_get(self, id_iv_time_to_replicate);
+    }
+    return (res->fields & RESULT_OBSERVE) ? ULONG2NUM(res->ttr) : Qnil;
+}
+
 /*
  * Check if result of operation was successful.
  *
@@ -28,7 +234,52 @@
     VALUE
 cb_result_success_p(VALUE self)
 {
-    return RTEST(rb_ivar_get(self, id_iv_error)) ? Qfalse : Qtrue;
+    struct result_st *res = DATA_PTR(self);
+
+    if ((res->fields & RESULT_STATUS) && !result_ivar_p(self, id_iv_error)) {
+        return (res->rc == LCB_SUCCESS || res->rc == LCB_AUTH_CONTINUE) ? Qtrue : Qfalse;
+    }
+    return RTEST(cb_result_error_get(self)) ? Qfalse : Qtrue;
+}
+
+/*
+ * Returns the status of operation as a Symbol
+ *
+ * @since 1.2.0
+ *
+ * It doesn't create the exception object when the operation was
+ * scheduled with +:errors => :codes+ option.
+ *
+ * @example Branch on missing key without exceptions
+ *   c.run do
+ *     c.get("foo", "bar", :errors => :codes) do |ret|
+ *       case ret.error_code
+ *       when :success
+ *         puts ret.value
+ *       when :not_found
+ *         puts "#{ret.key} is missing"
+ *       end
+ *     end
+ *   end
+ *
+ * @return [Symbol] +:success+, +:not_found+, +:key_exists+,
+ *   +:not_stored+, +:timeout+ etc.
+ */
+    VALUE
+cb_result_error_code(VALUE self)
+{
+    struct result_st *res = DATA_PTR(self);
+    VALUE exc, rc;
+
+    if ((res->fields & RESULT_STATUS) && !result_ivar_p(self, id_iv_error)) {
+        return cb_error_code_get(res->rc);
+    }
+    exc = cb_result_error_get(self);
+    if (NIL_P(exc)) {
+        return cb_error_code_get(LCB_SUCCESS);
+    }
+    rc = rb_ivar_get(exc, id_iv_error);
+    return cb_error_code_get(FIXNUM_P(rc) ? (lcb_error_t)FIX2INT(rc) : LCB_ERROR);
 }
 
 /*
@@ -41,6 +292,7 @@ cb_result_success_p(VALUE self)
     VALUE
 cb_result_inspect(VALUE self)
 {
+    struct result_st *res = DATA_PTR(self);
     VALUE str, attr, error;
     char buf[100];
 
@@ -49,70 +301,70 @@ cb_result_inspect(VALUE self)
     snprintf(buf, 100, ":%p", (void *)self);
     rb_str_buf_cat2(str, buf);
 
-    attr = rb_ivar_get(self, id_iv_error);
-    if (RTEST(attr)) {
-        error = rb_ivar_get(attr, id_iv_error);
+    if ((res->fields & RESULT_STATUS) && !result_ivar_p(self, id_iv_error)) {
+        error = INT2FIX(res->rc);
     } else {
-        error = INT2FIX(0);
+        attr = cb_result_error_get(self);
+        error = RTEST(attr) ? rb_ivar_get(attr, id_iv_error) : INT2FIX(0);
     }
     rb_str_buf_cat2(str, " error=0x");
     rb_str_append(str, rb_funcall(error, id_to_s, 1, INT2FIX(16)));
 
-    attr = rb_ivar_get(self, id_iv_operation);
+    attr = cb_result_operation_get(self);
     if (RTEST(attr)) {
         rb_str_buf_cat2(str, " operation=");
         rb_str_append(str, rb_inspect(attr));
     }
 
-    attr = rb_ivar_get(self, id_iv_key);
+    attr = cb_result_key_get(self);
     if (RTEST(attr)) {
         rb_str_buf_cat2(str, " key=");
         rb_str_append(str, rb_inspect(attr));
     }
 
-    attr = rb_ivar_get(self, id_iv_status);
+    attr = cb_result_status_get(self);
     if (RTEST(attr)) {
         rb_str_buf_cat2(str, " status=");
         rb_str_append(str, rb_inspect(attr));
     }
 
-    attr = rb_ivar_get(self, id_iv_cas);
+    attr = cb_result_cas_get(self);
     if (RTEST(attr)) {
         rb_str_buf_cat2(str, " cas=");
         rb_str_append(str, rb_inspect(attr));
     }
 
-    attr = rb_ivar_get(self, id_iv_flags);
+    attr = cb_result_flags_get(self);
     if (RTEST(attr)) {
         rb_str_buf_cat2(str, " flags=0x");
         rb_str_append(str, rb_funcall(attr, id_to_s, 1, INT2FIX(16)));
     }
 
-    attr = rb_ivar_get(self, id_iv_node);
+    attr = cb_result_node_get(self);
     if (RTEST(attr)) {
         rb_str_buf_cat2(str, " node=");
         rb_str_append(str, rb_inspect(attr));
     }
 
-    attr = rb_ivar_get(self, id_iv_from_master);
+    attr = cb_result_from_master_get(self);
     if (attr != Qnil) {
         rb_str_buf_cat2(str, " from_master=");
         rb_str_append(str, rb_inspect(attr));
     }
 
-    attr = rb_ivar_get(self, id_iv_time_to_persist);
+    attr = cb_result_time_to_persist_get(self);
     if (RTEST(attr)) {
         rb_str_buf_cat2(str, " time_to_persist=");
         rb_str_append(str, rb_inspect(attr));
     }
 
-    attr = rb_ivar_get(self, id_iv_time_to_replicate);
+    attr = cb_result_time_to_replicate_get(self);
     if (RTEST(attr)) {
         rb_str_buf_cat2(str, " time_to_replicate=");
         rb_str_append(str, rb_inspect(attr));
     }
 
-    attr = rb_ivar_get(self, id_iv_headers);
+    attr = cb_result_headers_get(self);
     if (RTEST(attr)) {
         rb_str_buf_cat2(str, " headers=");
         rb_str_append(str, rb_inspect(attr));
@@ -23,6 +23,7 @@ stat_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_ser
     struct context_st *ctx = (struct context_st *)cookie;
     struct bucket_st *bucket = ctx->bucket;
     VALUE stats, node, key, val, *rv = ctx->rv, exc = Qnil, res;
+    struct result_st *r;
 
     node = resp->v.v0.server_endpoint ? STR_NEW_CSTR(resp->v.v0.server_endpoint) : Qnil;
     exc = cb_check_error(error, "failed to fetch stats", node);
@@ -35,15 +36,13 @@ stat_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_ser
     if (node != Qnil) {
         key = STR_NEW((const char*)resp->v.v0.key, resp->v.v0.nkey);
         val = STR_NEW((const char*)resp->v.v0.bytes, resp->v.v0.nbytes);
-        if (bucket->async) {    /* asynchronous */
+        if (ctx->async) {    /* asynchronous */
             if (ctx->proc != Qnil) {
-                res = rb_class_new_instance(0, NULL, cResult);
-                rb_ivar_set(res, id_iv_error, exc);
-                rb_ivar_set(res, id_iv_operation, sym_stats);
-                rb_ivar_set(res, id_iv_node, node);
-                rb_ivar_set(res, id_iv_key, key);
-                rb_ivar_set(res, id_iv_value, val);
-                cb_proc_call(ctx->proc, 1, res);
+                res = cb_result_new(sym_stats, key, exc);
+                r = DATA_PTR(res);
+                r->node = node;
+                r->value = val;
+                cb_context_yield(ctx, res);
             }
         } else {                /* synchronous */
             if (NIL_P(exc)) {
@@ -57,11 +56,25 @@ stat_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_ser
         }
     } else {
         ctx->nqueries--;
-        cb_gc_unprotect(bucket, ctx->proc);
+        if (ctx->nqueries == 0) {
+            cb_context_finish(ctx);
+        }
     }
     (void)handle;
 }
 
+/* Fill the context and schedule the command (see cb_context_schedule()) */
+    static lcb_error_t
+do_schedule(struct schedule_st *sched)
+{
+    struct params_st *params = sched->params;
+    struct context_st *ctx = sched->ctx;
+
+    ctx->nqueries = params->cmd.stats.num;
+    return lcb_server_stats(params->bucket->handle, cb_context_cookie(ctx),
+            params->cmd.stats.num, params->cmd.stats.ptr);
+}
+
 /*
  * Request server statistics.
  *
@@ -110,8 +123,8 @@ cb_bucket_stats(int argc, VALUE *argv, VALUE self)
     struct bucket_st *bucket = DATA_PTR(self);
     struct context_st *ctx;
     VALUE rv, exc, args, proc;
-    lcb_error_t err;
     struct params_st params;
+    struct schedule_st sched;
 
     if (bucket->handle == NULL) {
         rb_raise(eConnectError, "closed connection");
@@ -123,25 +136,13 @@ cb_bucket_stats(int argc, VALUE *argv, VALUE self)
     memset(&params, 0, sizeof(struct params_st));
     params.type = cmd_stats;
     params.bucket = bucket;
-    cb_params_build(&params, RARRAY_LEN(args), args);
-    ctx = xcalloc(1, sizeof(struct context_st));
-    if (ctx == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for context");
-    }
     rv = rb_hash_new();
-    ctx->rv = &rv;
-    ctx->bucket = bucket;
-    ctx->proc = cb_gc_protect(bucket, proc);
-    ctx->exception = Qnil;
-    ctx->nqueries = params.cmd.stats.num;
-    err = lcb_server_stats(bucket->handle, (const void *)ctx,
-            params.cmd.stats.num, params.cmd.stats.ptr);
-    exc = cb_check_error(err, "failed to schedule stat request", Qnil);
-    cb_params_destroy(&params);
-    if (exc != Qnil) {
-        xfree(ctx);
-        rb_exc_raise(exc);
-    }
+    cb_params_build(&params, RARRAY_LEN(args), args);
+    sched.bucket = bucket;
+    sched.params = &params;
+    sched.proc = proc;
+    sched.rv = &rv;
+    ctx = cb_context_schedule(&sched, do_schedule, "failed to schedule stat request", Qnil);
     bucket->nbytes += params.npayload;
     if (bucket->async) {
         maybe_do_loop(bucket);
@@ -149,10 +150,10 @@ cb_bucket_stats(int argc, VALUE *argv, VALUE self)
     } else {
         if (ctx->nqueries > 0) {
             /* we have some operations pending */
-            lcb_wait(bucket->handle);
+            cb_wait(bucket, ctx);
         }
         exc = ctx->exception;
-        xfree(ctx);
+        cb_context_free(ctx);
         if (exc != Qnil) {
             cb_gc_unprotect(bucket, exc);
             rb_exc_raise(exc);
@@ -25,12 +25,13 @@ storage_observe_callback(VALUE args, VALUE cookie)
 
     if (ctx->proc != Qnil) {
         rb_ivar_set(res, id_iv_operation, ctx->operation);
-        cb_proc_call(ctx->proc, 1, res);
+        cb_context_yield(ctx, res);
     }
     if (!RTEST(ctx->observe_options)) {
         ctx->nqueries--;
+        cb_context_window_next(ctx);
         if (ctx->nqueries == 0) {
-            cb_gc_unprotect(ctx->bucket, ctx->proc);
+            cb_context_finish(ctx);
         }
     }
     return Qnil;
@@ -42,10 +43,11 @@ storage_callback(lcb_t handle, const void *cookie, lcb_storage_t operation,
 {
     struct context_st *ctx = (struct context_st *)cookie;
     struct bucket_st *bucket = ctx->bucket;
+    const char *msg = "failed to store value";
     VALUE key, cas, *rv = ctx->rv, exc, res;
+    struct result_st *r;
 
-    key = STR_NEW((const char*)resp->v.v0.key, resp->v.v0.nkey);
-    strip_key_prefix(bucket, key);
+    key = cb_context_key(ctx, (const char*)resp->v.v0.key, resp->v.v0.nkey);
 
     cas = resp->v.v0.cas > 0 ? ULL2NUM(resp->v.v0.cas) : Qnil;
     switch(operation) {
@@ -67,7 +69,7 @@ storage_callback(lcb_t handle, const void *cookie, lcb_storage_t operation,
         default:
             ctx->operation = Qnil;
     }
-    exc = cb_check_error(error, "failed to store value", key);
+    exc = cb_context_check_error(ctx, error, msg, key);
     if (exc != Qnil) {
         rb_ivar_set(exc, id_iv_cas, cas);
         rb_ivar_set(exc, id_iv_operation, ctx->operation);
@@ -76,7 +78,7 @@ storage_callback(lcb_t handle, const void *cookie, lcb_storage_t operation,
         }
     }
 
-    if (bucket->async) { /* asynchronous */
+    if (ctx->async) { /* asynchronous */
         if (RTEST(ctx->observe_options)) {
             VALUE args[2]; /* it's ok to pass pointer to stack struct here */
             args[0] = rb_hash_new();
@@ -86,12 +88,16 @@ storage_callback(lcb_t handle, const void *cookie, lcb_storage_t operation,
                     storage_observe_callback, (VALUE)ctx);
             cb_gc_unprotect(bucket, ctx->observe_options);
         } else if (ctx->proc != Qnil) {
-            res = rb_class_new_instance(0, NULL, cResult);
-            rb_ivar_set(res, id_iv_error, exc);
-            rb_ivar_set(res, id_iv_key, key);
-            rb_ivar_set(res, id_iv_operation, ctx->operation);
-            rb_ivar_set(res, id_iv_cas, cas);
-            cb_proc_call(ctx->proc, 1, res);
+            res = cb_result_new(ctx->operation, key, exc);
+            r = DATA_PTR(res);
+            if (ctx->error_codes) {
+                cb_result_set_status(res, error, msg);
+            }
+            if (resp->v.v0.cas > 0) {
+                r->cas = resp->v.v0.cas;
+                r->fields |= RESULT_CAS;
+            }
+            cb_context_yield(ctx, res);
         }
     } else {             /* synchronous */
         rb_hash_aset(*rv, key, cas);
@@ -99,21 +105,34 @@ storage_callback(lcb_t handle, const void *cookie, lcb_storage_t operation,
 
     if (!RTEST(ctx->observe_options)) {
         ctx->nqueries--;
+        cb_context_window_next(ctx);
         if (ctx->nqueries == 0) {
-            cb_gc_unprotect(bucket, ctx->proc);
+            cb_context_finish(ctx);
         }
     }
     (void)handle;
 }
 
+/* Fill the context and schedule the command (see cb_context_schedule()) */
+    static lcb_error_t
+do_schedule(struct schedule_st *sched)
+{
+    struct params_st *params = sched->params;
+    struct context_st *ctx = sched->ctx;
+
+    ctx->nqueries = params->cmd.store.num;
+    return lcb_store(params->bucket->handle, cb_context_cookie(ctx),
+            params->cmd.store.num, params->cmd.store.ptr);
+}
+
     static inline VALUE
 cb_bucket_store(lcb_storage_t cmd, int argc, VALUE *argv, VALUE self)
 {
     struct bucket_st *bucket = DATA_PTR(self);
     struct context_st *ctx;
     VALUE args, rv, proc, exc, obs = Qnil;
-    lcb_error_t err;
     struct params_st params;
+    struct schedule_st sched;
 
     if (bucket->handle == NULL) {
         rb_raise(eConnectError, "closed connection");
@@ -126,37 +145,26 @@ cb_bucket_store(lcb_storage_t cmd, int argc, VALUE *argv, VALUE self)
     params.type = cmd_store;
     params.bucket = bucket;
     params.cmd.store.operation = cmd;
-    cb_params_build(&params, RARRAY_LEN(args), args);
-    ctx = xcalloc(1, sizeof(struct context_st));
-    if (ctx == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for context");
-    }
     rv = rb_hash_new();
-    ctx->rv = &rv;
-    ctx->bucket = bucket;
-    ctx->proc = cb_gc_protect(bucket, proc);
-    ctx->observe_options = cb_gc_protect(bucket, obs);
-    ctx->exception = Qnil;
-    ctx->nqueries = params.cmd.store.num;
-    err = lcb_store(bucket->handle, (const void *)ctx,
-            params.cmd.store.num, params.cmd.store.ptr);
-    cb_params_destroy(&params);
-    exc = cb_check_error(err, "failed to schedule set request", Qnil);
-    if (exc != Qnil) {
-        xfree(ctx);
-        rb_exc_raise(exc);
-    }
+    cb_params_build(&params, RARRAY_LEN(args), args);
+    sched.bucket = bucket;
+    sched.params = &params;
+    sched.proc = proc;
+    sched.rv = &rv;
+    ctx = cb_context_schedule(&sched, do_schedule, "failed to schedule set request", Qnil);
     bucket->nbytes += params.npayload;
+    ctx->window_size = ctx->nqueries;
+    cb_context_window_next(ctx);
     if (bucket->async) {
         maybe_do_loop(bucket);
         return Qnil;
     } else {
         if (ctx->nqueries > 0) {
             /* we have some operations pending */
-            lcb_wait(bucket->handle);
+            cb_wait(bucket, ctx);
         }
         exc = ctx->exception;
-        xfree(ctx);
+        cb_context_free(ctx);
         if (exc != Qnil) {
             cb_gc_unprotect(bucket, exc);
             rb_exc_raise(exc);
@@ -197,6 +205,9 @@ cb_bucket_store(lcb_storage_t cmd, int argc, VALUE *argv, VALUE self)
  *   @option options [Symbol] :format (self.default_format) The
  *     representation for storing the value in the bucket. For more info see
  *     {Bucket#default_format}.
+ *   @option options [true, false] :encoded (false) The values are Strings
+ *     encoded in the +:format+ already (e.g. JSON text for +:document+),
+ *     they are stored as is, with the flags of the format.
  *   @option options [Fixnum] :cas The CAS value for an object. This value
  *     created on the server and is guaranteed to be unique for each value of
  *     a given key. This value is used to provide simple optimistic
@@ -205,6 +216,18 @@ cb_bucket_store(lcb_storage_t cmd, int argc, VALUE *argv, VALUE self)
  *   @option options [Hash] :observe Apply persistence condition before
  *     returning result. When this option specified the library will observe
  *     given condition. See {Bucket#observe_and_wait}.
+ *   @option options [Hash, Symbol, false] :compression (self.compression)
+ *     Override compression settings of the connection for this operation.
+ *   @option options [true, false] :batch_callback (false) Yield the Array
+ *     of results once, when all keys have been stored (see {Bucket#get}).
+ *     Pass the pairs as the Hash to store several keys, e.g.
+ *     +set({"foo" => 1, "bar" => 2}, :batch_callback => true)+.
+ *   @option options [Symbol] :errors (self.errors) Report the errors as
+ *     status codes ({Result#error_code}) instead of exceptions. The
+ *     synchronous call returns +nil+ instead of CAS when the key exists
+ *     (+add+ or CAS mismatch) or is missing (+replace+, +append+,
+ *     +prepend+).
+ *     See {Bucket#initialize}.
  *
  *   @yieldparam ret [Result] the result of operation in asynchronous mode
  *     (valid attributes: +error+, +operation+, +key+).
@@ -255,6 +278,9 @@ cb_bucket_store(lcb_storage_t cmd, int argc, VALUE *argv, VALUE self)
  *
  *   @example Ensure that the key will be persisted at least on the one node
  *     c.set("foo", "bar", :observe => {:persisted => 1})
+ *
+ *   @example Store several key-value pairs with the same options
+ *     c.set({"foo" => "bar", "baz" => "qux"}, :ttl => 60)
  */
     VALUE
 cb_bucket_set(int argc, VALUE *argv, VALUE self)
@@ -289,6 +315,8 @@ cb_bucket_set(int argc, VALUE *argv, VALUE self)
  *   @option options [Hash] :observe Apply persistence condition before
  *     returning result. When this option specified the library will observe
  *     given condition. See {Bucket#observe_and_wait}.
+ *   @option options [Hash, Symbol, false] :compression (self.compression)
+ *     Override compression settings of the connection for this operation.
  *
  *   @yieldparam ret [Result] the result of operation in asynchronous mode
  *     (valid attributes: +error+, +operation+, +key+).
@@ -344,6 +372,8 @@ cb_bucket_add(int argc, VALUE *argv, VALUE self)
  *   @option options [Hash] :observe Apply persistence condition before
  *     returning result. When this option specified the library will observe
  *     given condition. See {Bucket#observe_and_wait}.
+ *   @option options [Hash, Symbol, false] :compression (self.compression)
+ *     Override compression settings of the connection for this operation.
  *
  *   @return [Fixnum] The CAS value of the object.
  *
@@ -375,7 +405,10 @@ cb_bucket_replace(int argc, VALUE *argv, VALUE self)
  *   This mean that the server treats value as binary stream and just
  *   perform concatenation, therefore it won't work with +:marshal+ and
  *   +:document+ formats, because of lack of knowledge how to merge values
- *   in these formats. See {Bucket#cas} for workaround.
+ *   in these formats. See {Bucket#cas} for workaround. For the same
+ *   reason it doesn't work with compressed values (see +:compression+
+ *   option of {Bucket#initialize}): the appended chunk is sent as is, and
+ *   reading the result raises {Couchbase::Error::ValueFormat}.
  *
  * @overload append(key, value, options = {})
  *   @param key [String, Symbol] Key used to reference the value.
@@ -455,7 +488,10 @@ cb_bucket_append(int argc, VALUE *argv, VALUE self)
  *   This mean that the server treats value as binary stream and just
  *   perform concatenation, therefore it won't work with +:marshal+ and
  *   +:document+ formats, because of lack of knowledge how to merge values
- *   in these formats. See {Bucket#cas} for workaround.
+ *   in these formats. See {Bucket#cas} for workaround. For the same
+ *   reason it doesn't work with compressed values (see +:compression+
+ *   option of {Bucket#initialize}): the prepended chunk is sent as is,
+ *   and the result cannot be decompressed anymore.
  *
  * @overload prepend(key, value, options = {})
  *   @param key [String, Symbol] Key used to reference the value.
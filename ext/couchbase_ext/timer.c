@@ -109,18 +109,36 @@ trigger_timer(VALUE timer)
     return cb_proc_call(tm->callback, 1, timer);
 }
 
-    static void
-timer_callback(lcb_timer_t timer, lcb_t instance,
-        const void *cookie)
+struct timer_callback_args_st
 {
-    struct timer_st *tm = (struct timer_st *)cookie;
+    lcb_timer_t timer;
+    lcb_t instance;
+    struct timer_st *tm;
+};
+
+    static VALUE
+do_timer_callback(VALUE ptr)
+{
+    struct timer_callback_args_st *args = (struct timer_callback_args_st *)ptr;
     int error = 0;
 
-    rb_protect(trigger_timer, tm->self, &error);
+    rb_protect(trigger_timer, args->tm->self, &error);
     if (error) {
-        lcb_timer_destroy(instance, timer);
+        lcb_timer_destroy(args->instance, args->timer);
     }
-    (void)cookie;
+    return Qnil;
+}
+
+    static void
+timer_callback(lcb_timer_t timer, lcb_t instance,
+        const void *cookie)
+{
+    struct timer_callback_args_st args;
+
+    args.timer = timer;
+    args.instance = instance;
+    args.tm = (struct timer_st *)cookie;
+    cb_invoke_callback(instance, do_timer_callback, (VALUE)&args);
 }
 
 /*
@@ -180,6 +198,7 @@ cb_timer_init(int argc, VALUE *argv, VALUE self)
         Check_Type(opts, T_HASH);
         tm->periodic = RTEST(rb_hash_aref(opts, sym_periodic));
     }
+    cb_wait_idle(tm->bucket);
     tm->timer = lcb_timer_create(tm->bucket->handle, tm, tm->usec,
             tm->periodic, timer_callback, &err);
     exc = cb_check_error(err, "failed to attach the timer", Qnil);
@@ -22,14 +22,14 @@ touch_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_to
 {
     struct context_st *ctx = (struct context_st *)cookie;
     struct bucket_st *bucket = ctx->bucket;
+    const char *msg = "failed to touch value";
     VALUE key, *rv = ctx->rv, exc = Qnil, res;
 
     ctx->nqueries--;
-    key = STR_NEW((const char*)resp->v.v0.key, resp->v.v0.nkey);
-    strip_key_prefix(bucket, key);
+    key = cb_context_key(ctx, (const char*)resp->v.v0.key, resp->v.v0.nkey);
 
     if (error != LCB_KEY_ENOENT || !ctx->quiet) {
-        exc = cb_check_error(error, "failed to touch value", key);
+        exc = cb_context_check_error(ctx, error, msg, key);
         if (exc != Qnil) {
             rb_ivar_set(exc, id_iv_operation, sym_touch);
             if (NIL_P(ctx->exception)) {
@@ -38,23 +38,37 @@ touch_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_to
         }
     }
 
-    if (bucket->async) {    /* asynchronous */
+    if (ctx->async) {    /* asynchronous */
         if (ctx->proc != Qnil) {
-            res = rb_class_new_instance(0, NULL, cResult);
-            rb_ivar_set(res, id_iv_error, exc);
-            rb_ivar_set(res, id_iv_operation, sym_touch);
-            rb_ivar_set(res, id_iv_key, key);
-            cb_proc_call(ctx->proc, 1, res);
+            res = cb_result_new(sym_touch, key, exc);
+            if (ctx->error_codes) {
+                cb_result_set_status(res, error, msg);
+            }
+            cb_context_yield(ctx, res);
         }
     } else {                /* synchronous */
         rb_hash_aset(*rv, key, (error == LCB_SUCCESS) ? Qtrue : Qfalse);
     }
+    cb_context_window_next(ctx);
     if (ctx->nqueries == 0) {
-        cb_gc_unprotect(bucket, ctx->proc);
+        cb_context_finish(ctx);
     }
     (void)handle;
 }
 
+/* Fill the context and schedule the command (see cb_context_schedule()) */
+    static lcb_error_t
+do_schedule(struct schedule_st *sched)
+{
+    struct params_st *params = sched->params;
+    struct context_st *ctx = sched->ctx;
+
+    ctx->quiet = params->cmd.touch.quiet;
+    ctx->nqueries = params->cmd.touch.num;
+    return lcb_touch(params->bucket->handle, cb_context_cookie(ctx),
+            params->cmd.touch.num, params->cmd.touch.ptr);
+}
+
 /*
  * Update the expiry time of an item
  *
@@ -75,6 +89,11 @@ touch_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_to
  *     absolute times (from the epoch).
  *   @option options [true, false] :quiet (self.quiet) If set to +true+, the
  *     operation won't raise error for missing key, it will return +nil+.
+ *   @option options [true, false] :batch_callback (false) Yield the Array
+ *     of results once, when all keys have been touched (see {Bucket#get}).
+ *   @option options [Symbol] :errors (self.errors) Report the errors as
+ *     status codes ({Result#error_code}) instead of exceptions. See
+ *     {Bucket#initialize}.
  *
  *   @yieldparam ret [Result] the result of operation in asynchronous mode
  *     (valid attributes: +error+, +operation+, +key+).
@@ -126,8 +145,8 @@ cb_bucket_touch(int argc, VALUE *argv, VALUE self)
     struct bucket_st *bucket = DATA_PTR(self);
     struct context_st *ctx;
     VALUE args, rv, proc, exc;
-    lcb_error_t err;
     struct params_st params;
+    struct schedule_st sched;
 
     if (bucket->handle == NULL) {
         rb_raise(eConnectError, "closed connection");
@@ -140,37 +159,26 @@ cb_bucket_touch(int argc, VALUE *argv, VALUE self)
     memset(&params, 0, sizeof(struct params_st));
     params.type = cmd_touch;
     params.bucket = bucket;
-    cb_params_build(&params, RARRAY_LEN(args), args);
-    ctx = xcalloc(1, sizeof(struct context_st));
-    if (ctx == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for context");
-    }
-    ctx->proc = cb_gc_protect(bucket, proc);
-    ctx->bucket = bucket;
     rv = rb_hash_new();
-    ctx->rv = &rv;
-    ctx->exception = Qnil;
-    ctx->quiet = params.cmd.touch.quiet;
-    ctx->nqueries = params.cmd.touch.num;
-    err = lcb_touch(bucket->handle, (const void *)ctx,
-            params.cmd.touch.num, params.cmd.touch.ptr);
-    cb_params_destroy(&params);
-    exc = cb_check_error(err, "failed to schedule touch request", Qnil);
-    if (exc != Qnil) {
-        xfree(ctx);
-        rb_exc_raise(exc);
-    }
+    cb_params_build(&params, RARRAY_LEN(args), args);
+    sched.bucket = bucket;
+    sched.params = &params;
+    sched.proc = proc;
+    sched.rv = &rv;
+    ctx = cb_context_schedule(&sched, do_schedule, "failed to schedule touch request", Qnil);
     bucket->nbytes += params.npayload;
+    ctx->window_size = ctx->nqueries;
+    cb_context_window_next(ctx);
     if (bucket->async) {
         maybe_do_loop(bucket);
         return Qnil;
     } else {
         if (ctx->nqueries > 0) {
             /* we have some operations pending */
-            lcb_wait(bucket->handle);
+            cb_wait(bucket, ctx);
         }
         exc = ctx->exception;
-        xfree(ctx);
+        cb_context_free(ctx);
         if (exc != Qnil) {
             rb_exc_raise(cb_gc_unprotect(bucket, exc));
         }
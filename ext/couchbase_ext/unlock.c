@@ -22,14 +22,14 @@ unlock_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_u
 {
     struct context_st *ctx = (struct context_st *)cookie;
     struct bucket_st *bucket = ctx->bucket;
+    const char *msg = "failed to unlock value";
     VALUE key, *rv = ctx->rv, exc = Qnil, res;
 
     ctx->nqueries--;
-    key = STR_NEW((const char*)resp->v.v0.key, resp->v.v0.nkey);
-    strip_key_prefix(bucket, key);
+    key = cb_context_key(ctx, (const char*)resp->v.v0.key, resp->v.v0.nkey);
 
     if (error != LCB_KEY_ENOENT || !ctx->quiet) {
-        exc = cb_check_error(error, "failed to unlock value", key);
+        exc = cb_context_check_error(ctx, error, msg, key);
         if (exc != Qnil) {
             rb_ivar_set(exc, id_iv_operation, sym_unlock);
             if (NIL_P(ctx->exception)) {
@@ -38,23 +38,36 @@ unlock_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_u
         }
     }
 
-    if (bucket->async) {    /* asynchronous */
+    if (ctx->async) {    /* asynchronous */
         if (ctx->proc != Qnil) {
-            res = rb_class_new_instance(0, NULL, cResult);
-            rb_ivar_set(res, id_iv_error, exc);
-            rb_ivar_set(res, id_iv_operation, sym_unlock);
-            rb_ivar_set(res, id_iv_key, key);
-            cb_proc_call(ctx->proc, 1, res);
+            res = cb_result_new(sym_unlock, key, exc);
+            if (ctx->error_codes) {
+                cb_result_set_status(res, error, msg);
+            }
+            cb_context_yield(ctx, res);
         }
     } else {                /* synchronous */
         rb_hash_aset(*rv, key, (error == LCB_SUCCESS) ? Qtrue : Qfalse);
     }
     if (ctx->nqueries == 0) {
-        cb_gc_unprotect(bucket, ctx->proc);
+        cb_context_finish(ctx);
     }
     (void)handle;
 }
 
+/* Fill the context and schedule the command (see cb_context_schedule()) */
+    static lcb_error_t
+do_schedule(struct schedule_st *sched)
+{
+    struct params_st *params = sched->params;
+    struct context_st *ctx = sched->ctx;
+
+    ctx->quiet = params->cmd.unlock.quiet;
+    ctx->nqueries = params->cmd.unlock.num;
+    return lcb_unlock(params->bucket->handle, cb_context_cookie(ctx),
+            params->cmd.unlock.num, params->cmd.unlock.ptr);
+}
+
 /*
  * Unlock key
  *
@@ -70,6 +83,9 @@ unlock_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_u
  *     from the storage.
  *   @option options [true, false] :quiet (self.quiet) If set to +true+, the
  *     operation won't raise error for missing key, it will return +nil+.
+ *   @option options [Symbol] :errors (self.errors) Report the errors as
+ *     status codes ({Result#error_code}) instead of exceptions. See
+ *     {Bucket#initialize}.
  *
  *   @return [true, false] +true+ if the operation was successful and +false+
  *     otherwise.
@@ -116,8 +132,8 @@ cb_bucket_unlock(int argc, VALUE *argv, VALUE self)
     struct bucket_st *bucket = DATA_PTR(self);
     struct context_st *ctx;
     VALUE args, rv, proc, exc;
-    lcb_error_t err;
     struct params_st params;
+    struct schedule_st sched;
 
     if (bucket->handle == NULL) {
         rb_raise(eConnectError, "closed connection");
@@ -130,26 +146,13 @@ cb_bucket_unlock(int argc, VALUE *argv, VALUE self)
     memset(&params, 0, sizeof(struct params_st));
     params.type = cmd_unlock;
     params.bucket = bucket;
-    cb_params_build(&params, RARRAY_LEN(args), args);
-    ctx = xcalloc(1, sizeof(struct context_st));
-    if (ctx == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for context");
-    }
-    ctx->proc = cb_gc_protect(bucket, proc);
-    ctx->bucket = bucket;
     rv = rb_hash_new();
-    ctx->rv = &rv;
-    ctx->exception = Qnil;
-    ctx->quiet = params.cmd.unlock.quiet;
-    ctx->nqueries = params.cmd.unlock.num;
-    err = lcb_unlock(bucket->handle, (const void *)ctx,
-            params.cmd.unlock.num, params.cmd.unlock.ptr);
-    cb_params_destroy(&params);
-    exc = cb_check_error(err, "failed to schedule unlock request", Qnil);
-    if (exc != Qnil) {
-        xfree(ctx);
-        rb_exc_raise(exc);
-    }
+    cb_params_build(&params, RARRAY_LEN(args), args);
+    sched.bucket = bucket;
+    sched.params = &params;
+    sched.proc = proc;
+    sched.rv = &rv;
+    ctx = cb_context_schedule(&sched, do_schedule, "failed to schedule unlock request", Qnil);
     bucket->nbytes += params.npayload;
     if (bucket->async) {
         maybe_do_loop(bucket);
@@ -157,10 +160,10 @@ cb_bucket_unlock(int argc, VALUE *argv, VALUE self)
     } else {
         if (ctx->nqueries > 0) {
             /* we have some operations pending */
-            lcb_wait(bucket->handle);
+            cb_wait(bucket, ctx);
         }
         exc = ctx->exception;
-        xfree(ctx);
+        cb_context_free(ctx);
         if (exc != Qnil) {
             rb_exc_raise(cb_gc_unprotect(bucket, exc));
         }
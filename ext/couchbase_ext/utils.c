@@ -17,47 +17,164 @@
 
 #include "couchbase_ext.h"
 
+/* The object space is the open addressing hash set of the objects which
+ * should survive GC while the operations are in flight. Empty slots are
+ * zero (Qfalse), removed ones are Qundef, so that special constants are
+ * never stored in the table. */
+#define OBJECT_SPACE_MIN_CAPACITY 64
+#define OBJECT_SPACE_TOMBSTONE Qundef
+
+    static size_t
+object_space_slot(VALUE val, size_t mask)
+{
+    /* the objects are aligned, shift out low bits before mixing */
+    return (size_t)(((uint64_t)(val >> 3) * 0x9E3779B97F4A7C15ULL) >> 17) & mask;
+}
+
+    static void
+object_space_insert(struct object_space_st *os, VALUE val)
+{
+    size_t mask = os->capacity - 1, ii = object_space_slot(val, mask);
+    size_t tombstone = os->capacity;
+
+    while (os->slots[ii] != 0) {
+        if (os->slots[ii] == val) {
+            return;
+        }
+        if (os->slots[ii] == OBJECT_SPACE_TOMBSTONE && tombstone == os->capacity) {
+            tombstone = ii;
+        }
+        ii = (ii + 1) & mask;
+    }
+    if (tombstone != os->capacity) {
+        ii = tombstone;
+    } else {
+        os->used++;
+    }
+    os->slots[ii] = val;
+    os->size++;
+}
+
+    static void
+object_space_resize(struct object_space_st *os, size_t capacity)
+{
+    VALUE *old = os->slots;
+    size_t ii, old_capacity = os->capacity;
+
+    os->slots = xcalloc(capacity, sizeof(VALUE));
+    if (os->slots == NULL) {
+        os->slots = old;
+        rb_raise(eClientNoMemoryError, "failed to allocate memory for object space");
+    }
+    os->capacity = capacity;
+    os->size = os->used = 0;
+    for (ii = 0; ii < old_capacity; ++ii) {
+        if (old[ii] != 0 && old[ii] != OBJECT_SPACE_TOMBSTONE) {
+            object_space_insert(os, old[ii]);
+        }
+    }
+    xfree(old);
+}
+
     VALUE
 cb_gc_protect(struct bucket_st *bucket, VALUE val)
 {
-    rb_hash_aset(bucket->object_space, val|1, val);
+    struct object_space_st *os = &bucket->object_space;
+
+    if (SPECIAL_CONST_P(val)) {
+        return val;
+    }
+    /* keep load factor (including removed slots) below 1/2, the table
+     * is rehashed when it is filled by removed slots */
+    if ((os->used + 1) * 2 > os->capacity) {
+        size_t capacity = os->capacity ? os->capacity : OBJECT_SPACE_MIN_CAPACITY;
+        while ((os->size + 1) * 2 > capacity) {
+            capacity *= 2;
+        }
+        object_space_resize(os, capacity);
+    }
+    object_space_insert(os, val);
     return val;
 }
 
     VALUE
 cb_gc_unprotect(struct bucket_st *bucket, VALUE val)
 {
-    rb_funcall(bucket->object_space, id_delete, 1, val|1);
+    struct object_space_st *os = &bucket->object_space;
+    size_t mask, ii;
+
+    if (SPECIAL_CONST_P(val) || os->size == 0) {
+        return val;
+    }
+    mask = os->capacity - 1;
+    ii = object_space_slot(val, mask);
+    while (os->slots[ii] != 0) {
+        if (os->slots[ii] == val) {
+            os->slots[ii] = OBJECT_SPACE_TOMBSTONE;
+            os->size--;
+            break;
+        }
+        ii = (ii + 1) & mask;
+    }
     return val;
 }
 
+    void
+cb_gc_mark_protected(struct bucket_st *bucket)
+{
+    struct object_space_st *os = &bucket->object_space;
+    size_t ii;
+
+    for (ii = 0; ii < os->capacity; ++ii) {
+        if (os->slots[ii] != 0 && os->slots[ii] != OBJECT_SPACE_TOMBSTONE) {
+            rb_gc_mark(os->slots[ii]);
+        }
+    }
+}
+
+    int
+cb_proc_arity(VALUE recv)
+{
+    return FIX2INT(rb_funcall(recv, id_arity, 0));
+}
+
+/* Call the proc passing exactly +arity+ arguments: the extra arguments are
+ * dropped, the missing ones are filled with +nil+ */
+    VALUE
+cb_proc_call_argv(VALUE recv, int arity, int argc, VALUE *argv)
+{
+    VALUE *args;
+    int ii;
+
+    if (arity < 0 || arity == argc) {
+        return rb_funcall2(recv, id_call, argc, argv);
+    }
+    if (arity == 0) {
+        return rb_funcall2(recv, id_call, 0, NULL);
+    }
+    args = ALLOCA_N(VALUE, arity);
+    for (ii = 0; ii < arity; ++ii) {
+        args[ii] = ii < argc ? argv[ii] : Qnil;
+    }
+    return rb_funcall2(recv, id_call, arity, args);
+}
+
     VALUE
 cb_proc_call(VALUE recv, int argc, ...)
 {
-    VALUE *argv;
+    VALUE *argv = NULL;
     va_list ar;
-    int arity;
     int ii;
 
-    arity = FIX2INT(rb_funcall(recv, id_arity, 0));
-    if (arity < 0) {
-        arity = argc;
-    }
-    if (arity > 0) {
+    if (argc > 0) {
         va_init_list(ar, argc);
         argv = ALLOCA_N(VALUE, argc);
-        for (ii = 0; ii < arity; ++ii) {
-            if (ii < argc) {
-                argv[ii] = va_arg(ar, VALUE);
-            } else {
-                argv[ii] = Qnil;
-            }
+        for (ii = 0; ii < argc; ++ii) {
+            argv[ii] = va_arg(ar, VALUE);
         }
         va_end(ar);
-    } else {
-        argv = NULL;
     }
-    return rb_funcall2(recv, id_call, arity, argv);
+    return cb_proc_call_argv(recv, cb_proc_arity(recv), argc, argv);
 }
 
 VALUE
@@ -275,6 +392,89 @@ cb_check_error(lcb_error_t rc, const char *msg, VALUE key)
     return cb_check_error_with_status(rc, msg, key, 0);
 }
 
+/* Returns nonzero if the error describes the state of the key rather than
+ * failure of the library or the cluster */
+    int
+cb_error_key_status_p(lcb_error_t rc)
+{
+    switch (rc) {
+        case LCB_KEY_ENOENT:
+        case LCB_KEY_EEXISTS:
+        case LCB_NOT_STORED:
+        case LCB_DELTA_BADVAL:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* The names of error codes, reported by Result#error_code. The symbols
+ * are interned on first use */
+static struct {
+    lcb_error_t rc;
+    const char *name;
+    ID id;
+} error_codes[] = {
+    {LCB_SUCCESS, "success", 0},
+    {LCB_AUTH_CONTINUE, "success", 0},
+    {LCB_KEY_ENOENT, "not_found", 0},
+    {LCB_KEY_EEXISTS, "key_exists", 0},
+    {LCB_NOT_STORED, "not_stored", 0},
+    {LCB_DELTA_BADVAL, "delta_badval", 0},
+    {LCB_E2BIG, "too_big", 0},
+    {LCB_ETMPFAIL, "tmp_fail", 0},
+    {LCB_ETIMEDOUT, "timeout", 0},
+    {LCB_EBUSY, "busy", 0},
+    {LCB_NOT_MY_VBUCKET, "not_my_vbucket", 0},
+    {LCB_NETWORK_ERROR, "network", 0},
+    {LCB_CONNECT_ERROR, "connect", 0},
+    {LCB_AUTH_ERROR, "auth", 0},
+    {LCB_ENOMEM, "no_memory", 0},
+    {LCB_CLIENT_ENOMEM, "client_no_memory", 0},
+    {LCB_ERANGE, "range", 0},
+    {LCB_EINVAL, "invalid", 0},
+    {LCB_EINTERNAL, "internal", 0},
+    {LCB_NOT_SUPPORTED, "not_supported", 0},
+    {LCB_UNKNOWN_COMMAND, "unknown_command", 0},
+    {LCB_UNKNOWN_HOST, "unknown_host", 0},
+    {LCB_PROTOCOL_ERROR, "protocol", 0},
+    {LCB_BUCKET_ENOENT, "bucket_not_found", 0},
+    {LCB_LIBEVENT_ERROR, "libevent", 0},
+    {LCB_ERROR, "error", 0}
+};
+
+    VALUE
+cb_error_code_get(lcb_error_t rc)
+{
+    size_t ii, nn = sizeof(error_codes) / sizeof(error_codes[0]);
+
+    for (ii = 0; ii < nn; ++ii) {
+        if (error_codes[ii].rc == rc) {
+            break;
+        }
+    }
+    if (ii == nn) {
+        ii = nn - 1;    /* LCB_ERROR */
+    }
+    if (error_codes[ii].id == 0) {
+        error_codes[ii].id = rb_intern(error_codes[ii].name);
+    }
+    return ID2SYM(error_codes[ii].id);
+}
+
+/* Accepts +:exceptions+ or +:codes+, returns nonzero for the latter */
+    int
+cb_errors_parse(VALUE arg)
+{
+    if (arg == sym_codes) {
+        return 1;
+    } else if (arg == sym_exceptions) {
+        return 0;
+    }
+    rb_raise(rb_eArgError, "errors mode should be :exceptions or :codes");
+    return 0;
+}
+
 
     uint32_t
 flags_set_format(uint32_t flags, ID format)
@@ -360,6 +560,15 @@ do_decode(VALUE *args)
     }
 }
 
+    static inline int
+document_format_p(uint32_t flags, VALUE force_format)
+{
+    if (TYPE(force_format) == T_SYMBOL) {
+        return force_format == sym_document;
+    }
+    return (flags & FMT_MASK) == FMT_DOCUMENT;
+}
+
     static VALUE
 coding_failed(void)
 {
@@ -371,6 +580,13 @@ encode_value(VALUE val, uint32_t flags)
 {
     VALUE blob, args[2];
 
+    if ((flags & FMT_MASK) == FMT_DOCUMENT && cb_json_backend == sym_native) {
+        blob = cb_json_encode(val);
+        if (blob != Qundef) {
+            return blob;
+        }
+        /* unknown objects, pass them to MultiJson */
+    }
     args[0] = val;
     args[1] = (VALUE)flags;
     /* FIXME re-raise proper exception */
@@ -382,14 +598,14 @@ encode_value(VALUE val, uint32_t flags)
     return blob;
 }
 
-    VALUE
-decode_value(VALUE blob, uint32_t flags, VALUE force_format)
+/* Decode the String, which is known to be uncompressed */
+    static VALUE
+do_decode_plain(VALUE blob, uint32_t flags, VALUE force_format)
 {
     VALUE val, args[3];
 
-    /* first it must be bytestring */
-    if (TYPE(blob) != T_STRING) {
-        return Qundef;
+    if (cb_json_backend == sym_native && document_format_p(flags, force_format)) {
+        return cb_json_decode(RSTRING_PTR(blob), RSTRING_LEN(blob));
     }
     args[0] = blob;
     args[1] = (VALUE)flags;
@@ -398,11 +614,108 @@ decode_value(VALUE blob, uint32_t flags, VALUE force_format)
     return val;
 }
 
-    void
-strip_key_prefix(struct bucket_st *bucket, VALUE key)
+    VALUE
+decode_value(VALUE blob, uint32_t flags, VALUE force_format, int encoding)
 {
-    if (bucket->key_prefix) {
-        rb_str_update(key, 0, RSTRING_LEN(bucket->key_prefix_val), STR_NEW_CSTR(""));
+    /* first it must be bytestring */
+    if (TYPE(blob) != T_STRING) {
+        return Qundef;
+    }
+    if (cb_compressed_p(RSTRING_PTR(blob), RSTRING_LEN(blob))) {
+        return decode_bytes(RSTRING_PTR(blob), RSTRING_LEN(blob), flags, force_format, encoding);
+    }
+    return do_decode_plain(blob, flags, force_format);
+}
+
+/* Same as decode_value(), but the built-in JSON decoder reads the
+ * response buffer directly, without intermediate String */
+    VALUE
+decode_bytes(const char *bytes, size_t nbytes, uint32_t flags, VALUE force_format, int encoding)
+{
+    if (cb_compressed_p(bytes, nbytes)) {
+        VALUE raw = cb_decompress_value(bytes, nbytes);
+
+        /* the algorithm is unavailable or the payload is corrupted (e.g.
+         * by append), the caller reports it as ValueFormat error */
+        if (NIL_P(raw) || raw == Qundef) {
+            return Qundef;
+        }
+        /* the buffer is ours, so it isn't copied again */
+        return do_decode_plain(cb_str_associate(raw, encoding), flags, force_format);
+    }
+    if (cb_json_backend == sym_native && document_format_p(flags, force_format)) {
+        return cb_json_decode(bytes, nbytes);
+    }
+    return do_decode_plain(cb_str_new(encoding, bytes, nbytes), flags, force_format);
+}
+
+/* Build String for the bytes received from the server according to the
+ * :encoding option of the connection. Unlike rb_external_str_new(), the
+ * UTF-8 and binary modes never transcode the data */
+    VALUE
+cb_str_new(int encoding, const char *ptr, size_t len)
+{
+#ifdef HAVE_RUBY_ENCODING_H
+    switch (encoding) {
+        case ENCODING_BINARY:
+            return rb_str_new(ptr, len);
+        case ENCODING_UTF8:
+            return rb_enc_str_new(ptr, len, rb_utf8_encoding());
+        default:
+            return rb_external_str_new(ptr, len);
+    }
+#else
+    (void)encoding;
+    return rb_str_new(ptr, len);
+#endif
+}
+
+/* Set the encoding of the binary String built by the library (e.g. the
+ * decompressed value) */
+    VALUE
+cb_str_associate(VALUE str, int encoding)
+{
+#ifdef HAVE_RUBY_ENCODING_H
+    switch (encoding) {
+        case ENCODING_BINARY:
+            break;
+        case ENCODING_UTF8:
+            rb_enc_associate(str, rb_utf8_encoding());
+            break;
+        default:
+            rb_enc_associate(str, rb_default_external_encoding());
+    }
+#else
+    (void)encoding;
+#endif
+    return str;
+}
+
+/* Accepts +:external+, +:utf8+ or +:binary+ */
+    int
+cb_encoding_parse(VALUE arg)
+{
+    if (arg == sym_external) {
+        return ENCODING_EXTERNAL;
+    } else if (arg == sym_utf8) {
+        return ENCODING_UTF8;
+    } else if (arg == sym_binary) {
+        return ENCODING_BINARY;
+    }
+    rb_raise(rb_eArgError, "encoding should be :external, :utf8 or :binary");
+    return ENCODING_EXTERNAL;
+}
+
+    VALUE
+cb_encoding_get(int encoding)
+{
+    switch (encoding) {
+        case ENCODING_BINARY:
+            return sym_binary;
+        case ENCODING_UTF8:
+            return sym_utf8;
+        default:
+            return sym_external;
     }
 }
 
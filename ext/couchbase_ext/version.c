@@ -23,6 +23,7 @@ version_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_
     struct context_st *ctx = (struct context_st *)cookie;
     struct bucket_st *bucket = ctx->bucket;
     VALUE node, val, *rv = ctx->rv, exc, res;
+    struct result_st *r;
 
     node = resp->v.v0.server_endpoint ? STR_NEW_CSTR(resp->v.v0.server_endpoint) : Qnil;
     exc = cb_check_error(error, "failed to get version", node);
@@ -35,14 +36,13 @@ version_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_
 
     if (node != Qnil) {
         val = STR_NEW((const char*)resp->v.v0.vstring, resp->v.v0.nvstring);
-        if (bucket->async) {    /* asynchronous */
+        if (ctx->async) {    /* asynchronous */
             if (ctx->proc != Qnil) {
-                res = rb_class_new_instance(0, NULL, cResult);
-                rb_ivar_set(res, id_iv_error, exc);
-                rb_ivar_set(res, id_iv_operation, sym_version);
-                rb_ivar_set(res, id_iv_node, node);
-                rb_ivar_set(res, id_iv_value, val);
-                cb_proc_call(ctx->proc, 1, res);
+                res = cb_result_new(sym_version, Qnil, exc);
+                r = DATA_PTR(res);
+                r->node = node;
+                r->value = val;
+                cb_context_yield(ctx, res);
             }
         } else {                /* synchronous */
             if (NIL_P(exc)) {
@@ -51,12 +51,26 @@ version_callback(lcb_t handle, const void *cookie, lcb_error_t error, const lcb_
         }
     } else {
         ctx->nqueries--;
-        cb_gc_unprotect(bucket, ctx->proc);
+        if (ctx->nqueries == 0) {
+            cb_context_finish(ctx);
+        }
     }
 
     (void)handle;
 }
 
+/* Fill the context and schedule the command (see cb_context_schedule()) */
+    static lcb_error_t
+do_schedule(struct schedule_st *sched)
+{
+    struct params_st *params = sched->params;
+    struct context_st *ctx = sched->ctx;
+
+    ctx->nqueries = params->cmd.version.num;
+    return lcb_server_versions(params->bucket->handle, cb_context_cookie(ctx),
+            params->cmd.version.num, params->cmd.version.ptr);
+}
+
 /*
  * Returns versions of the server for each node in the cluster
  *
@@ -90,8 +104,8 @@ cb_bucket_version(int argc, VALUE *argv, VALUE self)
     struct bucket_st *bucket = DATA_PTR(self);
     struct context_st *ctx;
     VALUE rv, exc, args, proc;
-    lcb_error_t err;
     struct params_st params;
+    struct schedule_st sched;
 
     if (bucket->handle == NULL) {
         rb_raise(eConnectError, "closed connection");
@@ -103,25 +117,13 @@ cb_bucket_version(int argc, VALUE *argv, VALUE self)
     memset(&params, 0, sizeof(struct params_st));
     params.type = cmd_version;
     params.bucket = bucket;
-    cb_params_build(&params, RARRAY_LEN(args), args);
-    ctx = xcalloc(1, sizeof(struct context_st));
-    if (ctx == NULL) {
-        rb_raise(eClientNoMemoryError, "failed to allocate memory for context");
-    }
     rv = rb_hash_new();
-    ctx->rv = &rv;
-    ctx->bucket = bucket;
-    ctx->exception = Qnil;
-    ctx->proc = cb_gc_protect(bucket, proc);
-    ctx->nqueries = params.cmd.version.num;
-    err = lcb_server_versions(bucket->handle, (const void *)ctx,
-            params.cmd.version.num, params.cmd.version.ptr);
-    exc = cb_check_error(err, "failed to schedule version request", Qnil);
-    cb_params_destroy(&params);
-    if (exc != Qnil) {
-        xfree(ctx);
-        rb_exc_raise(exc);
-    }
+    cb_params_build(&params, RARRAY_LEN(args), args);
+    sched.bucket = bucket;
+    sched.params = &params;
+    sched.proc = proc;
+    sched.rv = &rv;
+    ctx = cb_context_schedule(&sched, do_schedule, "failed to schedule version request", Qnil);
     bucket->nbytes += params.npayload;
     if (bucket->async) {
         maybe_do_loop(bucket);
@@ -129,10 +131,10 @@ cb_bucket_version(int argc, VALUE *argv, VALUE self)
     } else {
         if (ctx->nqueries > 0) {
             /* we have some operations pending */
-            lcb_wait(bucket->handle);
+            cb_wait(bucket, ctx);
         }
         exc = ctx->exception;
-        xfree(ctx);
+        cb_context_free(ctx);
         if (exc != Qnil) {
             cb_gc_unprotect(bucket, exc);
             rb_exc_raise(exc);
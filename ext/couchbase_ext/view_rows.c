@@ -0,0 +1,261 @@
+/* vim: ft=c et ts=8 sts=4 sw=4 cino=
+ *
+ *   Copyright 2011, 2012 Couchbase, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "couchbase_ext.h"
+
+/* Incremental splitter of the view response. It picks the objects of
+ * "rows" and "errors" arrays and the value of "total_rows" from the body
+ * as the chunks arrive. Only the nesting and the strings are tracked by
+ * the scanner, the items are decoded by the built-in codec (see json.c).
+ * When MultiJson backend is selected, or the codec can't decode the item,
+ * it is passed as the String with raw JSON. */
+
+    struct view_rows_st *
+cb_view_rows_alloc(void)
+{
+    struct view_rows_st *rows;
+
+    rows = xcalloc(1, sizeof(struct view_rows_st));
+    if (rows == NULL) {
+        rb_raise(eClientNoMemoryError, "failed to allocate memory for view parser");
+    }
+    rows->buf = Qnil;
+    return rows;
+}
+
+    void
+cb_view_rows_free(struct view_rows_st *rows)
+{
+    xfree(rows);
+}
+
+    static void
+rows_key_append(struct view_rows_st *rows, const char *ptr, size_t len)
+{
+    if (!rows->reading_key) {
+        return;
+    }
+    if (rows->nkey + len > sizeof(rows->key)) {
+        /* too long for interesting keys */
+        rows->nkey = sizeof(rows->key);
+        return;
+    }
+    memcpy(rows->key + rows->nkey, ptr, len);
+    rows->nkey += len;
+}
+
+    static int
+rows_section(struct view_rows_st *rows)
+{
+    if (rows->nkey == 4 && memcmp(rows->key, "rows", 4) == 0) {
+        return VIEW_SECTION_ROWS;
+    } else if (rows->nkey == 6 && memcmp(rows->key, "errors", 6) == 0) {
+        return VIEW_SECTION_ERRORS;
+    } else if (rows->nkey == 10 && memcmp(rows->key, "total_rows", 10) == 0) {
+        return VIEW_SECTION_TOTAL_ROWS;
+    }
+    return VIEW_SECTION_NONE;
+}
+
+    static void
+rows_emit(struct view_rows_st *rows, VALUE items, const char *ptr, size_t len)
+{
+    VALUE kind, obj = Qundef;
+
+    if (rows->buf != Qnil && RSTRING_LEN(rows->buf) > 0) {
+        /* the beginning has been received in previous chunks */
+        rb_str_cat(rows->buf, ptr, len);
+        ptr = RSTRING_PTR(rows->buf);
+        len = RSTRING_LEN(rows->buf);
+    }
+    if (cb_json_backend == sym_native) {
+        obj = cb_json_decode(ptr, len);
+    }
+    if (obj == Qundef) {
+        obj = cb_str_new(ENCODING_UTF8, ptr, len);
+    }
+    switch (rows->section) {
+        case VIEW_SECTION_ROWS:
+            kind = sym_rows;
+            break;
+        case VIEW_SECTION_ERRORS:
+            kind = sym_errors;
+            break;
+        default:
+            kind = sym_total_rows;
+    }
+    rb_ary_push(items, rb_assoc_new(kind, obj));
+    if (rows->buf != Qnil) {
+        rb_str_set_len(rows->buf, 0);
+    }
+    rows->capturing = 0;
+}
+
+/* Feed the next chunk of the body. Returns the Array of [kind, item]
+ * pairs completed by this chunk, where kind is +:rows+, +:errors+ or
+ * +:total_rows+ */
+    VALUE
+cb_view_rows_feed(struct view_rows_st *rows, const char *ptr, size_t len)
+{
+    const char *end = ptr + len, *start = ptr, *quote, *slash;
+    VALUE items = rb_ary_new();
+
+    while (ptr < end) {
+        if (rows->in_string) {
+            if (rows->escape) {
+                rows->escape = 0;
+                ++ptr;
+                continue;
+            }
+            /* the strings take the most of the body, and memchr() is
+             * vectorized by the libc on most platforms */
+            quote = memchr(ptr, '"', end - ptr);
+            slash = memchr(ptr, '\\', (quote ? quote : end) - ptr);
+            if (slash) {
+                if (rows->reading_key) {
+                    /* escaped keys aren't interesting */
+                    rows->nkey = sizeof(rows->key);
+                }
+                ptr = slash + 1;
+                if (ptr == end) {
+                    rows->escape = 1;
+                } else {
+                    ++ptr;
+                }
+                continue;
+            }
+            if (quote == NULL) {
+                rows_key_append(rows, ptr, end - ptr);
+                break;
+            }
+            rows_key_append(rows, ptr, quote - ptr);
+            rows->in_string = 0;
+            ptr = quote + 1;
+            if (rows->reading_key) {
+                rows->reading_key = 0;
+                rows->section = rows_section(rows);
+            }
+            continue;
+        }
+        switch (*ptr) {
+            case '"':
+                rows->in_string = 1;
+                if (rows->depth == 1 && rows->expect_key) {
+                    rows->reading_key = 1;
+                    rows->nkey = 0;
+                }
+                break;
+            case '{':
+            case '[':
+                if (rows->depth == 1 && *ptr == '[' &&
+                        (rows->section == VIEW_SECTION_ROWS || rows->section == VIEW_SECTION_ERRORS)) {
+                    rows->in_array = 1;
+                } else if (rows->depth == 2 && rows->in_array && *ptr == '{') {
+                    rows->capturing = 1;
+                    start = ptr;
+                }
+                if (++rows->depth == 1) {
+                    rows->expect_key = 1;
+                }
+                break;
+            case '}':
+            case ']':
+                if (rows->depth == 1 && rows->capturing) {
+                    /* total_rows is the last key of the object */
+                    rows_emit(rows, items, start, ptr - start);
+                }
+                --rows->depth;
+                if (rows->depth == 2 && rows->capturing && *ptr == '}') {
+                    rows_emit(rows, items, start, ptr + 1 - start);
+                } else if (rows->depth == 1) {
+                    rows->in_array = 0;
+                }
+                break;
+            case ':':
+                if (rows->depth == 1) {
+                    rows->expect_key = 0;
+                    if (rows->section == VIEW_SECTION_TOTAL_ROWS) {
+                        rows->capturing = 1;
+                        start = ptr + 1;
+                    }
+                }
+                break;
+            case ',':
+                if (rows->depth == 1) {
+                    if (rows->capturing) {
+                        rows_emit(rows, items, start, ptr - start);
+                    }
+                    rows->expect_key = 1;
+                    rows->section = VIEW_SECTION_NONE;
+                }
+                break;
+        }
+        ++ptr;
+    }
+    if (rows->capturing) {
+        /* keep the beginning of the item until the rest arrives */
+        if (NIL_P(rows->buf)) {
+            rows->buf = rb_str_buf_new(end - start);
+        }
+        rb_str_cat(rows->buf, start, end - start);
+    }
+    return items;
+}
+
+/* Couchbase::ViewRowsParser wraps the splitter to feed it from Ruby. It
+ * is not used by the library itself and exists for the tests. */
+
+    static void
+view_rows_parser_mark(void *ptr)
+{
+    struct view_rows_st *rows = ptr;
+    if (rows) {
+        rb_gc_mark(rows->buf);
+    }
+}
+
+    static void
+view_rows_parser_free(void *ptr)
+{
+    cb_view_rows_free(ptr);
+}
+
+    VALUE
+cb_view_rows_parser_alloc(VALUE klass)
+{
+    struct view_rows_st *rows = cb_view_rows_alloc();
+    return Data_Wrap_Struct(klass, view_rows_parser_mark, view_rows_parser_free, rows);
+}
+
+/*
+ * @private Feed the next chunk of the view response
+ *
+ * @since 1.2.0
+ *
+ * @param [String] chunk the bytes of the response body
+ *
+ * @return [Array] the +[kind, item]+ pairs completed by this chunk,
+ *   where +kind+ is +:rows+, +:errors+ or +:total_rows+
+ */
+    VALUE
+cb_view_rows_parser_feed(VALUE self, VALUE chunk)
+{
+    struct view_rows_st *rows = DATA_PTR(self);
+
+    Check_Type(chunk, T_STRING);
+    return cb_view_rows_feed(rows, RSTRING_PTR(chunk), RSTRING_LEN(chunk));
+}
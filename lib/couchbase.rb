@@ -18,18 +18,21 @@
 require 'couchbase/version'
 require 'multi_json'
 require 'ext/multi_json_fix'
-require 'yaji'
 require 'uri'
+require 'thread'
 require 'couchbase_ext'
 require 'couchbase/utils'
 require 'couchbase/bucket'
 require 'couchbase/view_row'
 require 'couchbase/view'
 require 'couchbase/result'
+require 'couchbase/future'
 
 # Couchbase ruby client
 module Couchbase
 
+  @shared_bucket_lock = Mutex.new
+
   class << self
     # The method +connect+ initializes new Bucket instance with all arguments passed.
     #
@@ -67,7 +70,26 @@ module Couchbase
     #   Couchbase.bucket.name     #=> "blog"
     #
     # @return [Hash, String]
-    attr_accessor :connection_options
+    attr_reader :connection_options
+
+    # Set default connection options
+    #
+    # @since 1.1.0
+    #
+    # The connection shared between threads (see {Couchbase.bucket}) is
+    # dropped, so that the new options will be used by the threads which
+    # haven't got the connection yet. The connections already stored by
+    # the threads aren't changed.
+    #
+    # @param [Hash, String] options
+    #
+    # @return [Hash, String]
+    def connection_options=(options)
+      @shared_bucket_lock.synchronize do
+        @shared_bucket = nil
+        @connection_options = options
+      end
+    end
 
     # @private the thread local storage
     def thread_storage
@@ -78,14 +100,31 @@ module Couchbase
     #
     # @since 1.1.0
     #
+    # If the connection options have +:thread_safe+ flag set, the single
+    # connection will be shared between all threads.
+    #
     # @see Couchbase.connection_options
     #
     # @example
     #   Couchbase.bucket.set("foo", "bar")
     #
+    # @example Use one connection for all threads
+    #   Couchbase.connection_options = {:bucket => 'blog', :thread_safe => true}
+    #   Couchbase.bucket.set("foo", "bar")
+    #
     # @return [Bucket]
     def bucket
-      thread_storage[:bucket] ||= connect(connection_options)
+      thread_storage[:bucket] ||= shared_bucket || connect(connection_options)
+    end
+
+    # @private the connection shared between threads
+    def shared_bucket
+      options = connection_options
+      if options.is_a?(Hash) && options[:thread_safe]
+        @shared_bucket_lock.synchronize do
+          @shared_bucket ||= connect(options)
+        end
+      end
     end
 
     # Set a connection instance for current thread
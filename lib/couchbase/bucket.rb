@@ -320,8 +320,412 @@ module Couchbase
       end
     end
 
+    # Schedule get operation and return the future
+    #
+    # @since 1.2.0
+    #
+    # The command will be sent out when the value of any future for this
+    # connection will be requested (or by any synchronous operation).
+    #
+    # @see Bucket#get
+    #
+    # @example Fan out several lookups
+    #   futures = ["foo", "bar", "baz"].map{|k| c.get_async(k)}
+    #   Couchbase::Future.wait_all(futures)   #=> ["foo value", "bar value", "baz value"]
+    #
+    # @return [Future]
+    def get_async(*args)
+      future = Future.new(self, :value, multi_key?(args))
+      options_p = args.size > 1 && args.last.is_a?(Hash)
+      async_schedule { get(*batch_arguments(args, options_p)) {|res| future.call(res)} }
+      future
+    end
+
+    # Schedule set operation and return the future
+    #
+    # @since 1.2.0
+    #
+    # @see Bucket#set
+    #
+    # @example
+    #   f = c.set_async("foo", "bar")
+    #   f.value     #=> CAS of the new value
+    #
+    # @return [Future]
+    def set_async(*args)
+      future = Future.new(self, :cas, args.first.is_a?(Hash))
+      # set(key, hash) stores the Hash as the value
+      options_p = args.last.is_a?(Hash) && (args.size > 2 || args.size == 2 && args.first.is_a?(Hash))
+      async_schedule { set(*batch_arguments(args, options_p)) {|res| future.call(res)} }
+      future
+    end
+
+    # Schedule increment operation and return the future
+    #
+    # @since 1.2.0
+    #
+    # @see Bucket#incr
+    #
+    # @example
+    #   f = c.incr_async("counter", :initial => 1)
+    #   f.value     #=> the new value of the counter
+    #
+    # @return [Future]
+    def incr_async(*args)
+      future = Future.new(self, :value, multi_key?(args))
+      options_p = args.size > 1 && args.last.is_a?(Hash)
+      async_schedule { incr(*batch_arguments(args, options_p)) {|res| future.call(res)} }
+      future
+    end
+
+    # Fetch the values for the keys from enumerable in windows
+    #
+    # @since 1.2.0
+    #
+    # The keys are requested in windows of +:window+ size with synchronous
+    # multi-get. Only one window is in flight, therefore the memory usage
+    # doesn't depend on the number of keys, and the source might be lazy or
+    # even infinite.
+    #
+    # Note that the pairs aren't streamed as their responses arrive: they
+    # are yielded when the whole window has been received and the event
+    # loop is stopped, so that the block is free to use the connection
+    # (the callbacks of the event loop don't allow synchronous operations).
+    # Use the smaller window to get the first pairs sooner.
+    #
+    # @see Bucket#get
+    #
+    # @param [Enumerable] keys the source of the keys
+    # @param [Hash] options the options for {Bucket#get}
+    # @option options [Fixnum] :window (1000) the number of keys requested
+    #   at once
+    #
+    # @yieldparam [String, Symbol] key the key as it was taken from the
+    #   source (or String when the result is a Hash, e.g. with +:extended+)
+    # @yieldparam [Object] value the value or +nil+ if the key is missing
+    #   and +:quiet+ is set
+    #
+    # @raise [ArgumentError] when called in asynchronous mode
+    #
+    # @example Copy all documents to another bucket
+    #   c.get_each(ids, :quiet => true) do |key, value|
+    #     other.set(key, value) if value
+    #   end
+    #
+    # @example Take first documents from the infinite sequence
+    #   keys = (1..Float::INFINITY).lazy.map { |ii| "item:#{ii}" }
+    #   c.get_each(keys, :window => 10).take(5)
+    #
+    # @return [Enumerator, nil] the enumerator if the block isn't given
+    def get_each(keys, options = {})
+      return enum_for(:get_each, keys, options) unless block_given?
+      if async?
+        raise ArgumentError, "get_each isn't supported in asynchronous mode"
+      end
+      options = options.dup
+      window = options.delete(:window) || 1000
+      unless window.is_a?(Integer) && window > 0
+        raise ArgumentError, "window should be positive number"
+      end
+      keys.each_slice(window) do |slice|
+        res = get(slice, options)
+        if res.is_a?(Hash)
+          res.each { |key, value| yield(key, value) }
+        else
+          slice.each_with_index { |key, ii| yield(key, res[ii]) }
+        end
+      end
+      nil
+    end
+
+    # Store the documents from JSON Lines or CSV source
+    #
+    # @since 1.2.0
+    #
+    # The source is read line by line, and the documents are stored in
+    # windows of +:window+ size using multi-key {Bucket#set}, so that the
+    # memory usage doesn't depend on the size of the source. The next
+    # window is read while the responses for the current one are being
+    # received, and it is sent as soon as the current one is done. The
+    # documents are stored in +:document+ format, the lines of JSON Lines
+    # source are stored as they are (see +:encoded+ option of
+    # {Bucket#set}). When the key repeats, the later document replaces the
+    # earlier one, and both are counted as stored.
+    #
+    # The thread-safe connections don't allow {Bucket#run}, therefore the
+    # windows are stored there with synchronous multi-set one after
+    # another. When it fails, only the documents which haven't been stored
+    # are stored again one by one to find out the errors.
+    #
+    # @param [String, IO] source the path to the file or IO object
+    # @param [Hash] options
+    # @option options [Symbol] :format (:jsonl) the format of the source:
+    #   +:jsonl+ (one JSON document per line) or +:csv+ (the first line
+    #   contains the names of the fields)
+    # @option options [String] :key_field ("id") the field of the document
+    #   which contains the key
+    # @option options [Fixnum] :window (1000) the number of documents
+    #   stored at once
+    # @option options [Fixnum] :ttl (self.default_ttl) Expiry time for the
+    #   documents
+    #
+    # @yieldparam [Result] ret the result for the document which wasn't
+    #   stored. The results are yielded when all windows have been sent.
+    #   Without the block the error will be raised, and the documents after
+    #   the failed window won't be stored.
+    #
+    # @raise [ArgumentError] when the document doesn't have the key field,
+    #   or when called in asynchronous mode
+    #
+    # @example Load the dump, skipping the broken documents
+    #   c.bulk_load("users.jsonl", :window => 5000) do |ret|
+    #     puts "#{ret.key}: #{ret.error}"
+    #   end                   #=> the number of stored documents
+    #
+    # @return [Fixnum] the number of stored documents
+    def bulk_load(source, options = {}, &block)
+      if async?
+        raise ArgumentError, "bulk_load isn't supported in asynchronous mode"
+      end
+      key_field = (options[:key_field] || "id").to_s
+      window = options[:window] || 1000
+      unless window.is_a?(Integer) && window > 0
+        raise ArgumentError, "window should be positive number"
+      end
+      format = options[:format] || :jsonl
+      store_options = {:format => :document, :encoded => format == :jsonl}
+      store_options[:ttl] = options[:ttl] if options[:ttl]
+      io = source.is_a?(String) ? File.open(source, "r") : source
+      reader = bulk_reader(io, format, key_field)
+      carry = nil
+      # read the next window, it is cut before the key which repeats, so
+      # that the later document will replace the earlier one on the server
+      next_window = lambda do
+        docs = {}
+        while docs.size < window && (pair = carry || reader.call)
+          carry = nil
+          if docs.has_key?(pair[0])
+            carry = pair
+            break
+          end
+          docs[pair[0]] = pair[1]
+        end
+        docs
+      end
+      stored = 0
+      if thread_safe?
+        until (docs = next_window.call).empty?
+          stored += bulk_store(docs, store_options, &block)
+        end
+        return stored
+      end
+      failed = []
+      schedule = lambda do |batch|
+        left = batch.size
+        upcoming = nil
+        set(batch, store_options) do |res|
+          if res.success?
+            stored += 1
+          else
+            failed << res
+          end
+          left -= 1
+          # the responses for the rest of the window are being received
+          # while the next one is read
+          upcoming ||= next_window.call
+          if left == 0 && !upcoming.empty? && (block || failed.empty?)
+            schedule.call(upcoming)
+          end
+        end
+      end
+      docs = next_window.call
+      run { schedule.call(docs) } unless docs.empty?
+      failed.each do |ret|
+        raise ret.error unless block
+        yield ret
+      end
+      stored
+    ensure
+      io.close if io && source.is_a?(String)
+    end
+
+    # Write the documents of the bucket to IO in JSON Lines format
+    #
+    # @since 1.2.0
+    #
+    # The ids are streamed from the view, and the documents are fetched in
+    # windows of +:window+ size. The multi-get for the window is scheduled
+    # asynchronously, so that it runs while the next page of the view is
+    # being received. Only one window is in flight, and each document is
+    # written as soon as it arrives. Each line is the JSON object with
+    # +"id"+, +"flags"+ and +"cas"+ keys. The value is exported as the
+    # bytes stored on the server, regardless of its format, so that the
+    # backup is lossless: in +"value"+ key as the String if the bytes are
+    # valid UTF-8, or in +"base64"+ key otherwise. The documents removed in
+    # the meantime are skipped.
+    #
+    # @param [IO] io the destination, which responds to +#write+
+    # @param [Hash] options
+    # @option options [String, View] :view ("_all_docs") the view which
+    #   lists the ids of the documents
+    # @option options [Fixnum] :window (1000) the number of documents
+    #   fetched at once
+    #
+    # @raise [ArgumentError] when called in asynchronous mode
+    #
+    # @example Backup the bucket
+    #   File.open("backup.jsonl", "w") do |file|
+    #     c.export(file, :window => 5000)   #=> the number of documents
+    #   end
+    #
+    # @return [Fixnum] the number of exported documents
+    def export(io, options = {})
+      if async?
+        raise ArgumentError, "export isn't supported in asynchronous mode"
+      end
+      view = options[:view] || "_all_docs"
+      view = View.new(self, view) unless view.is_a?(View)
+      window = options[:window] || 1000
+      unless window.is_a?(Integer) && window > 0
+        raise ArgumentError, "window should be positive number"
+      end
+      exported = pending = 0
+      error = nil
+      ids = []
+      wait = lambda do
+        async_wait while pending > 0
+        raise error if error
+      end
+      fetch = lambda do
+        wait.call
+        pending += ids.size
+        async_schedule do
+          get(ids, :format => :plain) do |ret|
+            pending -= 1
+            if ret.success?
+              io.write(MultiJson.dump(export_record(ret)) << "\n")
+              exported += 1
+            elsif !ret.error.is_a?(Error::NotFound)
+              error ||= ret.error
+            end
+          end
+        end
+        ids = []
+      end
+      view.each do |row|
+        next if row.id.nil? || row.id.start_with?("_design/")
+        ids << row.id
+        fetch.call if ids.size >= window
+      end
+      fetch.call unless ids.empty?
+      wait.call
+      exported
+    end
+
     private
 
+    # Whether the arguments of get or incr describe multiple keys, so that
+    # the operation returns the Hash
+    def multi_key?(args)
+      keys = args.first
+      keys.is_a?(Array) || keys.is_a?(Hash) ||
+        args.count { |arg| arg.is_a?(String) || arg.is_a?(Symbol) } > 1
+    end
+
+    # Add +:batch_callback+ to the options of the operation, which are
+    # the last Hash of the arguments if +options_p+ is true
+    def batch_arguments(args, options_p)
+      if options_p
+        args[0...-1] + [args.last.merge(:batch_callback => true)]
+      else
+        args + [{:batch_callback => true}]
+      end
+    end
+
+    # Build the line of #export with the raw value
+    def export_record(ret)
+      record = {"id" => ret.key, "flags" => ret.flags, "cas" => ret.cas}
+      if value = utf8_string(ret.value)
+        record["value"] = value
+      else
+        record["base64"] = [ret.value].pack("m").delete("\n")
+      end
+      record
+    end
+
+    # Returns the String as UTF-8, or nil if the bytes aren't valid UTF-8
+    def utf8_string(str)
+      if str.respond_to?(:valid_encoding?)
+        str = str.dup.force_encoding("UTF-8")
+        str if str.valid_encoding?
+      else
+        begin
+          str.unpack("U*")
+          str
+        rescue ArgumentError
+          nil
+        end
+      end
+    end
+
+    # Returns the lambda which reads the next document from the source as
+    # the pair [key, document], or nil at the end. The document of JSON
+    # Lines source is the line itself
+    def bulk_reader(io, format, key_field)
+      case format
+      when :jsonl
+        lambda do
+          while line = io.gets
+            line = line.strip
+            next if line.empty?
+            return [bulk_key(MultiJson.load(line), key_field), line]
+          end
+        end
+      when :csv
+        require 'csv'
+        csv = CSV.new(io, :headers => true)
+        lambda do
+          if row = csv.shift
+            doc = row.to_hash
+            [bulk_key(doc, key_field), doc]
+          end
+        end
+      else
+        raise ArgumentError, "unknown format #{format.inspect}, expected :jsonl or :csv"
+      end
+    end
+
+    def bulk_key(doc, key_field)
+      key = doc[key_field] if doc.is_a?(Hash)
+      if key.nil? || key.to_s.empty?
+        raise ArgumentError, "the document doesn't have \"#{key_field}\" field"
+      end
+      key.to_s
+    end
+
+    def bulk_store(docs, options)
+      begin
+        set(docs, options)
+        return docs.size
+      rescue Error::Base
+        raise unless block_given?
+      end
+      # the window has been stored partially, the documents which are on
+      # the server already are skipped
+      format = options[:encoded] ? :plain : :document
+      current = get(docs.keys, :quiet => true, :format => format, :assemble_hash => true)
+      stored = 0
+      docs.each do |key, doc|
+        begin
+          set(key, doc, options) unless current[key] == doc
+          stored += 1
+        rescue Error::Base => ex
+          yield Result.new(:operation => :set, :key => key, :error => ex)
+        end
+      end
+      stored
+    end
+
     def verify_observe_options(options)
       unless num_replicas
         raise Couchbase::Error::Libcouchbase, "cannot detect number of the replicas"
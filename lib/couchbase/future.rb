@@ -0,0 +1,130 @@
+# Author:: Couchbase <info@couchbase.com>
+# Copyright:: 2012 Couchbase, Inc.
+# License:: Apache License, Version 2.0
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+module Couchbase
+
+  # The result of the operation which will be available later
+  #
+  # @since 1.2.0
+  #
+  # The futures are returned by {Bucket#get_async}, {Bucket#set_async} and
+  # {Bucket#incr_async}. The commands are buffered until some future asks
+  # for its value, then all of them are sent out in one batch.
+  #
+  # @example Fetch several documents in one round trip
+  #   f1 = c.get_async("foo")
+  #   f2 = c.get_async("bar")
+  #   f1.value    #=> "foo value"
+  #   f2.value    #=> "bar value", without additional network interaction
+  class Future
+
+    # @return [Bucket] the connection which executes the operation
+    attr_reader :bucket
+
+    # @return [Array<Result>] the results received so far
+    attr_reader :results
+
+    # @param [Bucket] bucket the connection
+    # @param [Symbol] attribute the attribute of {Result} holding the value
+    #   (+:value+ or +:cas+)
+    # @param [true, false] multi whether the operation has been called
+    #   for multiple keys, so that the value is the Hash
+    def initialize(bucket, attribute = :value, multi = false)
+      @bucket = bucket
+      @attribute = attribute
+      @multi = multi
+      @results = []
+      @completed = false
+    end
+
+    # Wait for several futures at once
+    #
+    # @since 1.2.0
+    #
+    # Runs event loop once per connection, so that all scheduled commands
+    # share the round trip.
+    #
+    # @param [Array<Future>] futures
+    #
+    # @example
+    #   futures = keys.map{|k| c.get_async(k)}
+    #   Couchbase::Future.wait_all(futures)   #=> [value1, value2, ...]
+    #
+    # @raise [Couchbase::Error::Invalid] if the event loop has been stopped
+    #   (e.g. by {Bucket#stop}) before some operation completed. Such
+    #   futures stay pending, and they will be waited for again on next
+    #   call.
+    #
+    # @return [Array] the values of the futures
+    def self.wait_all(*futures)
+      futures = futures.flatten
+      pending = futures.reject{|f| f.completed?}
+      pending.map{|f| f.bucket}.uniq.each do |bucket|
+        bucket.send(:async_wait)
+      end
+      futures.map{|f| f.send(:fetch)}
+    end
+
+    # @return [true, false] +true+ if the all results are received
+    def completed?
+      @completed
+    end
+
+    # The value of the operation
+    #
+    # @since 1.2.0
+    #
+    # Blocks until the operation will be completed.
+    #
+    # @raise [Couchbase::Error::Base] the error of the operation
+    #
+    # @return [Object, Hash] the value for single key operations, or the
+    #   hash key-value pairs for multiple keys
+    def value
+      Future.wait_all(self).first
+    end
+
+    # @private Accept the results from the operation callback. The
+    #   operation is scheduled with +:batch_callback+ option, therefore it
+    #   is called once, when all responses have been received
+    def call(results)
+      @results.concat(results)
+      @completed = true
+    end
+
+    private
+
+    def fetch
+      unless @completed
+        raise Error::Invalid, "the event loop has been stopped before the operation completed"
+      end
+      @results.each do |res|
+        raise res.error if res.error
+      end
+      if @multi
+        @results.reduce({}) do |h, res|
+          h[res.key] = res.send(@attribute)
+          h
+        end
+      else
+        @results.first.send(@attribute)
+      end
+    end
+
+  end
+
+end
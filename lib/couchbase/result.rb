@@ -17,10 +17,43 @@
 
 module Couchbase
   class Result
+    # The attributes filled by the extension. They are kept in C struct,
+    # and copied to the instance variables only when the application
+    # inspects them with reflection methods.
+    ATTRIBUTES = [:operation, :error, :key, :value, :cas, :flags, :node,
+                  :headers, :completed, :status, :from_master,
+                  :time_to_persist, :time_to_replicate]
+
     def initialize(attrs = {})
       attrs.each do |k, v|
         instance_variable_set("@#{k}", v) if respond_to?(k)
       end
     end
+
+    def instance_variables
+      mirror_attributes
+      super
+    end
+
+    def instance_variable_get(name)
+      mirror_attributes
+      super
+    end
+
+    def instance_variable_defined?(name)
+      mirror_attributes
+      super
+    end
+
+    private
+
+    # The readers prefer instance variables, so that copying the values
+    # they return doesn't change anything
+    def mirror_attributes
+      ATTRIBUTES.each do |name|
+        val = send(name)
+        instance_variable_set("@#{name}", val) unless val.nil?
+      end
+    end
   end
 end
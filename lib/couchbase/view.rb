@@ -35,6 +35,12 @@ module Couchbase
   class View
     include Enumerable
 
+    # The number of rows per page (see {#each_page})
+    PAGE_SIZE = 100
+
+    # The number of documents fetched at once (see {#each_with_docs})
+    BATCH = 200
+
     attr_reader :params
 
     # Set up view endpoint and optional params
@@ -88,6 +94,155 @@ module Couchbase
       fetch(params) {|doc| yield(doc)}
     end
 
+    # Yields the results page by page. Returns Enumerator unless block
+    # given.
+    #
+    # @since 1.2.0
+    #
+    # The pages are requested using +startkey+ and +startkey_docid+ of the
+    # first row of the next page instead of +skip+, which makes the server
+    # to walk the index from the beginning for each page. Each request
+    # takes one extra row, therefore the request for the next page is
+    # scheduled before the current page is yielded. Note that it is
+    # executed only while the event loop runs: if the block performs
+    # operations on the same bucket, the next page is being received
+    # meanwhile, otherwise the request is sent after the block returns,
+    # like without prefetch. Thread-safe connections don't allow
+    # asynchronous requests, and the pages are fetched one after another
+    # there.
+    #
+    # Works for the views without reduce, because the rows should have
+    # document IDs.
+    #
+    # @param [Hash] params Params for Couchdb query (see {View#fetch}). The
+    #   +:page_size+ key sets the number of rows per page (see {PAGE_SIZE}).
+    #
+    # @yieldparam [Array<ViewRow>] page the rows of the page
+    #
+    # @raise [ArgumentError] when called inside {Bucket#run} block
+    #
+    # @return [nil]
+    #
+    # @example Handle the rows of the view in pages of 500
+    #   view.each_page(:page_size => 500) do |page|
+    #     keys = page.map{|row| row.key}
+    #     # do something with keys
+    #   end
+    #
+    def each_page(params = {})
+      return enum_for(:each_page, params) unless block_given?
+      if @bucket.async?
+        raise ArgumentError, "each_page isn't supported in asynchronous mode"
+      end
+      params = @params.merge(params)
+      page_size = (params.delete(:page_size) || PAGE_SIZE).to_i
+      if page_size < 1
+        raise ArgumentError, "page size should be positive number"
+      end
+      params[:limit] = page_size + 1
+      page = schedule_page(params)
+      loop do
+        rows = page.call
+        if rows.size > page_size
+          head = rows.pop
+          params = params.merge(:startkey => head["key"], :startkey_docid => head["id"])
+          params.delete(:start_key)
+          params.delete(:start_key_doc_id)
+          params.delete(:skip)
+          page = schedule_page(params)
+        else
+          page = nil
+        end
+        yield rows.map {|obj| @wrapper_class.wrap(@bucket, obj)}
+        break unless page
+      end
+      nil
+    end
+
+    # Yields the rows along with their documents. Returns Enumerator unless
+    # block given.
+    #
+    # @since 1.2.0
+    #
+    # The documents are fetched by the ids of the rows in batches. The
+    # multi-get of each batch is scheduled asynchronously as soon as its
+    # rows have been received, so that it runs on the event loop while the
+    # rest of the view is being streamed, instead of collecting all ids
+    # for one giant get. The pairs are yielded batch by batch in the order
+    # of the rows, when all documents of the batch are here. Thread-safe connections don't allow
+    # asynchronous operations, and the batches are fetched synchronously
+    # there.
+    #
+    # @param [Hash] params Params for Couchdb query (see {View#fetch}). The
+    #   +:batch+ key sets the number of rows per multi-get (see {BATCH}).
+    #
+    # @yieldparam [ViewRow] row
+    # @yieldparam [Object] doc the value of the document or +nil+ if it
+    #   doesn't exist (or the row doesn't have id)
+    #
+    # @raise [ArgumentError] when called inside {Bucket#run} block
+    #
+    # @return [nil]
+    #
+    # @example Render recent posts
+    #   blog.recent_posts.each_with_docs(:batch => 50) do |row, post|
+    #     puts "#{row.key}: #{post["title"]}" if post
+    #   end
+    #
+    def each_with_docs(params = {})
+      return enum_for(:each_with_docs, params) unless block_given?
+      if @bucket.async?
+        raise ArgumentError, "each_with_docs isn't supported in asynchronous mode"
+      end
+      params = params.dup
+      batch = (params.delete(:batch) || BATCH).to_i
+      if batch < 1
+        raise ArgumentError, "batch should be positive number"
+      end
+      # the batches are yielded in the order of the rows, as soon as
+      # the documents of the head batch are here
+      rows, batches, error = [], [], nil
+      drain = lambda do
+        raise error if error
+        while batches.first && batches.first[:left] == 0
+          head = batches.shift
+          head[:rows].each {|row| yield(row, head[:docs][row.id])}
+        end
+      end
+      fetch_docs = lambda do
+        ids = rows.map {|row| row.id}.compact.uniq
+        entry = {:rows => rows, :docs => {}, :left => ids.size}
+        batches << entry
+        rows = []
+        next if ids.empty?
+        if @bucket.thread_safe?
+          entry[:docs] = @bucket.get(ids, :quiet => true, :assemble_hash => true)
+          entry[:left] = 0
+        else
+          @bucket.send(:async_schedule) do
+            @bucket.get(ids) do |ret|
+              if ret.success?
+                entry[:docs][ret.key] = ret.value
+              elsif !ret.error.is_a?(Error::NotFound)
+                error ||= ret.error
+              end
+              entry[:left] -= 1
+            end
+          end
+        end
+      end
+      # the multi-gets are progressed by the event loop of the view request
+      fetch(params) do |row|
+        rows << row
+        fetch_docs.call if rows.size >= batch
+        drain.call
+      end
+      fetch_docs.call unless rows.empty?
+      @bucket.send(:async_wait) while batches.any? {|entry| entry[:left] > 0}
+      drain.call
+      nil
+    end
+
     # Registers callback function for handling error objects in view
     # results stream.
     #
@@ -230,59 +385,41 @@ module Couchbase
     #                                  :end_key => [post_id, 1],
     #                                  :include_docs => true)
     def fetch(params = {})
-      params = @params.merge(params)
-      options = {:chunked => true, :extended => true, :type => :view}
-      if body = params.delete(:body)
-        body = MultiJson.dump(body) unless body.is_a?(String)
-        options.update(:body => body, :method => params.delete(:method) || :post)
-      end
-      path = Utils.build_query(@endpoint, params)
-      request = @bucket.make_http_request(path, options)
+      request = make_request(@params.merge(params))
       res = []
+      # the extension splits the body into the items, so that each chunk
+      # is the Array of [kind, item] pairs completed by it
       request.on_body do |chunk|
         res << chunk
-        request.pause if chunk.value.nil? || chunk.error
+        request.pause if chunk.completed? || chunk.error
       end
-      filter = ["/rows/", "/errors/"]
-      filter << "/total_rows" unless block_given?
-      parser = YAJI::Parser.new(:filter => filter, :with_path => true)
       docs = []
-      parser.on_object do |path, obj|
-        case path
-        when "/total_rows"
-          # if total_rows key present, save it and take next object
-          docs.instance_eval("def total_rows; #{obj}; end")
-        when "/errors/"
-          from, reason = obj["from"], obj["reason"]
-          if @on_error
-            @on_error.call(from, reason)
-          else
-            raise Error::View.new(from, reason)
-          end
-        else
-          if block_given?
-            yield @wrapper_class.wrap(@bucket, obj)
-          else
-            docs << @wrapper_class.wrap(@bucket, obj)
-          end
-        end
-      end
       # run event loop until the terminating chunk will be found
       # last_res variable keeps latest known chunk of the result
       last_res = nil
       loop do
-        # feed response received chunks to the parser
+        # handle the items from received chunks
         while r = res.shift
           if r.error
-            if @on_error
-              @on_error.call("http_error", r.error)
-              break
+            handle_error("http_error", r.error, nil)
+            break
+          end
+          last_res = r
+          each_item(r) do |kind, obj|
+            case kind
+            when :total_rows
+              # if total_rows key present, save it and take next object
+              docs.instance_eval("def total_rows; #{obj}; end") unless block_given?
+            when :errors
+              handle_error(obj["from"], obj["reason"])
             else
-              raise Error::View.new("http_error", r.error, nil)
+              if block_given?
+                yield @wrapper_class.wrap(@bucket, obj)
+              else
+                docs << @wrapper_class.wrap(@bucket, obj)
+              end
             end
           end
-          last_res = r
-          parser << r.value
         end
         if last_res.nil? || !last_res.completed?  # shall we run the event loop?
           request.continue
@@ -301,5 +438,171 @@ module Couchbase
     def inspect
       %(#<#{self.class.name}:#{self.object_id} @endpoint=#{@endpoint.inspect} @params=#{@params.inspect}>)
     end
+
+    # Executes several views at once
+    #
+    # @since 1.2.0
+    #
+    # The requests of all views are scheduled on the event loop of their
+    # connection, and the rows are yielded as soon as they arrive, so that
+    # it takes about as long as the slowest view. Thread-safe connections
+    # don't allow {Bucket#run}, and the views are fetched one after
+    # another there.
+    #
+    # @param [Array<View>, Hash] views the views to execute, or the Hash
+    #   where the values are the handlers of the rows of the views (keys)
+    # @param [Hash] params Params for Couchdb query (see {View#fetch}),
+    #   applied to all views
+    #
+    # @yieldparam [View] view the view of the row, unless the handlers are
+    #   passed in +views+
+    # @yieldparam [ViewRow] row
+    #
+    # @raise [ArgumentError] when the views use different connections
+    # @raise [Couchbase::Error::View] when the view hasn't +on_error+
+    #   callback and the error object found in its result stream.
+    #
+    # @return [Array, nil] the Arrays with the rows of each view if neither
+    #   block nor handlers given, +nil+ otherwise
+    #
+    # @example Query the views for dashboard
+    #   recent, popular = View.fetch_all([blog.recent_posts, blog.popular_posts],
+    #                                    :limit => 10)
+    #
+    # @example Handle the rows of each view as they arrive
+    #   View.fetch_all(blog.recent_posts => lambda{|row| render_recent(row)},
+    #                  blog.comments => lambda{|row| render_comment(row)})
+    #
+    def self.fetch_all(views, params = {})
+      handlers = views.is_a?(Hash) ? views : {}
+      views = views.is_a?(Hash) ? views.keys : views.to_a
+      results = views.map { [] }
+      return results if views.empty?
+      buckets = views.map {|view| view.send(:bucket)}.uniq
+      if buckets.size > 1
+        raise ArgumentError, "all views should use the same connection"
+      end
+      handler = lambda do |idx, row|
+        view = views[idx]
+        if handlers[view]
+          handlers[view].call(row)
+        elsif block_given?
+          yield(view, row)
+        else
+          results[idx] << row
+        end
+      end
+      if buckets.first.thread_safe?
+        views.each_with_index do |view, idx|
+          view.fetch(params) {|row| handler.call(idx, row)}
+        end
+      else
+        errors = []
+        buckets.first.run do
+          views.each_with_index do |view, idx|
+            view.send(:schedule_stream, params, errors) {|row| handler.call(idx, row)}
+          end
+        end
+        raise errors.first unless errors.empty?
+      end
+      block_given? || !handlers.empty? ? nil : results
+    end
+
+    private
+
+    def bucket
+      @bucket
+    end
+
+    # Build the request of the view
+    def make_request(params)
+      params = params.dup
+      options = {:chunked => true, :extended => true, :type => :view,
+                 :rows => true}
+      if body = params.delete(:body)
+        body = MultiJson.dump(body) unless body.is_a?(String)
+        options.update(:body => body, :method => params.delete(:method) || :post)
+      end
+      @bucket.make_http_request(Utils.build_query(@endpoint, params), options)
+    end
+
+    # Schedule the request in asynchronous mode and yield the rows as they
+    # arrive. The errors, which aren't handled by +on_error+ callback, are
+    # appended to +errors+
+    def schedule_stream(params, errors)
+      request = make_request(@params.merge(params))
+      request.on_body do |chunk|
+        if chunk.error
+          handle_error("http_error", chunk.error, nil, errors)
+        else
+          each_item(chunk) do |kind, obj|
+            case kind
+            when :rows
+              yield @wrapper_class.wrap(@bucket, obj)
+            when :errors
+              handle_error(obj["from"], obj["reason"], "SERVER: ", errors)
+            end
+          end
+        end
+      end
+      request.perform
+    end
+
+    # Yield the +[kind, item]+ pairs of the chunk. The extension splits
+    # the body into the items, and passes them as raw JSON when the
+    # native codec isn't used.
+    def each_item(chunk)
+      chunk.value.each do |kind, obj|
+        obj = MultiJson.load(obj) if obj.is_a?(String)
+        yield(kind, obj)
+      end
+    end
+
+    # Pass the error to +on_error+ callback. Without the callback it is
+    # raised, or appended to +errors+ if given.
+    def handle_error(from, reason, prefix = "SERVER: ", errors = nil)
+      if @on_error
+        @on_error.call(from, reason)
+      elsif errors
+        errors << Error::View.new(from, reason, prefix)
+      else
+        raise Error::View.new(from, reason, prefix)
+      end
+    end
+
+    # Schedule the request of the page. Returns the lambda, which waits
+    # for the page and returns its rows
+    def schedule_page(params)
+      request = make_request(params)
+      rows, errors, error, done = [], [], nil, false
+      request.on_body do |chunk|
+        if chunk.error
+          error ||= chunk.error
+        else
+          each_item(chunk) do |kind, obj|
+            case kind
+            when :rows
+              rows << obj
+            when :errors
+              errors << obj
+            end
+          end
+        end
+        done = true if chunk.completed? || chunk.error
+      end
+      if @bucket.thread_safe?
+        request.perform
+      else
+        @bucket.send(:async_schedule) { request.perform }
+      end
+      lambda do
+        @bucket.send(:async_wait) until done
+        handle_error("http_error", error, nil) if error
+        errors.each do |obj|
+          handle_error(obj["from"], obj["reason"])
+        end
+        rows
+      end
+    end
   end
 end
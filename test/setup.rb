@@ -169,3 +169,24 @@ class MiniTest::Unit::TestCase
     [caller.first[/.*[` ](.*)'/, 1], suffixes].join("_")
   end
 end
+
+# The view which yields the given rows instead of querying the server
+class StubView < Couchbase::View
+  def initialize(bucket, rows)
+    super(bucket, "_design/stub/_view/stub")
+    @rows = rows
+  end
+
+  def fetch(params = {})
+    rows = @rows.map {|data| Couchbase::ViewRow.wrap(@bucket, data)}
+    return rows unless block_given?
+    rows.each {|row| yield row}
+    nil
+  end
+
+  private
+
+  def schedule_stream(params, errors)
+    @rows.each {|data| yield Couchbase::ViewRow.wrap(@bucket, data)}
+  end
+end
@@ -38,6 +38,55 @@ class TestAsync < MiniTest::Unit::TestCase
     assert obj.respond_to?(:flags)
   end
 
+  def test_result_object_accepts_attributes
+    obj = Couchbase::Result.new(:key => "foo", :cas => 42, :operation => :get)
+    assert_equal "foo", obj.key
+    assert_equal 42, obj.cas
+    assert_equal :get, obj.operation
+    assert_nil obj.flags
+    assert obj.success?
+    obj.instance_variable_set("@operation", :set)
+    assert_equal :set, obj.operation
+    assert_equal :set, obj.dup.operation
+  end
+
+  def test_result_attributes_are_visible_as_instance_variables
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    cas = connection.set(uniq_id, "foo", :format => :plain)
+    res = nil
+    connection.run do |conn|
+      conn.get(uniq_id) {|ret| res = ret}
+    end
+    assert_equal "foo", res.instance_variable_get(:@value)
+    assert_equal cas, res.instance_variable_get(:@cas)
+    assert res.instance_variable_defined?(:@key)
+    refute res.instance_variable_defined?(:@error)
+    ivars = res.instance_variables.map {|iv| iv.to_sym}
+    assert ivars.include?(:@operation)
+    assert ivars.include?(:@flags)
+    refute ivars.include?(:@headers)
+    # the values set by the application still take precedence
+    res.instance_variable_set(:@value, "bar")
+    assert_equal "bar", res.value
+    assert_equal "bar", res.instance_variable_get(:@value)
+  end
+
+  def test_result_attributes_in_async_mode
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    cas = connection.set(uniq_id, "foo", :format => :plain)
+    res = nil
+    connection.run do |conn|
+      conn.get(uniq_id) {|ret| res = ret}
+    end
+    assert res.success?
+    assert_equal :get, res.operation
+    assert_equal uniq_id, res.key
+    assert_equal "foo", res.value
+    assert_equal cas, res.cas
+    assert_equal Couchbase::Bucket::FMT_PLAIN, res.flags
+    assert_match(/key="#{uniq_id}"/, res.inspect)
+  end
+
   def test_it_requires_block_for_running_loop
     connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
     refute connection.async?
@@ -246,4 +295,42 @@ class TestAsync < MiniTest::Unit::TestCase
     end
   end
 
+  def test_batch_callback_yields_all_results_once
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    keys = [uniq_id(1), uniq_id(2), uniq_id(3)]
+    keys.each { |k| connection.set(k, k) }
+
+    calls = 0
+    results = nil
+    connection.run do
+      connection.get(keys, :batch_callback => true) do |ret|
+        calls += 1
+        results = ret
+      end
+    end
+    assert_equal 1, calls
+    assert_equal 3, results.size
+    assert_equal keys.sort, results.map(&:key).sort
+    results.each do |r|
+      assert r.success?
+      assert_equal r.key, r.value
+    end
+  end
+
+  def test_batch_callback_for_store_operations
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+
+    calls = 0
+    results = nil
+    connection.run do
+      connection.set({uniq_id(1) => "foo", uniq_id(2) => "bar"}, :batch_callback => true) do |ret|
+        calls += 1
+        results = ret
+      end
+    end
+    assert_equal 1, calls
+    assert_equal 2, results.size
+    assert results.all?(&:success?)
+  end
+
 end
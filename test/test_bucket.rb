@@ -16,6 +16,7 @@
 #
 
 require File.join(File.dirname(__FILE__), 'setup')
+require 'timeout'
 
 class TestBucket < MiniTest::Unit::TestCase
 
@@ -234,4 +235,119 @@ class TestBucket < MiniTest::Unit::TestCase
     end
   end
 
+  def test_it_allows_other_threads_to_run_while_waiting_for_response
+    skip("GVL is released on ruby 2.0+ only") if RUBY_VERSION < "2.0.0"
+    # the server accepts the connection, but never responds
+    server = TCPServer.new("127.0.0.1", 0)
+    clients = []
+    acceptor = Thread.new { loop { clients << server.accept } }
+    gap = 0
+    ticker = Thread.new do
+      last = Time.now
+      loop do
+        sleep(0.01)
+        now = Time.now
+        gap = [gap, now - last].max
+        last = now
+      end
+    end
+    started = Time.now
+    assert_raises(Couchbase::Error::Base) do
+      Couchbase.new(:hostname => "127.0.0.1", :port => server.addr[1], :timeout => 1_000_000)
+    end
+    assert Time.now - started > 0.5
+    # the ticker cannot wake up while the waiting thread holds GVL
+    assert gap < 0.3, "the ticker was blocked for #{gap} seconds"
+  ensure
+    ticker.kill if ticker
+    acceptor.kill if acceptor
+    clients.each {|c| c.close} if clients
+    server.close if server
+  end
+
+  def test_interrupted_wait_does_not_block_other_threads
+    skip("GVL is released on ruby 2.0+ only") if RUBY_VERSION < "2.0.0"
+    server = TCPServer.new("127.0.0.1", 0)
+    clients = []
+    acceptor = Thread.new { loop { clients << server.accept } }
+    gap = 0
+    waiter = Thread.new do
+      Couchbase.new(:hostname => "127.0.0.1", :port => server.addr[1], :timeout => 1_000_000)
+    end
+    sleep(0.2)
+    waiter.raise(RuntimeError, "interrupted")
+    # the interrupted thread drains the pending operations without GVL
+    last = Time.now
+    while waiter.alive?
+      sleep(0.01)
+      now = Time.now
+      gap = [gap, now - last].max
+      last = now
+    end
+    assert_raises(RuntimeError) { waiter.join }
+    assert gap < 0.3, "the main thread was blocked for #{gap} seconds"
+  ensure
+    waiter.kill if waiter
+    acceptor.kill if acceptor
+    clients.each {|c| c.close} if clients
+    server.close if server
+  end
+
+  def test_it_allows_to_share_thread_safe_connection
+    with_mock do |mock|
+      connection = Couchbase.new(:hostname => mock.host, :port => mock.port,
+                                 :thread_safe => true)
+      assert connection.thread_safe?
+      threads = 8.times.map do |ii|
+        Thread.new do
+          10.times.map do |jj|
+            key = uniq_id(ii, jj)
+            connection.set(key, "#{ii}-#{jj}")
+            connection.get(key)
+          end
+        end
+      end
+      threads.each_with_index do |th, ii|
+        assert_equal 10.times.map{|jj| "#{ii}-#{jj}"}, th.value
+      end
+      assert_raises(Couchbase::Error::Invalid) do
+        connection.run { }
+      end
+    end
+  end
+
+  def test_it_allows_synchronous_operations_from_callbacks_of_thread_safe_connection
+    with_mock do |mock|
+      connection = Couchbase.new(:hostname => mock.host, :port => mock.port,
+                                 :thread_safe => true)
+      connection.set(uniq_id, "bar")
+      values = []
+      req = connection.make_http_request("/pools/default", :type => :management,
+                                         :chunked => true)
+      req.on_body do |chunk|
+        # the callback runs in the thread driving the event loop
+        values << connection.get(uniq_id)
+      end
+      Timeout.timeout(10) { req.perform }
+      refute values.empty?
+      assert values.all? { |val| val == "bar" }
+    end
+  end
+
+  def test_it_allows_to_continue_completed_asynchronous_request
+    with_mock do |mock|
+      connection = Couchbase.new(:hostname => mock.host, :port => mock.port)
+      chunks = []
+      req = connection.make_http_request("/pools/default", :type => :management,
+                                         :chunked => true)
+      req.on_body { |chunk| chunks << chunk }
+      connection.run { req.perform }
+      refute chunks.empty?
+      # the context of the request has been released and reused by others
+      connection.run { connection.set(uniq_id, "foo") { } }
+      assert_nil req.continue
+      assert_equal "foo", connection.get(uniq_id)
+    end
+  end
+
 end
@@ -0,0 +1,95 @@
+# Author:: Couchbase <info@couchbase.com>
+# Copyright:: 2012 Couchbase, Inc.
+# License:: Apache License, Version 2.0
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+require File.join(File.dirname(__FILE__), 'setup')
+
+class TestConnectionPool < MiniTest::Unit::TestCase
+
+  def setup
+    @mock = start_mock
+  end
+
+  def teardown
+    stop_mock(@mock)
+  end
+
+  def test_initialization
+    pool = Couchbase::ConnectionPool.new(3, :hostname => @mock.host, :port => @mock.port)
+    assert_equal 3, pool.size
+    assert_equal 3, pool.available
+    assert_raises(ArgumentError) do
+      Couchbase::ConnectionPool.new(0, :hostname => @mock.host, :port => @mock.port)
+    end
+  end
+
+  def test_it_returns_connection_after_block
+    pool = Couchbase::ConnectionPool.new(2, :hostname => @mock.host, :port => @mock.port)
+    pool.with do |conn|
+      assert_instance_of Couchbase::Bucket, conn
+      assert_equal 1, pool.available
+      conn.set(uniq_id, "bar")
+    end
+    assert_equal 2, pool.available
+    assert_raises(RuntimeError) do
+      pool.with { raise "oops" }
+    end
+    assert_equal 2, pool.available
+    assert_equal "bar", pool.with { |conn| conn.get(uniq_id) }
+  end
+
+  def test_checkout_and_checkin
+    pool = Couchbase::ConnectionPool.new(1, :hostname => @mock.host, :port => @mock.port)
+    conn = pool.checkout
+    assert_equal 0, pool.available
+    pool.checkin(conn)
+    assert_equal 1, pool.available
+    assert_raises(ArgumentError) do
+      pool.checkin(conn)
+    end
+    assert_raises(ArgumentError) do
+      pool.checkin(Couchbase.new(:hostname => @mock.host, :port => @mock.port))
+    end
+  end
+
+  def test_it_blocks_until_connection_available
+    pool = Couchbase::ConnectionPool.new(2, :hostname => @mock.host, :port => @mock.port)
+    pool.with { |conn| conn.set(uniq_id, 0) }
+    threads = 6.times.map do
+      Thread.new do
+        5.times { pool.with { |conn| conn.incr(uniq_id) } }
+      end
+    end
+    threads.each(&:join)
+    assert_equal 30, pool.with { |conn| conn.get(uniq_id) }
+    assert_equal 2, pool.available
+  end
+
+  def test_interrupted_waiter_passes_connection_on
+    pool = Couchbase::ConnectionPool.new(1, :hostname => @mock.host, :port => @mock.port)
+    conn = pool.checkout
+    first = Thread.new { pool.with { :first } }
+    Thread.pass until first.stop?
+    second = Thread.new { pool.with { :second } }
+    Thread.pass until second.stop?
+    pool.checkin(conn)
+    first.kill
+    assert second.join(5), "the second waiter hasn't been woken up"
+    assert_equal :second, second.value
+    assert_equal 1, pool.available
+  end
+
+end
@@ -97,6 +97,143 @@ class TestFormat < MiniTest::Unit::TestCase
     end
   end
 
+  def test_native_json_codec_round_trip
+    orig_doc = {
+      'name' => "Twoflower \u00e9 \"quoted\"\n",
+      'tags' => ['tourist', :luggage],
+      'age' => 42,
+      'big' => 2**70,
+      'height' => 1.75,
+      'flags' => [true, false, nil],
+      'nested' => {'empty' => {}, 'list' => []}
+    }
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    assert_equal :native, Couchbase.json_backend
+    connection.set(uniq_id, orig_doc)
+    doc = connection.get(uniq_id)
+    expected = orig_doc.merge('tags' => ['tourist', 'luggage'])
+    assert_equal expected, doc
+    assert_equal expected, MultiJson.load(connection.get(uniq_id, :format => :plain))
+  end
+
+  def test_native_json_codec_decodes_scalars
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    connection.set(uniq_id, '"string"', :format => :plain)
+    assert_equal "string", connection.get(uniq_id, :format => :document)
+    connection.set(uniq_id, '42', :format => :plain)
+    assert_equal 42, connection.get(uniq_id, :format => :document)
+    connection.set(uniq_id, '{"broken":', :format => :plain)
+    assert_raises(Couchbase::Error::ValueFormat) do
+      connection.get(uniq_id, :format => :document)
+    end
+  end
+
+  def test_native_json_codec_requires_valid_utf8
+    skip("no encodings in this ruby") unless "".respond_to?(:encoding)
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    connection.set(uniq_id, {"name" => "caf\u00e9".encode("ISO-8859-1")})
+    assert_equal({"name" => "caf\u00e9"}, connection.get(uniq_id))
+    connection.set(uniq_id, {"name" => "caf\u00e9".force_encoding("binary")})
+    assert_equal({"name" => "caf\u00e9"}, connection.get(uniq_id))
+
+    assert_raises(Couchbase::Error::ValueFormat) do
+      connection.set(uniq_id, {"name" => "caf\xE9".force_encoding("binary")})
+    end
+    assert_raises(Couchbase::Error::ValueFormat) do
+      connection.set(uniq_id, {"name" => "caf\xE9".force_encoding("UTF-8")})
+    end
+    connection.set(uniq_id, "{\"name\":\"caf\xE9\"}".force_encoding("binary"), :format => :plain)
+    assert_raises(Couchbase::Error::ValueFormat) do
+      connection.get(uniq_id, :format => :document)
+    end
+  end
+
+  def test_multi_json_backend
+    orig_doc = {'name' => 'Twoflower', 'role' => 'The tourist'}
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    assert_raises(ArgumentError) do
+      Couchbase.json_backend = :unknown
+    end
+    Couchbase.json_backend = :multi_json
+    connection.set(uniq_id, orig_doc)
+    assert_equal orig_doc, connection.get(uniq_id)
+  ensure
+    Couchbase.json_backend = :native
+  end
+
+  def compressed_connection(options = {})
+    Couchbase.new({:hostname => @mock.host, :port => @mock.port}.merge(options))
+  rescue ArgumentError
+    skip("the extension was built without compression libraries")
+  end
+
+  def test_values_compressed_above_threshold
+    connection = compressed_connection(:compression => {:min_size => 100}, :default_format => :marshal)
+    assert_equal 100, connection.compression[:min_size]
+    orig_doc = {'fragment' => '<li>item</li>' * 1000}
+    connection.set(uniq_id(:big), orig_doc)
+    doc, flags, _ = connection.get(uniq_id(:big), :extended => true)
+    assert_equal orig_doc, doc
+    assert_equal 0x01, flags
+    raw = connection.get(uniq_id(:big), :format => :plain)
+    assert_equal orig_doc, connection.get(uniq_id(:big))
+    assert_equal orig_doc, Marshal.load(raw)
+    stored = connection.get(uniq_id(:big), :lazy => true).raw
+    assert_equal "\0CBZ", stored[0, 4]
+    assert stored.bytesize < raw.bytesize / 10, "the stored value isn't compressed"
+
+    connection.set(uniq_id(:small), 'tiny')
+    _, flags, _ = connection.get(uniq_id(:small), :extended => true)
+    assert_equal 0x01, flags
+    assert_equal Marshal.dump('tiny'), connection.get(uniq_id(:small), :lazy => true).raw
+  end
+
+  def test_compression_keeps_user_flags
+    connection = compressed_connection(:compression => {:min_size => 1})
+    orig_doc = 'x' * 10_000
+    connection.set(uniq_id, orig_doc, :format => :plain, :flags => 0x0e)
+    val, flags, _ = connection.get(uniq_id, :extended => true)
+    assert_equal 0x0e, flags
+    assert_equal orig_doc, val
+  end
+
+  def test_flags_dont_mark_values_as_compressed
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    connection.set(uniq_id, "abcdefgh", :format => :plain, :flags => 0x06)
+    assert_equal "abcdefgh", connection.get(uniq_id)
+    connection.set(uniq_id, "\0CBZ\1garbage", :format => :plain)
+    assert_raises(Couchbase::Error::ValueFormat) do
+      connection.get(uniq_id)
+    end
+  end
+
+  def test_append_breaks_compressed_values
+    connection = compressed_connection(:compression => {:min_size => 1})
+    connection.set(uniq_id, 'x' * 10_000, :format => :plain)
+    connection.append(uniq_id, 'y' * 10_000, :format => :plain)
+    # the appended chunk isn't compressed
+    stored = connection.get(uniq_id, :lazy => true).raw
+    assert_equal 'y' * 10_000, stored[-10_000..-1]
+    assert_raises(Couchbase::Error::ValueFormat) do
+      connection.get(uniq_id)
+    end
+  end
+
+  def test_compression_could_be_disabled_per_operation
+    connection = compressed_connection(:compression => {:min_size => 1})
+    orig_doc = 'x' * 10_000
+    connection.set(uniq_id, orig_doc, :compression => false, :format => :plain)
+    assert_equal orig_doc, connection.get(uniq_id)
+    assert_equal orig_doc, connection.get(uniq_id, :lazy => true).raw
+    uncompressed = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    assert_nil uncompressed.compression
+    uncompressed.set(uniq_id, orig_doc, :compression => {:min_size => 1}, :format => :plain)
+    assert_equal orig_doc, uncompressed.get(uniq_id)
+    stored = uncompressed.get(uniq_id, :lazy => true).raw
+    assert_equal "\0CBZ", stored[0, 4]
+    assert stored.bytesize < orig_doc.bytesize / 10, "the stored value isn't compressed"
+  end
+
   def test_bignum_conversion
     connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port, :default_format => :plain)
     cas = 0xffff_ffff_ffff_ffff
@@ -106,4 +243,26 @@ class TestFormat < MiniTest::Unit::TestCase
     end
   end
 
+  def test_encoding_of_received_strings
+    skip("no encodings in this ruby") unless "".respond_to?(:encoding)
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port,
+                               :default_format => :plain)
+    assert_equal :external, connection.encoding
+    connection.set(uniq_id, "caf\u00e9")
+
+    connection.encoding = :binary
+    val = connection.get(uniq_id)
+    assert_equal Encoding::ASCII_8BIT, val.encoding
+    assert_equal "caf\u00e9".force_encoding("binary"), val
+
+    connection.encoding = :utf8
+    val = connection.get(uniq_id)
+    assert_equal Encoding::UTF_8, val.encoding
+    assert_equal "caf\u00e9", val
+
+    assert_raises(ArgumentError) do
+      connection.encoding = :latin1
+    end
+  end
+
 end
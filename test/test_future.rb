@@ -0,0 +1,113 @@
+# Author:: Couchbase <info@couchbase.com>
+# Copyright:: 2012 Couchbase, Inc.
+# License:: Apache License, Version 2.0
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+require File.join(File.dirname(__FILE__), 'setup')
+
+class TestFuture < MiniTest::Unit::TestCase
+
+  def setup
+    @mock = start_mock
+  end
+
+  def teardown
+    stop_mock(@mock)
+  end
+
+  def test_it_returns_value_of_operation
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    f1 = connection.set_async(uniq_id, "foo")
+    refute f1.completed?
+    cas = f1.value
+    assert f1.completed?
+    assert_instance_of Fixnum, cas
+
+    f2 = connection.get_async(uniq_id)
+    assert_equal "foo", f2.value
+
+    f3 = connection.incr_async(uniq_id(:counter), :initial => 10)
+    assert_equal 10, f3.value
+  end
+
+  def test_wait_all
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    futures = 5.times.map{|ii| connection.set_async(uniq_id(ii), "val#{ii}")}
+    Couchbase::Future.wait_all(futures)
+    assert futures.all?{|f| f.completed?}
+
+    futures = 5.times.map{|ii| connection.get_async(uniq_id(ii))}
+    assert_equal 5.times.map{|ii| "val#{ii}"}, Couchbase::Future.wait_all(futures)
+  end
+
+  def test_multiple_keys
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    connection.set(uniq_id(1), "foo")
+    connection.set(uniq_id(2), "bar")
+    future = connection.get_async(uniq_id(1), uniq_id(2))
+    assert_equal({uniq_id(1) => "foo", uniq_id(2) => "bar"}, future.value)
+  end
+
+  def test_value_shape_follows_the_arguments
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    cas = connection.set_async(uniq_id(1) => "foo").value
+    assert_instance_of Hash, cas
+    assert_equal [uniq_id(1)], cas.keys
+
+    assert_equal({uniq_id(1) => "foo"}, connection.get_async([uniq_id(1)]).value)
+    assert_equal "foo", connection.get_async(uniq_id(1), :quiet => false).value
+  end
+
+  def test_it_stores_hash_as_value
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    connection.set_async(uniq_id, {"foo" => "bar"}).value
+    assert_equal({"foo" => "bar"}, connection.get(uniq_id))
+    connection.set_async(uniq_id, {"foo" => "baz"}, :ttl => 10).value
+    assert_equal({"foo" => "baz"}, connection.get(uniq_id))
+  end
+
+  # the event loop has been stopped before any response arrived
+  class StoppedBucket
+    def async_wait
+    end
+  end
+
+  def test_it_stays_pending_when_event_loop_stops_early
+    future = Couchbase::Future.new(StoppedBucket.new)
+    assert_raises(Couchbase::Error::Invalid) do
+      Couchbase::Future.wait_all(future)
+    end
+    refute future.completed?
+    future.call([])
+    assert future.completed?
+  end
+
+  def test_it_raises_error_on_value
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    future = connection.get_async(uniq_id(:missing))
+    assert_raises(Couchbase::Error::NotFound) do
+      future.value
+    end
+  end
+
+  def test_sync_operations_do_not_break_pending_futures
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    connection.set(uniq_id, "foo")
+    future = connection.get_async(uniq_id)
+    assert_equal "foo", connection.get(uniq_id)
+    assert_equal "foo", future.value
+  end
+
+end
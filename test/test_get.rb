@@ -404,4 +404,161 @@ class TestGet < MiniTest::Unit::TestCase
     expected = {uniq_id(1) => "foo", uniq_id(2) => "bar"}
     assert_equal expected, connection.get(uniq_id(1), uniq_id(2), :assemble_hash => true)
   end
+
+  def test_lazy_get_decodes_on_first_access
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    connection.set(uniq_id(1), {"name" => "foo"})
+    connection.set(uniq_id(2), "bar", :format => :plain)
+
+    res = connection.get(uniq_id(1), uniq_id(2), :lazy => true, :assemble_hash => true)
+    foo, bar = res.values_at(uniq_id(1), uniq_id(2))
+    assert_instance_of Couchbase::LazyValue, foo
+    refute foo.decoded?
+    assert_equal '{"name":"foo"}', foo.raw
+    assert_equal({"name" => "foo"}, foo.value)
+    assert foo.decoded?
+    assert_same foo.value, foo.value
+    assert_equal "bar", bar.value
+    assert_equal 0x02, bar.flags & 0x03
+  end
+
+  def test_lazy_get_raises_format_error_on_access
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    connection.set(uniq_id, "{broken", :format => :plain)
+    val = connection.get(uniq_id, :lazy => true, :format => :document)
+    assert_raises(Couchbase::Error::ValueFormat) do
+      val.value
+    end
+  end
+
+  def test_lazy_get_returns_nil_for_missing_keys
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    assert_nil connection.get(uniq_id, :lazy => true, :quiet => true)
+  end
+
+  def test_errors_as_codes_in_synchronous_mode
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port,
+                               :quiet => false, :errors => :codes)
+    assert_equal :codes, connection.errors
+    connection.set(uniq_id(1), "foo")
+    assert_nil connection.get(uniq_id(:missing))
+    assert_equal ["foo", nil], connection.get(uniq_id(1), uniq_id(:missing))
+    connection.errors = :exceptions
+    assert_raises(Couchbase::Error::NotFound) do
+      connection.get(uniq_id(:missing))
+    end
+    assert_nil connection.get(uniq_id(:missing), :errors => :codes)
+  end
+
+  def test_errors_as_codes_in_asynchronous_mode
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    connection.set(uniq_id(1), "foo")
+
+    res = {}
+    connection.run do
+      connection.get(uniq_id(1), uniq_id(:missing), :errors => :codes) do |ret|
+        res[ret.key] = ret
+      end
+    end
+    assert res[uniq_id(1)].success?
+    assert_equal :success, res[uniq_id(1)].error_code
+    missing = res[uniq_id(:missing)]
+    refute missing.success?
+    assert_equal :not_found, missing.error_code
+    assert_instance_of Couchbase::Error::NotFound, missing.error
+    assert_equal :get, missing.error.operation
+    assert_same missing.error, missing.error
+  end
+
+  def test_errors_option_validation
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    assert_raises(ArgumentError) do
+      connection.errors = :silent
+    end
+    assert_raises(ArgumentError) do
+      connection.get(uniq_id, :errors => :silent)
+    end
+  end
+
+  def test_asynchronous_get_yields_keys_passed_to_operation
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port,
+                               :key_prefix => "prefix:")
+    keys = (1..20).map { |ii| uniq_id(ii) }
+    connection.set(Hash[keys.zip(keys)])
+
+    seen = []
+    connection.run do
+      connection.get(keys + [:"#{uniq_id(:missing)}"], :quiet => true) do |ret|
+        seen << ret.key
+      end
+    end
+    assert_equal 21, seen.size
+    seen.each do |key|
+      assert_instance_of String, key
+      refute_match(/^prefix:/, key)
+    end
+    found = seen.select { |key| keys.include?(key) }
+    assert_equal 20, found.size
+    found.each do |key|
+      assert keys.any? { |kk| kk.equal?(key) }
+    end
+    assert_includes seen, uniq_id(:missing)
+  end
+
+  def test_multi_get_keeps_order_of_duplicate_and_missing_keys
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    connection.set(uniq_id(1), "foo")
+    connection.set(uniq_id(2), "bar")
+
+    keys = [uniq_id(2), uniq_id(:missing), uniq_id(1), uniq_id(2)]
+    assert_equal ["bar", nil, "foo", "bar"], connection.get(keys, :quiet => true)
+    assert_equal ["foo", "bar"], connection.get(uniq_id(1).to_sym, uniq_id(2).to_sym)
+
+    res = connection.get(keys, :quiet => true, :assemble_hash => true)
+    assert_equal({uniq_id(1) => "foo", uniq_id(2) => "bar"}, res)
+  end
+
+  def test_multi_get_of_many_keys
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    keys = (1..100).map { |ii| uniq_id(ii) }
+    connection.set(Hash[keys.zip(keys)])
+    assert_equal keys, connection.get(keys)
+    assert_equal keys.reverse, connection.get(keys.reverse)
+  end
+
+  def test_multi_get_of_keys_split_into_windows
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    keys = (1..10_000).map { |ii| uniq_id(ii) }
+    cas = connection.set(Hash[keys.zip(keys)])
+    assert_equal keys.size, cas.size
+    assert_equal keys, connection.get(keys)
+    assert_equal keys.reverse, connection.get(*keys.reverse)
+
+    res = connection.get(keys, :extended => true)
+    assert_equal keys.size, res.size
+    assert_equal [uniq_id(42), 0, cas[uniq_id(42)]], res[uniq_id(42)]
+
+    seen = []
+    connection.run do
+      connection.get(keys) { |ret| seen << ret.key }
+    end
+    assert_equal keys.sort, seen.sort
+    assert_equal keys.size, connection.delete(keys).size
+  end
+
+  def test_get_each_yields_pairs_by_windows
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    keys = (1..25).map { |ii| uniq_id(ii) }
+    connection.set(Hash[keys.zip(keys.map(&:upcase))])
+
+    pairs = []
+    connection.get_each(keys + [uniq_id(:missing)], :window => 10, :quiet => true) do |key, value|
+      pairs << [key, value]
+    end
+    assert_equal keys.zip(keys.map(&:upcase)) + [[uniq_id(:missing), nil]], pairs
+
+    enum = connection.get_each(keys.cycle, :window => 4)
+    assert_instance_of Enumerator, enum
+    assert_equal keys.first(6), enum.take(6).map(&:first)
+  end
 end
@@ -16,6 +16,7 @@
 #
 
 require File.join(File.dirname(__FILE__), 'setup')
+require 'stringio'
 
 class TestStore < MiniTest::Unit::TestCase
 
@@ -213,4 +214,124 @@ class TestStore < MiniTest::Unit::TestCase
     assert_equal ["bar", "foo"], connection.get(uniq_id(:a), uniq_id(:z))
     assert res.is_a?(Hash)
   end
+
+  def test_multi_store_with_options
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    res = connection.set({uniq_id(:a) => "foo", uniq_id(:z) => "bar"}, :format => :plain, :flags => 0x100)
+    assert_equal 2, res.size
+    res = connection.get(uniq_id(:a), uniq_id(:z), :extended => true)
+    assert_equal "foo", res[uniq_id(:a)][0]
+    assert_equal 0x100, res[uniq_id(:a)][1] & 0x100
+  end
+
+  def test_multi_store_of_documents_split_into_windows
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    # the windows are sized by the encoded documents, ~12MB in total
+    doc = {"body" => "x" * 100_000}
+    keys = (1..120).map { |ii| uniq_id(ii) }
+    cas = connection.set(Hash[keys.map { |key| [key, doc] }])
+    assert_equal keys.size, cas.size
+    assert keys.all? { |key| cas[key].is_a?(Integer) }
+
+    seen = []
+    connection.run do
+      connection.set(Hash[keys.map { |key| [key, doc] }], :batch_callback => true) do |results|
+        seen.concat(results.map { |ret| ret.key })
+      end
+    end
+    assert_equal keys.sort, seen.sort
+    assert_equal doc, connection.get(keys.last)
+  end
+
+  def test_bulk_load
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    lines = (1..25).map { |ii| MultiJson.dump("id" => uniq_id(ii), "num" => ii) }
+    assert_equal 25, connection.bulk_load(StringIO.new(lines.join("\n")), :window => 10)
+    assert_equal({"id" => uniq_id(7), "num" => 7}, connection.get(uniq_id(7)))
+
+    csv = StringIO.new("key,name\n#{uniq_id(:csv)},foo\n")
+    assert_equal 1, connection.bulk_load(csv, :format => :csv, :key_field => "key")
+    assert_equal({"key" => uniq_id(:csv), "name" => "foo"}, connection.get(uniq_id(:csv)))
+
+    assert_raises(ArgumentError) do
+      connection.bulk_load(StringIO.new(MultiJson.dump("name" => "foo")))
+    end
+  end
+
+  def test_bulk_load_stores_json_lines_as_is
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    lines = (1..5).map { |ii| %Q({"id": "#{uniq_id(ii)}",  "num": #{ii}}) }
+    assert_equal 5, connection.bulk_load(StringIO.new(lines.join("\n")), :window => 2)
+    assert_equal lines[2], connection.get(uniq_id(3), :format => :plain)
+    assert_equal({"id" => uniq_id(3), "num" => 3}, connection.get(uniq_id(3)))
+  end
+
+  def test_set_encoded_value
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    connection.set(uniq_id, '{"foo":"bar"}', :encoded => true)
+    assert_equal({"foo" => "bar"}, connection.get(uniq_id))
+    assert_raises(Couchbase::Error::ValueFormat) do
+      connection.set(uniq_id, {"foo" => "bar"}, :encoded => true)
+    end
+  end
+
+  def test_export
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    connection.set(uniq_id(:doc), {"name" => "foo"})
+    connection.set(uniq_id(:bin), "\xFF\x00bar", :format => :plain, :flags => 0x100)
+    view = StubView.new(connection, [
+      {"id" => uniq_id(:doc)},
+      {"id" => "_design/foo"},
+      {"id" => uniq_id(:missing)},
+      {"key" => "reduced"},
+      {"id" => uniq_id(:bin)}
+    ])
+    io = StringIO.new
+    assert_equal 2, connection.export(io, :view => view, :window => 2)
+    records = io.string.split("\n").map {|line| MultiJson.load(line)}
+    assert_equal [uniq_id(:doc), uniq_id(:bin)], records.map {|rec| rec["id"]}
+
+    doc, bin = records
+    assert_equal '{"name":"foo"}', doc["value"]
+    assert_equal Couchbase::Bucket::FMT_DOCUMENT, doc["flags"]
+    assert_equal connection.get(uniq_id(:doc), :extended => true)[2], doc["cas"]
+    refute bin.has_key?("value")
+    assert_equal "\xFF\x00bar", bin["base64"].unpack("m").first
+    assert_equal 0x100, bin["flags"]
+  end
+
+  def test_export_record
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    res = Couchbase::Result.new(:key => "foo", :value => "caf\xC3\xA9", :flags => 0, :cas => 42)
+    record = connection.send(:export_record, res)
+    assert_equal ["foo", 0, 42], record.values_at("id", "flags", "cas")
+    assert_equal "caf\xC3\xA9".unpack("C*"), record["value"].unpack("C*")
+    refute record.has_key?("base64")
+    res = Couchbase::Result.new(:key => "foo", :value => "\xC3(", :flags => 0, :cas => 42)
+    expected = {"id" => "foo", "flags" => 0, "cas" => 42, "base64" => "wyg="}
+    assert_equal expected, connection.send(:export_record, res)
+  end
+
+  def test_export_rejects_bad_window
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    assert_raises(ArgumentError) do
+      connection.export(StringIO.new, :view => StubView.new(connection, []), :window => 0)
+    end
+  end
+
+  def test_bulk_load_with_duplicate_keys
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    lines = [1, 2, 1].map { |ii| MultiJson.dump("id" => uniq_id(ii), "num" => ii) }
+    lines << MultiJson.dump("id" => uniq_id(1), "num" => 3)
+    assert_equal 4, connection.bulk_load(StringIO.new(lines.join("\n")))
+    assert_equal 3, connection.get(uniq_id(1))["num"]
+    assert_equal 2, connection.get(uniq_id(2))["num"]
+  end
+
+  def test_bulk_load_with_thread_safe_connection
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port, :thread_safe => true)
+    lines = (1..5).map { |ii| MultiJson.dump("id" => uniq_id(ii), "num" => ii) }
+    assert_equal 5, connection.bulk_load(StringIO.new(lines.join("\n")), :window => 2)
+    assert_equal 5, connection.get(uniq_id(5))["num"]
+  end
 end
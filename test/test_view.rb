@@ -0,0 +1,139 @@
+# Author:: Couchbase <info@couchbase.com>
+# Copyright:: 2012 Couchbase, Inc.
+# License:: Apache License, Version 2.0
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+require File.join(File.dirname(__FILE__), 'setup')
+
+class TestView < MiniTest::Unit::TestCase
+
+  def setup
+    @mock = start_mock
+  end
+
+  def teardown
+    stop_mock(@mock)
+  end
+
+  # Records the moments when the rows are streamed
+  class LoggingView < StubView
+    attr_accessor :log
+
+    def fetch(params = {})
+      super(params) do |row|
+        @log << [:row, row.id]
+        yield row
+      end
+    end
+  end
+
+  def stub_views(connection)
+    [StubView.new(connection, [{"id" => "a1", "key" => 1}, {"id" => "a2", "key" => 2}]),
+     StubView.new(connection, [{"id" => "b1", "key" => 3}])]
+  end
+
+  def test_fetch_all_returns_rows_of_each_view
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    a, b = stub_views(connection)
+    res = Couchbase::View.fetch_all([a, b])
+    assert_equal [["a1", "a2"], ["b1"]], res.map {|rows| rows.map {|row| row.id}}
+    assert_equal [], Couchbase::View.fetch_all([])
+  end
+
+  def test_fetch_all_yields_view_and_row
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    a, b = stub_views(connection)
+    seen = []
+    assert_nil Couchbase::View.fetch_all([a, b]) {|view, row| seen << [view, row.id]}
+    assert_equal [[a, "a1"], [a, "a2"], [b, "b1"]], seen
+  end
+
+  def test_fetch_all_routes_rows_to_handlers_of_views
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    a, b = stub_views(connection)
+    a_rows, b_rows = [], []
+    handlers = {a => lambda {|row| a_rows << row.key}, b => lambda {|row| b_rows << row.key}}
+    assert_nil Couchbase::View.fetch_all(handlers)
+    assert_equal [1, 2], a_rows
+    assert_equal [3], b_rows
+  end
+
+  def test_fetch_all_on_thread_safe_connection
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port,
+                               :thread_safe => true)
+    a, b = stub_views(connection)
+    a_rows = []
+    handlers = {a => lambda {|row| a_rows << row.id}, b => nil}
+    seen = []
+    Couchbase::View.fetch_all(handlers) {|view, row| seen << [view, row.id]}
+    assert_equal ["a1", "a2"], a_rows
+    assert_equal [[b, "b1"]], seen
+  end
+
+  def docs_rows(connection)
+    connection.set(uniq_id(:a), {"n" => 1})
+    connection.set(uniq_id(:c), {"n" => 3})
+    connection.set(uniq_id(:e), {"n" => 5})
+    [:a, :b, :c, :d, :e].map {|sfx| {"id" => uniq_id(sfx), "key" => sfx.to_s}} +
+      [{"key" => "reduced"}]
+  end
+
+  def test_each_with_docs
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    view = StubView.new(connection, docs_rows(connection))
+    pairs = []
+    assert_nil view.each_with_docs(:batch => 2) {|row, doc| pairs << [row.key, doc]}
+    expected = [["a", {"n" => 1}], ["b", nil], ["c", {"n" => 3}], ["d", nil],
+                ["e", {"n" => 5}], ["reduced", nil]]
+    assert_equal expected, pairs
+    assert_equal expected, view.each_with_docs(:batch => 4).map {|row, doc| [row.key, doc]}
+  end
+
+  def test_each_with_docs_flushes_batches_while_streaming
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port,
+                               :thread_safe => true)
+    rows = docs_rows(connection)
+    a, b, c, d, e, reduced = rows.map {|data| data["id"]}
+    view = LoggingView.new(connection, rows)
+    view.log = log = []
+    view.each_with_docs(:batch => 2) {|row, doc| log << [:doc, row.id]}
+    expected = [[:row, a], [:row, b], [:doc, a], [:doc, b],
+                [:row, c], [:row, d], [:doc, c], [:doc, d],
+                [:row, e], [:row, reduced], [:doc, e], [:doc, reduced]]
+    assert_equal expected, log
+  end
+
+  def test_each_with_docs_checks_arguments
+    connection = Couchbase.new(:hostname => @mock.host, :port => @mock.port)
+    view = StubView.new(connection, [])
+    assert_raises(ArgumentError) do
+      view.each_with_docs(:batch => 0) {}
+    end
+    connection.run do
+      assert_raises(ArgumentError) do
+        view.each_with_docs {}
+      end
+    end
+  end
+
+  def test_fetch_all_requires_the_same_connection
+    a, _ = stub_views(Couchbase.new(:hostname => @mock.host, :port => @mock.port))
+    _, b = stub_views(Couchbase.new(:hostname => @mock.host, :port => @mock.port))
+    assert_raises(ArgumentError) do
+      Couchbase::View.fetch_all([a, b])
+    end
+  end
+
+end
@@ -0,0 +1,108 @@
+# Author:: Couchbase <info@couchbase.com>
+# Copyright:: 2012 Couchbase, Inc.
+# License:: Apache License, Version 2.0
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+require File.join(File.dirname(__FILE__), 'setup')
+
+class TestViewRows < MiniTest::Unit::TestCase
+
+  BODY = <<-EOJ
+{"total_rows":3,"rows":[
+{"id":"a\\"}","key":["x",{"n":1}],"value":null},
+{"id":"b\\\\","key":"[{\\u0041","value":[1,2]}
+],
+"errors":[{"from":"node1","reason":"timeout"}]
+}
+  EOJ
+
+  EXPECTED = [
+    [:total_rows, 3],
+    [:rows, {"id" => "a\"}", "key" => ["x", {"n" => 1}], "value" => nil}],
+    [:rows, {"id" => "b\\", "key" => "[{A", "value" => [1, 2]}],
+    [:errors, {"from" => "node1", "reason" => "timeout"}]
+  ]
+
+  def feed(*chunks)
+    parser = Couchbase::ViewRowsParser.new
+    chunks.inject([]) { |items, chunk| items.concat(parser.feed(chunk)) }
+  end
+
+  def test_whole_body
+    assert_equal EXPECTED, feed(BODY)
+  end
+
+  def test_body_split_at_every_position
+    (1...BODY.size).each do |ii|
+      assert_equal EXPECTED, feed(BODY[0, ii], BODY[ii..-1]), "split at #{ii}"
+    end
+  end
+
+  def test_body_fed_by_single_bytes
+    assert_equal EXPECTED, feed(*BODY.split(//))
+  end
+
+  def test_escapes_at_chunk_boundaries
+    # the chunk ends with the backslash, the escaped quote starts the next one
+    assert_equal [[:rows, {"id" => "a\"b"}]], feed('{"rows":[{"id":"a\\', '"b"}]}')
+    assert_equal [[:rows, {"id" => "a\\"}]], feed('{"rows":[{"id":"a\\', '\\"}]}')
+  end
+
+  def test_items_are_emitted_as_soon_as_completed
+    parser = Couchbase::ViewRowsParser.new
+    assert_equal [], parser.feed('{"rows":[{"id":"a","value":{"n')
+    assert_equal [[:rows, {"id" => "a", "value" => {"n" => 1}}]], parser.feed('":1}},{"id"')
+    assert_equal [[:rows, {"id" => "b"}]], parser.feed(':"b"}]}')
+  end
+
+  def test_total_rows_as_the_last_key
+    assert_equal [[:rows, {"id" => "a"}], [:total_rows, 7]],
+      feed('{"rows":[{"id":"a"}],"total_rows":', '7}')
+  end
+
+  def test_keys_of_rows_are_not_sections
+    assert_equal [[:rows, {"rows" => [{"errors" => 1}], "total_rows" => 2}]],
+      feed('{"rows":[{"rows":[{"errors":1}],"total_rows":2}]}')
+  end
+
+  def test_errors_only
+    body = '{"total_rows":0,"rows":[],"errors":[{"from":"local","reason":"missing"}]}'
+    assert_equal [[:total_rows, 0], [:errors, {"from" => "local", "reason" => "missing"}]], feed(body)
+  end
+
+  def test_non_200_error_body
+    # the error is reported by the request status, the body has no rows
+    assert_equal [], feed('{"error":"not_found","reason":"missing_named_view"}')
+  end
+
+  def test_broken_row_is_passed_as_string
+    assert_equal [[:rows, '{"id":"a",}']], feed('{"rows":[{"id":"a",}]}')
+  end
+
+  def test_multi_json_backend_receives_raw_rows
+    Couchbase.json_backend = :multi_json
+    assert_equal [[:total_rows, "1"], [:rows, '{"id":"a"}']],
+      feed('{"total_rows":1,"rows":[{"id":"a"}]}')
+  ensure
+    Couchbase.json_backend = :native
+  end
+
+  def test_it_accepts_only_strings
+    assert_raises(TypeError) do
+      Couchbase::ViewRowsParser.new.feed(nil)
+    end
+  end
+
+end